@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_writer.hpp"
+#include "failure_policy.hpp"
+
+//--------------------------------------------------
+
+static std::string directory_of(const std::string& path)
+{
+	const size_t slash = path.find_last_of('/');
+	if ( slash == std::string::npos )
+	{
+		return ".";
+	}
+	return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+//--------------------------------------------------
+
+AsyncFileWriter::AsyncFileWriter(int numThreads, size_t queueDepth, int fsyncBatch, int maxRetries, int retryDelayMs,
+	const Callback& callback)
+	: fsyncBatch(std::max(0, fsyncBatch)), maxRetries(std::max(0, maxRetries)), retryDelayMs(std::max(0, retryDelayMs)),
+	  callback(callback), queue(queueDepth), finished(false), outstanding(0), stopRetries(false)
+{
+	for ( int t = 0; t < std::max(1, numThreads); t++ )
+	{
+		threads.push_back(std::thread([this] { run(); }));
+	}
+	if ( this->maxRetries > 0 )
+	{
+		retryThread = std::thread([this] { runRetries(); });
+	}
+}
+
+//--------------------------------------------------
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	finish();
+}
+
+//--------------------------------------------------
+
+bool AsyncFileWriter::submit(const std::string& path, std::vector<unsigned char>& data, const std::string& tag)
+{
+	Job job;
+	job.path = path;
+	job.tag = tag;
+	job.data = std::make_shared<std::vector<unsigned char> >();
+	job.data->swap(data);
+	job.attempts = 0;
+	{
+		std::lock_guard<std::mutex> lock(retryMutex);
+		outstanding++;
+	}
+	if ( !queue.push(job) )
+	{
+		jobDone();
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+void AsyncFileWriter::jobDone()
+{
+	std::lock_guard<std::mutex> lock(retryMutex);
+	outstanding--;
+	retryChanged.notify_all();
+}
+
+//--------------------------------------------------
+
+void AsyncFileWriter::finish()
+{
+	if ( finished )
+	{
+		return;
+	}
+	finished = true;
+	if ( retryThread.joinable() )
+	{
+		// Retries go back through the queue, so it stays open until the last file is reported.
+		{
+			std::unique_lock<std::mutex> lock(retryMutex);
+			retryChanged.wait(lock, [this] { return outstanding == 0; });
+			stopRetries = true;
+			retryChanged.notify_all();
+		}
+		retryThread.join();
+	}
+	queue.close();
+	for ( size_t t = 0; t < threads.size(); t++ )
+	{
+		threads[t].join();
+	}
+}
+
+//--------------------------------------------------
+
+void AsyncFileWriter::run()
+{
+	Pending pending;
+	Job job;
+	while ( queue.pop(job) )
+	{
+		std::string problem;
+		job.attempts++;
+		if ( !writeFile(job, pending, problem) && job.attempts <= maxRetries )
+		{
+			const Clock::time_point due = Clock::now()
+				+ std::chrono::milliseconds(failureRetryDelayMs(retryDelayMs, job.attempts));
+			std::lock_guard<std::mutex> lock(retryMutex);
+			retries.insert(std::make_pair(due, job));
+			retryChanged.notify_all();
+			continue;
+		}
+		job.data.reset();
+		if ( callback )
+		{
+			Report report;
+			report.path = job.path;
+			report.tag = job.tag;
+			report.synced = false;
+			report.problem = problem;
+			report.attempts = job.attempts;
+			callback(report);
+		}
+		jobDone();
+		if ( fsyncBatch > 0 && (int) pending.fds.size() >= fsyncBatch )
+		{
+			syncPending(pending);
+		}
+	}
+	syncPending(pending);
+}
+
+//--------------------------------------------------
+// Moves the files of the retry queue back to the writer threads as they fall due.
+//--------------------------------------------------
+
+void AsyncFileWriter::runRetries()
+{
+	std::unique_lock<std::mutex> lock(retryMutex);
+	while ( !stopRetries )
+	{
+		if ( retries.empty() )
+		{
+			retryChanged.wait(lock);
+			continue;
+		}
+		if ( retryChanged.wait_until(lock, retries.begin()->first) != std::cv_status::timeout
+			|| retries.empty() || retries.begin()->first > Clock::now() )
+		{
+			continue;
+		}
+		const Job job = retries.begin()->second;
+		retries.erase(retries.begin());
+		lock.unlock();
+		// Blocks while the queue is full; the writer threads drain it.
+		queue.push(job);
+		lock.lock();
+	}
+}
+
+//--------------------------------------------------
+
+bool AsyncFileWriter::writeFile(const Job& job, Pending& pending, std::string& problem)
+{
+	const std::string partPath = job.path + ".part";
+	const int fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if ( fd < 0 )
+	{
+		problem = "cannot create '" + partPath + "': " + strerror(errno);
+		return false;
+	}
+
+	const unsigned char * p = job.data->empty() ? NULL : &(*job.data)[0];
+	size_t left = job.data->size();
+	while ( left > 0 )
+	{
+		const ssize_t n = write(fd, p, left);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			problem = "cannot write '" + partPath + "': " + strerror(n < 0 ? errno : ENOSPC);
+			close(fd);
+			unlink(partPath.c_str());
+			return false;
+		}
+		p += n;
+		left -= (size_t) n;
+	}
+
+	if ( fsyncBatch > 0 )
+	{
+		// Start the writeback now; syncPending() then mostly finds it done.
+		sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+	}
+	if ( rename(partPath.c_str(), job.path.c_str()) != 0 )
+	{
+		problem = "cannot rename '" + partPath + "': " + strerror(errno);
+		close(fd);
+		unlink(partPath.c_str());
+		return false;
+	}
+	if ( fsyncBatch > 0 )
+	{
+		Report report;
+		report.path = job.path;
+		report.tag = job.tag;
+		report.synced = true;
+		report.attempts = job.attempts;
+		pending.reports.push_back(report);
+		pending.fds.push_back(fd);
+	}
+	else
+	{
+		close(fd);
+	}
+	return true;
+}
+
+//--------------------------------------------------
+// The data of every file of the batch, then the directory entries the renames created.
+//--------------------------------------------------
+
+void AsyncFileWriter::syncPending(Pending& pending)
+{
+	if ( pending.fds.empty() )
+	{
+		return;
+	}
+	std::set<std::string> directories;
+	for ( size_t i = 0; i < pending.fds.size(); i++ )
+	{
+		Report& report = pending.reports[i];
+		if ( fdatasync(pending.fds[i]) != 0 )
+		{
+			report.problem = "cannot sync '" + report.path + "': " + strerror(errno);
+		}
+		close(pending.fds[i]);
+		directories.insert(directory_of(report.path));
+	}
+	for ( std::set<std::string>::const_iterator it = directories.begin(); it != directories.end(); ++it )
+	{
+		const int fd = open(it->c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if ( fd >= 0 )
+		{
+			fsync(fd);
+			close(fd);
+		}
+	}
+	if ( callback )
+	{
+		for ( size_t i = 0; i < pending.reports.size(); i++ )
+		{
+			callback(pending.reports[i]);
+		}
+	}
+	pending.reports.clear();
+	pending.fds.clear();
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,118 @@
+#ifndef FLATTEN_ASYNC_WRITER_HPP
+#define FLATTEN_ASYNC_WRITER_HPP
+
+#include <stddef.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+
+//--------------------------------------------------
+// Writes encoded files on threads of its own, so the encoders go on with the next frame while the
+// previous one is on its way to the disk, and reads and writes overlap instead of alternating.
+//
+// submit() queues a file and returns at once; it blocks only while the queue is full, which bounds the
+// encoded files held in memory. Each file is written under a temporary name (path + ".part") and
+// renamed when complete, so a path either does not exist or holds a whole file.
+//
+// With fsyncBatch > 0, each writer thread starts the writeback of every file right away
+// (sync_file_range()) but only waits for it every fsyncBatch files: it then syncs the data of the
+// batch and the directories the files went to. Until then, a crash can lose the files of the last
+// batch. With fsyncBatch = 0, nothing is synced and the kernel writes back in its own time.
+//
+// With maxRetries > 0, a file that cannot be written goes to a retry queue and back to the writer
+// threads after retryDelayMs, then twice that, and so on (failureRetryDelayMs()); the writer threads
+// meanwhile go on with the other files.
+//--------------------------------------------------
+
+class AsyncFileWriter
+{
+public:
+	// What the callback gets, on a writer thread, after each file: an empty problem if the file was
+	// written. It is called again with synced set once the batch of the file has been synced
+	// (fsyncBatch > 0 only). A file that is retried is reported once, after its last attempt.
+	struct Report
+	{
+		std::string path;
+		std::string tag;     // as passed to submit()
+		bool synced;
+		std::string problem;
+		int attempts;        // counting the first one
+	};
+
+	typedef std::function<void(const Report& report)> Callback;
+
+	AsyncFileWriter(int numThreads, size_t queueDepth, int fsyncBatch, int maxRetries, int retryDelayMs,
+		const Callback& callback);
+
+	// Waits for the queued files; see finish().
+	~AsyncFileWriter();
+
+	//--------------------------------------------------
+
+	// Takes the content of data, leaving it empty; tag is handed back in the reports of the file.
+	// Returns false after finish().
+	bool submit(const std::string& path, std::vector<unsigned char>& data, const std::string& tag = std::string());
+
+	// Writes and syncs everything queued, retries included, then stops the threads.
+	void finish();
+
+	//--------------------------------------------------
+
+private:
+	AsyncFileWriter(const AsyncFileWriter&);
+	AsyncFileWriter& operator=(const AsyncFileWriter&);
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Job
+	{
+		std::string path;
+		std::shared_ptr<std::vector<unsigned char> > data;
+		std::string tag;
+		int attempts;
+	};
+
+	// Files written but not synced yet, per writer thread.
+	struct Pending
+	{
+		std::vector<Report> reports;
+		std::vector<int> fds;
+	};
+
+	void run();
+	void runRetries();
+	bool writeFile(const Job& job, Pending& pending, std::string& problem);
+	void syncPending(Pending& pending);
+	void jobDone();
+
+	const int fsyncBatch;
+	const int maxRetries;
+	const int retryDelayMs;
+	const Callback callback;
+	BoundedQueue<Job> queue;
+	std::vector<std::thread> threads;
+	bool finished;
+
+	// Files submitted and not reported yet, and the ones waiting for their next attempt by due time.
+	std::mutex retryMutex;
+	std::condition_variable retryChanged;
+	size_t outstanding;
+	std::multimap<Clock::time_point, Job> retries;
+	bool stopRetries;
+	std::thread retryThread;
+};
+
+#endif // FLATTEN_ASYNC_WRITER_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
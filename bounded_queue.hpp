@@ -0,0 +1,164 @@
+#ifndef FLATTEN_BOUNDED_QUEUE_HPP
+#define FLATTEN_BOUNDED_QUEUE_HPP
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+//--------------------------------------------------
+// Blocking FIFO with a fixed capacity, used to connect the stages of the processing pipelines.
+//
+// push() blocks while the queue is full, which is what bounds the number of frames in flight.
+// close() wakes everybody up: push() then fails, and pop() fails once the queue is drained.
+//--------------------------------------------------
+
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+	//--------------------------------------------------
+
+	bool push(const T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+		if ( closed )
+		{
+			return false;
+		}
+		items.push_back(item);
+		notEmpty.notify_one();
+		return true;
+	}
+
+	//--------------------------------------------------
+
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+		if ( items.empty() )
+		{
+			return false;
+		}
+		item = items.front();
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	//--------------------------------------------------
+
+	// Waits until max items are queued (or the queue is closed), then takes up to max items.
+	// Returns false once the queue is closed and drained.
+	bool popBatch(std::vector<T>& batch, size_t max)
+	{
+		batch.clear();
+		const size_t wanted = std::min(std::max(max, (size_t) 1), capacity);
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this, wanted] { return closed || items.size() >= wanted; });
+		while ( !items.empty() && batch.size() < wanted )
+		{
+			batch.push_back(items.front());
+			items.pop_front();
+		}
+		notFull.notify_all();
+		if ( !items.empty() )
+		{
+			notEmpty.notify_one(); // enough may be left for another waiting consumer
+		}
+		return !batch.empty();
+	}
+
+	//--------------------------------------------------
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+	//--------------------------------------------------
+
+private:
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+
+	const size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+
+};
+
+//--------------------------------------------------
+// Counting semaphore that bounds the frames between two stages that are not directly connected by a
+// BoundedQueue: the producer acquires a slot per frame, the consumer releases it when the frame is gone.
+// close() wakes everybody up; acquire() then fails.
+//--------------------------------------------------
+
+class CountingGate
+{
+public:
+	explicit CountingGate(size_t slots) : available(slots > 0 ? slots : 1), closed(false) {}
+
+	//--------------------------------------------------
+
+	bool acquire()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		released.wait(lock, [this] { return closed || available > 0; });
+		if ( closed )
+		{
+			return false;
+		}
+		--available;
+		return true;
+	}
+
+	//--------------------------------------------------
+
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++available;
+		released.notify_one();
+	}
+
+	//--------------------------------------------------
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		released.notify_all();
+	}
+
+	//--------------------------------------------------
+
+private:
+	CountingGate(const CountingGate&);
+	CountingGate& operator=(const CountingGate&);
+
+	size_t available;
+	bool closed;
+	std::mutex mutex;
+	std::condition_variable released;
+
+};
+
+#endif // FLATTEN_BOUNDED_QUEUE_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,247 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "buffer_pool.hpp"
+
+//--------------------------------------------------
+
+#define CONST_INT__HUGE_PAGE_SIZE    (2 * 1024 * 1024)
+
+// UMatData::allocatorFlags_ of buffers that come from take()
+#define CONST_INT__POOLED_BUFFER     1
+
+//--------------------------------------------------
+
+static size_t round_to_huge_pages(size_t bytes)
+{
+	return (bytes + CONST_INT__HUGE_PAGE_SIZE - 1) & ~((size_t) CONST_INT__HUGE_PAGE_SIZE - 1);
+}
+
+//--------------------------------------------------
+// mmap() returns 4K aligned memory; map one huge page more and trim both ends to get a 2 MB boundary.
+//--------------------------------------------------
+
+static void * map_huge_page_aligned(size_t bytes)
+{
+	const size_t length = bytes + CONST_INT__HUGE_PAGE_SIZE;
+	uchar * p = (uchar *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( p == (uchar *) MAP_FAILED )
+	{
+		return NULL;
+	}
+	uchar * aligned = (uchar *) round_to_huge_pages((size_t) p);
+	const size_t head = (size_t) (aligned - p);
+	if ( head > 0 )
+	{
+		munmap(p, head);
+	}
+	const size_t tail = length - head - bytes;
+	if ( tail > 0 )
+	{
+		munmap(aligned + bytes, tail);
+	}
+	return aligned;
+}
+
+//--------------------------------------------------
+
+PooledMatAllocator * PooledMatAllocator::create(size_t minPooledBytes, size_t maxMappedBytes)
+{
+	return new PooledMatAllocator(minPooledBytes, maxMappedBytes);
+}
+
+//--------------------------------------------------
+
+PooledMatAllocator::PooledMatAllocator(size_t minPooledBytes, size_t maxMappedBytes)
+	: minPooledBytes(minPooledBytes), maxMappedBytes(maxMappedBytes)
+{
+	memset(&counters, 0, sizeof(counters));
+}
+
+//--------------------------------------------------
+
+void * PooledMatAllocator::take(size_t bytes) const
+{
+	const size_t rounded = round_to_huge_pages(bytes);
+	std::vector<std::pair<void *, size_t> > evicted;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<size_t, std::vector<void *> >::iterator it = freeLists.find(rounded);
+		if ( it != freeLists.end() && !it->second.empty() )
+		{
+			void * p = it->second.back();
+			it->second.pop_back();
+			counters.cachedBytes -= rounded;
+			++counters.hits;
+			return p;
+		}
+
+		// Beyond the limit even with every free buffer dropped, the buffer is left to cv::fastMalloc().
+		// Otherwise free buffers of other sizes are dropped, largest first, until it fits.
+		if ( counters.mappedBytes - counters.cachedBytes + rounded > maxMappedBytes )
+		{
+			++counters.overLimit;
+			return NULL;
+		}
+		std::map<size_t, std::vector<void *> >::reverse_iterator rit = freeLists.rbegin();
+		while ( counters.mappedBytes + rounded > maxMappedBytes && rit != freeLists.rend() )
+		{
+			if ( rit->second.empty() )
+			{
+				++rit;
+				continue;
+			}
+			evicted.push_back(std::make_pair(rit->second.back(), rit->first));
+			rit->second.pop_back();
+			counters.cachedBytes -= rit->first;
+			counters.mappedBytes -= rit->first;
+		}
+		++counters.misses;
+		counters.mappedBytes += rounded;
+	}
+	for ( size_t i = 0; i < evicted.size(); i++ )
+	{
+		munmap(evicted[i].first, evicted[i].second);
+	}
+
+	void * p = map_huge_page_aligned(rounded);
+	if ( p == NULL )
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.mappedBytes -= rounded;
+		return NULL;
+	}
+	if ( madvise(p, rounded, MADV_HUGEPAGE) != 0 )
+	{
+		// No transparent huge page support; the buffer is still recycled.
+		std::lock_guard<std::mutex> lock(mutex);
+		++counters.hugePageAdviceFailures;
+	}
+	return p;
+}
+
+//--------------------------------------------------
+
+void PooledMatAllocator::give(void * p, size_t bytes) const
+{
+	// Free buffers stay mapped and counted against maxMappedBytes until take() needs the room.
+	const size_t rounded = round_to_huge_pages(bytes);
+	std::lock_guard<std::mutex> lock(mutex);
+	freeLists[rounded].push_back(p);
+	counters.cachedBytes += rounded;
+}
+
+//--------------------------------------------------
+// Same as OpenCV's StdMatAllocator, with the buffer coming from take() when it is large enough.
+//--------------------------------------------------
+
+#if CV_VERSION_MAJOR >= 4
+cv::UMatData * PooledMatAllocator::allocate(int dims, const int * sizes, int type, void * data0, size_t * step,
+	cv::AccessFlag /*flags*/, cv::UMatUsageFlags /*usageFlags*/) const
+#else
+cv::UMatData * PooledMatAllocator::allocate(int dims, const int * sizes, int type, void * data0, size_t * step,
+	int /*flags*/, cv::UMatUsageFlags /*usageFlags*/) const
+#endif
+{
+	size_t total = CV_ELEM_SIZE(type);
+	for ( int i = dims - 1; i >= 0; i-- )
+	{
+		if ( step )
+		{
+			if ( data0 && step[i] != CV_AUTOSTEP )
+			{
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			}
+			else
+			{
+				step[i] = total;
+			}
+		}
+		total *= sizes[i];
+	}
+
+	uchar * data = (uchar *) data0;
+	bool pooled = false;
+	if ( data == NULL )
+	{
+		if ( total >= minPooledBytes )
+		{
+			data = (uchar *) take(total);
+			pooled = data != NULL;
+		}
+		if ( data == NULL )
+		{
+			data = (uchar *) cv::fastMalloc(total);
+		}
+		if ( data == NULL )
+		{
+			CV_Error(cv::Error::StsNoMem, "PooledMatAllocator: out of memory");
+		}
+	}
+	cv::UMatData * u = new cv::UMatData(this);
+	u->data = u->origdata = data;
+	u->size = total;
+	u->allocatorFlags_ = pooled ? CONST_INT__POOLED_BUFFER : 0;
+	if ( data0 )
+	{
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+	}
+	return u;
+}
+
+//--------------------------------------------------
+
+#if CV_VERSION_MAJOR >= 4
+bool PooledMatAllocator::allocate(cv::UMatData * u, cv::AccessFlag /*accessFlags*/, cv::UMatUsageFlags /*usageFlags*/) const
+#else
+bool PooledMatAllocator::allocate(cv::UMatData * u, int /*accessFlags*/, cv::UMatUsageFlags /*usageFlags*/) const
+#endif
+{
+	return u != NULL;
+}
+
+//--------------------------------------------------
+
+void PooledMatAllocator::deallocate(cv::UMatData * u) const
+{
+	if ( u == NULL )
+	{
+		return;
+	}
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+	if ( !(u->flags & cv::UMatData::USER_ALLOCATED) )
+	{
+		if ( u->allocatorFlags_ & CONST_INT__POOLED_BUFFER )
+		{
+			give(u->origdata, u->size);
+		}
+		else
+		{
+			cv::fastFree(u->origdata);
+		}
+		u->origdata = 0;
+	}
+	delete u;
+}
+
+//--------------------------------------------------
+
+PooledMatAllocator::Stats PooledMatAllocator::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
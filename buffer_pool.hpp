@@ -0,0 +1,85 @@
+#ifndef FLATTEN_BUFFER_POOL_HPP
+#define FLATTEN_BUFFER_POOL_HPP
+
+#include <stddef.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+//--------------------------------------------------
+// cv::Mat allocator that recycles large buffers.
+//
+// Every frame of a run has the same size, so the decoded frame, the remapped frame and the encoder's
+// input are allocated and freed over and over. Buffers of at least minPooledBytes are kept on a free
+// list keyed by size after their Mat is released, and handed out again to the next Mat of that size,
+// instead of going back to the kernel and being page-faulted in once more.
+//
+// Pooled buffers are mmap()ed at a 2 MB boundary, rounded up to whole 2 MB pages, and marked with
+// madvise(MADV_HUGEPAGE) so transparent huge pages can back them: a 4K frame then needs a dozen TLB
+// entries instead of several thousand. The maps are built through the same allocator and get the same
+// treatment. Smaller buffers go to cv::fastMalloc() as usual.
+//
+// maxMappedBytes bounds all the memory the pool maps, buffers in use included. When a new buffer would
+// go beyond it, free buffers of other sizes are unmapped to make room; if that is not enough, the buffer
+// comes from cv::fastMalloc() instead, without the huge pages and without being recycled.
+//
+// Install it with cv::Mat::setDefaultAllocator() before the first frame is allocated. It is never
+// destroyed, so Mats released during static destruction still find it.
+//--------------------------------------------------
+
+class PooledMatAllocator : public cv::MatAllocator
+{
+public:
+	static PooledMatAllocator * create(size_t minPooledBytes, size_t maxMappedBytes);
+
+#if CV_VERSION_MAJOR >= 4
+	cv::UMatData * allocate(int dims, const int * sizes, int type, void * data, size_t * step,
+		cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const CV_OVERRIDE;
+	bool allocate(cv::UMatData * u, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const CV_OVERRIDE;
+#else
+	cv::UMatData * allocate(int dims, const int * sizes, int type, void * data, size_t * step,
+		int flags, cv::UMatUsageFlags usageFlags) const CV_OVERRIDE;
+	bool allocate(cv::UMatData * u, int accessFlags, cv::UMatUsageFlags usageFlags) const CV_OVERRIDE;
+#endif
+	void deallocate(cv::UMatData * u) const CV_OVERRIDE;
+
+	struct Stats
+	{
+		size_t hits;           // pooled allocations served from the free lists
+		size_t misses;         // pooled allocations that had to map new memory
+		size_t overLimit;      // large allocations left to cv::fastMalloc() because of maxMappedBytes
+		size_t mappedBytes;    // currently mapped, in use or free
+		size_t cachedBytes;    // currently on the free lists
+		size_t hugePageAdviceFailures;
+	};
+
+	Stats stats() const;
+
+	//--------------------------------------------------
+
+private:
+	PooledMatAllocator(size_t minPooledBytes, size_t maxMappedBytes);
+	PooledMatAllocator(const PooledMatAllocator&);
+	PooledMatAllocator& operator=(const PooledMatAllocator&);
+
+	// NULL if the buffer would go beyond maxMappedBytes, or if mmap() fails.
+	void * take(size_t bytes) const;
+	void give(void * p, size_t bytes) const;
+
+	const size_t minPooledBytes;
+	const size_t maxMappedBytes;
+
+	mutable std::mutex mutex;
+	mutable std::map<size_t, std::vector<void *> > freeLists;  // key: rounded size
+	mutable Stats counters;
+
+};
+
+#endif // FLATTEN_BUFFER_POOL_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
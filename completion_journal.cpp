@@ -0,0 +1,146 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "completion_journal.hpp"
+
+//--------------------------------------------------
+
+CompletionJournal::CompletionJournal()
+	: fd(-1), fsyncBatch(0), unsynced(0)
+{
+}
+
+//--------------------------------------------------
+
+CompletionJournal::~CompletionJournal()
+{
+	close();
+}
+
+//--------------------------------------------------
+
+bool CompletionJournal::open(const std::string& path, bool resume, int fsyncBatch, std::string& problem)
+{
+	close();
+	loaded.clear();
+	loadedSet.clear();
+	filePath = path;
+	this->fsyncBatch = fsyncBatch;
+	unsynced = 0;
+
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0666);
+	if ( fd < 0 )
+	{
+		problem = "cannot open '" + path + "': " + strerror(errno);
+		return false;
+	}
+	if ( !resume )
+	{
+		return true;
+	}
+
+	std::string content;
+	char buffer[65536];
+	for(;;)
+	{
+		const ssize_t n = read(fd, buffer, sizeof(buffer));
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n < 0 )
+		{
+			problem = "cannot read '" + path + "': " + strerror(errno);
+			close();
+			return false;
+		}
+		if ( n == 0 )
+		{
+			break;
+		}
+		content.append(buffer, (size_t) n);
+	}
+
+	size_t start = 0;
+	size_t end;
+	while ( (end = content.find('\n', start)) != std::string::npos )
+	{
+		if ( end > start )
+		{
+			loaded.push_back(content.substr(start, end - start));
+			loadedSet.insert(loaded.back());
+		}
+		start = end + 1;
+	}
+	if ( start < content.size() && ftruncate(fd, (off_t) start) != 0 )
+	{
+		// The line cut short stays, and the next entry would be glued to it.
+		problem = "cannot truncate '" + path + "': " + strerror(errno);
+		close();
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+void CompletionJournal::add(const std::string& entry)
+{
+	const std::string line = entry + "\n";
+	std::lock_guard<std::mutex> lock(mutex);
+	if ( fd < 0 )
+	{
+		return;
+	}
+	const char * p = line.data();
+	size_t left = line.size();
+	while ( left > 0 )
+	{
+		const ssize_t n = write(fd, p, left);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			// The entry is lost, which only means that a resumed run does its work again.
+			return;
+		}
+		p += n;
+		left -= (size_t) n;
+	}
+	if ( fsyncBatch > 0 && ++unsynced >= fsyncBatch )
+	{
+		fdatasync(fd);
+		unsynced = 0;
+	}
+}
+
+//--------------------------------------------------
+
+void CompletionJournal::close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if ( fd < 0 )
+	{
+		return;
+	}
+	if ( unsynced > 0 )
+	{
+		fdatasync(fd);
+	}
+	::close(fd);
+	fd = -1;
+	unsynced = 0;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,70 @@
+#ifndef FLATTEN_COMPLETION_JOURNAL_HPP
+#define FLATTEN_COMPLETION_JOURNAL_HPP
+
+#include <stddef.h>
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------
+// Append-only record of the work a run has completed, so that a run that died can be resumed.
+//
+// Each entry is one line of text, appended with a single write() as soon as it is added: a process that
+// is killed loses nothing that was added. The journal is synced to the disk (fdatasync()) every
+// fsyncBatch entries and when it is closed, so a machine that goes down loses at most the entries of the
+// last batch; they are then simply done again. A line cut short by a crash is dropped when the journal
+// is opened again.
+//
+// What the entries mean is up to the caller: flatten writes the input path of every image of a list
+// whose output is complete, and "frame N" for video once the first N frames are in the output.
+//--------------------------------------------------
+
+class CompletionJournal
+{
+public:
+	CompletionJournal();
+	~CompletionJournal();
+
+	// With resume, the entries of an existing journal are loaded and new ones are appended; otherwise
+	// the journal starts empty. Returns false, with the reason in problem, if the file cannot be opened.
+	bool open(const std::string& path, bool resume, int fsyncBatch, std::string& problem);
+
+	bool isOpen() const { return fd >= 0; }
+
+	const std::string& path() const { return filePath; }
+
+	// The entries loaded by open(), in the order they were added.
+	const std::vector<std::string>& loadedEntries() const { return loaded; }
+
+	// Whether open() loaded this entry.
+	bool contains(const std::string& entry) const { return loadedSet.count(entry) > 0; }
+
+	// Thread-safe. Entries must not contain a line break.
+	void add(const std::string& entry);
+
+	// Syncs what is not synced yet and closes the file.
+	void close();
+
+	//--------------------------------------------------
+
+private:
+	CompletionJournal(const CompletionJournal&);
+	CompletionJournal& operator=(const CompletionJournal&);
+
+	std::mutex mutex;
+	int fd;
+	std::string filePath;
+	int fsyncBatch;
+	int unsynced;
+	std::vector<std::string> loaded;
+	std::set<std::string> loadedSet;
+
+};
+
+#endif // FLATTEN_COMPLETION_JOURNAL_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
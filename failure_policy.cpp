@@ -0,0 +1,126 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "failure_policy.hpp"
+
+//--------------------------------------------------
+
+#define CONST_INT__MAX_RETRY_DELAY_MS   60000
+
+//--------------------------------------------------
+
+bool parseFailurePolicy(const std::string& name, FailurePolicy& policy)
+{
+	if ( name == "skip" )
+	{
+		policy = FAILURE_SKIP;
+		return true;
+	}
+	if ( name == "retry" )
+	{
+		policy = FAILURE_RETRY;
+		return true;
+	}
+	if ( name == "abort" )
+	{
+		policy = FAILURE_ABORT;
+		return true;
+	}
+	return false;
+}
+
+//--------------------------------------------------
+
+int failureRetryDelayMs(int baseMs, int attempt)
+{
+	long long delay = std::max(baseMs, 0);
+	for ( int i = 1; i < attempt && delay < CONST_INT__MAX_RETRY_DELAY_MS; i++ )
+	{
+		delay *= 2;
+	}
+	return (int) std::min(delay, (long long) CONST_INT__MAX_RETRY_DELAY_MS);
+}
+
+//--------------------------------------------------
+
+void FailureManifest::record(const std::string& stage, const std::string& input, const std::string& output,
+	const std::string& problem, int attempts)
+{
+	Failure failure;
+	failure.stage = stage;
+	failure.input = input;
+	failure.output = output;
+	failure.problem = problem;
+	failure.attempts = attempts;
+	std::lock_guard<std::mutex> lock(mutex);
+	failures.push_back(failure);
+}
+
+//--------------------------------------------------
+
+size_t FailureManifest::count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return failures.size();
+}
+
+//--------------------------------------------------
+
+static std::string json_string(const std::string& text)
+{
+	std::string out = "\"";
+	for ( size_t i = 0; i < text.size(); i++ )
+	{
+		const unsigned char c = (unsigned char) text[i];
+		if ( c == '"' || c == '\\' )
+		{
+			out += '\\';
+			out += (char) c;
+		}
+		else if ( c < 0x20 )
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		}
+		else
+		{
+			out += (char) c;
+		}
+	}
+	return out + "\"";
+}
+
+//--------------------------------------------------
+
+bool FailureManifest::writeJson(const std::string& path, const std::string& policy, size_t images) const
+{
+	FILE * f = fopen(path.c_str(), "w");
+	if ( f == NULL )
+	{
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	fprintf(f, "{\n");
+	fprintf(f, "  \"policy\": %s,\n", json_string(policy).c_str());
+	fprintf(f, "  \"images\": %zu,\n", images);
+	fprintf(f, "  \"failures\": [");
+	for ( size_t i = 0; i < failures.size(); i++ )
+	{
+		const Failure& failure = failures[i];
+		fprintf(f, "%s\n    { \"stage\": %s, \"input\": %s, \"output\": %s, \"problem\": %s, \"attempts\": %d }",
+			i > 0 ? "," : "", json_string(failure.stage).c_str(), json_string(failure.input).c_str(),
+			json_string(failure.output).c_str(), json_string(failure.problem).c_str(), failure.attempts);
+	}
+	fprintf(f, "%s]\n", failures.empty() ? "" : "\n  ");
+	fprintf(f, "}\n");
+	return fclose(f) == 0;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,78 @@
+#ifndef FLATTEN_FAILURE_POLICY_HPP
+#define FLATTEN_FAILURE_POLICY_HPP
+
+#include <stddef.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------
+// What an unattended run does when an image of a list cannot be read, encoded or written.
+//
+// - FAILURE_SKIP records the image and goes on with the next one.
+// - FAILURE_RETRY tries reads and writes again a few times, with a delay that doubles from one attempt
+//   to the next, before it records the image and goes on. Encoding gives the same result every time,
+//   so encode failures are recorded at once.
+// - FAILURE_ABORT records the image and starts no further ones; the run ends with an error status.
+//
+// Either way the run never waits for the user, and the failures end up in a FailureManifest.
+//--------------------------------------------------
+
+enum FailurePolicy
+{
+	FAILURE_SKIP,
+	FAILURE_RETRY,
+	FAILURE_ABORT
+};
+
+// "skip", "retry" or "abort"; returns false for anything else.
+bool parseFailurePolicy(const std::string& name, FailurePolicy& policy);
+
+// Delay before attempt + 1, for attempt >= 1: baseMs, 2 * baseMs, 4 * baseMs, ... up to a minute.
+int failureRetryDelayMs(int baseMs, int attempt);
+
+//--------------------------------------------------
+// The failures of a run, recorded from any thread and written out as JSON at the end.
+//--------------------------------------------------
+
+class FailureManifest
+{
+public:
+	FailureManifest() {}
+
+	// stage is "read", "encode" or "write"; attempts counts the first one.
+	void record(const std::string& stage, const std::string& input, const std::string& output,
+		const std::string& problem, int attempts);
+
+	size_t count() const;
+
+	// { "policy": ..., "images": ..., "failures": [ { "stage", "input", "output", "problem", "attempts" }, ... ] }
+	// images is the number of images the run was asked to process.
+	bool writeJson(const std::string& path, const std::string& policy, size_t images) const;
+
+	//--------------------------------------------------
+
+private:
+	FailureManifest(const FailureManifest&);
+	FailureManifest& operator=(const FailureManifest&);
+
+	struct Failure
+	{
+		std::string stage;
+		std::string input;
+		std::string output;
+		std::string problem;
+		int attempts;
+	};
+
+	mutable std::mutex mutex;
+	std::vector<Failure> failures;
+
+};
+
+#endif // FLATTEN_FAILURE_POLICY_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,128 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "file_input.hpp"
+
+//--------------------------------------------------
+
+bool parseFileReadMode(const std::string& name, FileReadMode& mode)
+{
+	if ( name == "pread" )
+	{
+		mode = FILE_READ_PREAD;
+		return true;
+	}
+	if ( name == "mmap" )
+	{
+		mode = FILE_READ_MMAP;
+		return true;
+	}
+	return false;
+}
+
+//--------------------------------------------------
+
+void adviseWillNeed(const std::string& path)
+{
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd >= 0 )
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+}
+
+//--------------------------------------------------
+
+FileReader::FileReader(FileReadMode mode)
+	: mode(mode), mapped(NULL), mappedSize(0)
+{
+}
+
+//--------------------------------------------------
+
+FileReader::~FileReader()
+{
+	unmap();
+}
+
+//--------------------------------------------------
+
+void FileReader::unmap()
+{
+	if ( mapped != NULL )
+	{
+		munmap(mapped, mappedSize);
+		mapped = NULL;
+		mappedSize = 0;
+	}
+}
+
+//--------------------------------------------------
+
+bool FileReader::read(const std::string& path, const uchar *& data, size_t& size, std::string& problem)
+{
+	unmap();
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 )
+	{
+		problem = "cannot open '" + path + "'";
+		return false;
+	}
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || st.st_size <= 0 )
+	{
+		close(fd);
+		problem = "cannot read '" + path + "' or it is empty";
+		return false;
+	}
+	size = (size_t) st.st_size;
+
+	bool ok = true;
+	if ( mode == FILE_READ_MMAP )
+	{
+		void * p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		ok = p != MAP_FAILED;
+		if ( ok )
+		{
+			// The decoder reads it front to back, all of it.
+			madvise(p, size, MADV_SEQUENTIAL);
+			madvise(p, size, MADV_WILLNEED);
+			mapped = p;
+			mappedSize = size;
+			data = (const uchar *) p;
+		}
+	}
+	else
+	{
+		if ( buffer.size() < size )
+		{
+			buffer.resize(size);
+		}
+		size_t done = 0;
+		while ( ok && done < size )
+		{
+			const ssize_t n = pread(fd, &buffer[done], size - done, (off_t) done);
+			ok = n > 0;
+			done += ok ? (size_t) n : 0;
+		}
+		data = &buffer[0];
+	}
+	close(fd);
+	if ( !ok )
+	{
+		problem = "cannot read '" + path + "'";
+	}
+	return ok;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
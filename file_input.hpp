@@ -0,0 +1,71 @@
+#ifndef FLATTEN_FILE_INPUT_HPP
+#define FLATTEN_FILE_INPUT_HPP
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+//--------------------------------------------------
+// Reading the files of an image list ahead of the decoders.
+//
+// cv::imread() opens, reads and decodes one file in a single synchronous call, so on a slow disk or a
+// network mount the decoder threads spend most of their time waiting for data and the disk is idle
+// while they decode. Here the two are split:
+//
+// - adviseWillNeed() asks the kernel, through posix_fadvise(POSIX_FADV_WILLNEED), to start reading a
+//   file into the page cache; the ImageSource of the list calls it for the next entries while the
+//   current ones are decoded (see image_source.hpp).
+// - A FileReader then gets the bytes of a file, by then usually from the page cache, either with
+//   pread() into a buffer it reuses from one file to the next, or by mapping the file; the caller
+//   decodes them with cv::imdecode() or the JPEG codec. Each decoder thread owns one.
+//
+// A mapped file that is truncated while it is read raises SIGBUS, so "mmap" is for files nothing
+// else writes to; "pread" is always safe.
+//--------------------------------------------------
+
+enum FileReadMode
+{
+	FILE_READ_PREAD,
+	FILE_READ_MMAP
+};
+
+// "pread" or "mmap"; returns false for anything else.
+bool parseFileReadMode(const std::string& name, FileReadMode& mode);
+
+// Starts reading the file into the page cache and returns without waiting for it.
+void adviseWillNeed(const std::string& path);
+
+//--------------------------------------------------
+
+class FileReader
+{
+public:
+	explicit FileReader(FileReadMode mode);
+	~FileReader();
+
+	// data and size receive the content of the file, valid until the next call or the destruction of
+	// the reader. Returns false, with the reason in problem, if the file cannot be read or is empty.
+	bool read(const std::string& path, const uchar *& data, size_t& size, std::string& problem);
+
+	//--------------------------------------------------
+
+private:
+	FileReader(const FileReader&);
+	FileReader& operator=(const FileReader&);
+
+	void unmap();
+
+	FileReadMode mode;
+	std::vector<uchar> buffer; // pread(): grows to the largest file read so far
+	void * mapped;             // mmap(): the current file
+	size_t mappedSize;
+};
+
+#endif // FLATTEN_FILE_INPUT_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
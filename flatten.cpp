@@ -1,13 +1,34 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <ctime>
 #include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <opencv2/core.hpp>
 #include <opencv2/core/utility.hpp>
@@ -15,7 +36,24 @@
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/videoio.hpp>
-#include <opencv2/highgui.hpp>
+
+#include "async_writer.hpp"
+#include "bounded_queue.hpp"
+#include "completion_journal.hpp"
+#include "buffer_pool.hpp"
+#include "failure_policy.hpp"
+#include "file_input.hpp"
+#include "flattener.hpp"
+#include "flattener_cache.hpp"
+#include "image_io.hpp"
+#include "image_source.hpp"
+#include "jpeg_codec.hpp"
+#include "lens_model.hpp"
+#include "perf_counters.hpp"
+#include "raw_stream.hpp"
+#include "remap_engine.hpp"
+#include "remap_maps.hpp"
+#include "stage_timings.hpp"
 
 //--------------------------------------------------
 
@@ -31,6 +69,13 @@ p_dst[int_dst_max_strlen_plus_one - 1] = '\0';
 #define CONST_INT__MAX_STRLEN_PLUS_ONE__TIMESTAMP_PREFIX_PART2  16
 #define CONST_INT__MAX_STRLEN_PLUS_ONE__LOG_MSG                 4096
 
+#define CONST_INT__BUFFER_POOL_MIN_BYTES                        (1024 * 1024)
+
+// Limits of a --serve job request
+#define CONST_INT__SERVE_MAX_HEADER_BYTES                       (64 * 1024)
+#define CONST_INT__SERVE_MAX_PROFILE_BYTES                      (1024 * 1024)
+#define CONST_INT__SERVE_SOCKET_TIMEOUT_S                       30
+
 //--------------------------------------------------
 
 static void obtain_timestamp_prefix(char * arg_timestamp)
@@ -134,6 +179,11 @@ static void obtain_timestamp_prefix(char * arg_timestamp)
 
 //--------------------------------------------------
 
+// NULL means stdout. Set to stderr while stdout carries raw frames.
+static FILE * p_log_stream = NULL;
+
+//--------------------------------------------------
+
 static void logmsg(const char * arg_fmt, ...)
 {
 	char sbuf_timestamp_prefix [ CONST_INT__MAX_STRLEN_PLUS_ONE__TIMESTAMP_PREFIX ];
@@ -156,7 +206,8 @@ static void logmsg(const char * arg_fmt, ...)
 		//--sbuf_log_msg [ CONST_INT__MAX_STRLEN_PLUS_ONE__LOG_MSG - 1 ] = '\0';
 	} // end if
 	//--------------------------------------------------
-	printf(
+	fprintf(
+		p_log_stream != NULL ? p_log_stream : stdout,
 		"{%.*s} %.*s\n",
 		(int) CONST_INT__MAX_STRLEN_PLUS_ONE__TIMESTAMP_PREFIX - 1,
 		sbuf_timestamp_prefix,
@@ -169,7 +220,7 @@ static void logmsg(const char * arg_fmt, ...)
 class Settings
 {
 public:
-	Settings() : goodInput(false) {}
+	Settings() : goodInput(false), resume(false) {}
 
 	//--------------------------------------------------
 
@@ -177,7 +228,8 @@ public:
 	{
 		INVALID,
 		VIDEO_FILE,
-		IMAGE_LIST
+		IMAGE_LIST,
+		RAW_STREAM
 	};
 
 	//--------------------------------------------------
@@ -187,20 +239,73 @@ public:
 		fs << "{"
 				  << "input" << input
 
-				  << "original_image_width" << originalSize.width
-				  << "original_image_height" << originalSize.height
+				  << "original_image_width" << flattenerOptions.profile.originalSize.width
+				  << "original_image_height" << flattenerOptions.profile.originalSize.height
+
+				  << "intermediate_image_width" << flattenerOptions.profile.intermedSize.width
+				  << "intermediate_image_height" << flattenerOptions.profile.intermedSize.height
+
+				  << "final_image_width" << flattenerOptions.profile.finalSize.width
+				  << "final_image_height" << flattenerOptions.profile.finalSize.height
+
+				  << "use_fisheye_model" << flattenerOptions.profile.useFisheye
+
+				  << "camera_matrix" << flattenerOptions.profile.cameraMatrix
+
+				  << "distortion_coefficients" <<  flattenerOptions.profile.distortionCoefficients
+
+				  << "map_cache_directory" << flattenerOptions.mapCacheDirectory
+
+				  << "decoder_threads" << decoderThreads
+				  << "remap_threads" << remapThreads
+				  << "encoder_threads" << encoderThreads
+				  << "pipeline_queue_depth" << queueDepth
+
+				  << "remap_engine" << flattenerOptions.remapEngine
+				  << "remap_engine_verify" << remapEngineVerify
+
+				  << "remap_scheduler" << flattenerOptions.remapScheduler
+				  << "tile_width" << flattenerOptions.tileSize.width
+				  << "tile_height" << flattenerOptions.tileSize.height
+				  << "tile_threads" << flattenerOptions.tileThreads
+				  << "tile_report" << tileReport
+
+				  << "remap_batch_size" << batchSize
 
-				  << "intermediate_image_width" << intermedSize.width
-				  << "intermediate_image_height" << intermedSize.height
+				  << "map_mode" << flattenerOptions.mapMode
+				  << "mesh_step" << flattenerOptions.meshStep
+				  << "mesh_error_report" << meshErrorReport
 
-				  << "final_image_width" << finalSize.width
-				  << "final_image_height" << finalSize.height
+				  << "map_generator" << flattenerOptions.mapGenerator
 
-				  << "use_fisheye_model" << useFisheye
+				  << "perf_counters" << perfCounters
 
-				  << "camera_matrix" << cameraMatrix
+				  << "raw_format" << rawFormatName
 
-				  << "distortion_coefficients" <<  distortionCoefficients
+				  << "keep_bit_depth" << keepBitDepth
+
+				  << "jpeg_fast_path" << jpegFastPath
+				  << "jpeg_quality" << jpegQuality
+				  << "jpeg_subsampling" << jpegSubsamplingName
+
+				  << "input_reader" << inputReader
+				  << "input_readahead" << inputReadahead
+
+				  << "output_directory" << outputDirectory
+				  << "writer_threads" << writerThreads
+				  << "output_fsync_batch" << outputFsyncBatch
+
+				  << "failure_policy" << failurePolicyName
+				  << "failure_retries" << failureRetries
+				  << "failure_retry_delay_ms" << failureRetryDelayMs
+				  << "failure_manifest" << failureManifest
+
+				  << "journal" << journal
+				  << "journal_fsync_batch" << journalFsyncBatch
+				  << "video_gop_size" << videoGopSize
+
+				  << "buffer_pool" << bufferPool
+				  << "buffer_pool_limit_mb" << bufferPoolLimitMb
 		   << "}";
 	}
 
@@ -210,20 +315,50 @@ public:
 	{
 		node["input"] >> input;
 
-		node["original_image_width"] >> originalSize.width;
-		node["original_image_height"] >> originalSize.height;
+		// The lens profile and the map and remap engine keys, as every client of libflatten reads them.
+		readFlattenerOptions(node, flattenerOptions);
+
+		node["decoder_threads"] >> decoderThreads;
+		node["remap_threads"] >> remapThreads;
+		node["encoder_threads"] >> encoderThreads;
+		node["pipeline_queue_depth"] >> queueDepth;
+
+		node["remap_engine_verify"] >> remapEngineVerify;
 
-		node["intermediate_image_width"] >> intermedSize.width;
-		node["intermediate_image_height"] >> intermedSize.height;
+		node["tile_report"] >> tileReport;
 
-		node["final_image_width"] >> finalSize.width;
-		node["final_image_height"] >> finalSize.height;
+		node["remap_batch_size"] >> batchSize;
 
-		node["use_fisheye_model"] >> useFisheye;
+		node["mesh_error_report"] >> meshErrorReport;
 
-		node["camera_matrix"] >> cameraMatrix;
+		node["perf_counters"] >> perfCounters;
 
-		node["distortion_coefficients"] >> distortionCoefficients;
+		node["raw_format"] >> rawFormatName;
+
+		node["keep_bit_depth"] >> keepBitDepth;
+
+		node["jpeg_fast_path"] >> jpegFastPath;
+		node["jpeg_quality"] >> jpegQuality;
+		node["jpeg_subsampling"] >> jpegSubsamplingName;
+
+		node["input_reader"] >> inputReader;
+		node["input_readahead"] >> inputReadahead;
+
+		node["output_directory"] >> outputDirectory;
+		node["writer_threads"] >> writerThreads;
+		node["output_fsync_batch"] >> outputFsyncBatch;
+
+		node["failure_policy"] >> failurePolicyName;
+		node["failure_retries"] >> failureRetries;
+		node["failure_retry_delay_ms"] >> failureRetryDelayMs;
+		node["failure_manifest"] >> failureManifest;
+
+		node["journal"] >> journal;
+		node["journal_fsync_batch"] >> journalFsyncBatch;
+		node["video_gop_size"] >> videoGopSize;
+
+		node["buffer_pool"] >> bufferPool;
+		node["buffer_pool_limit_mb"] >> bufferPoolLimitMb;
 
 		validate();
 	}
@@ -234,6 +369,12 @@ public:
 	{
 		goodInput = true;
 
+		applyFlattenerDefaults(flattenerOptions);
+		const LensProfile& profile = flattenerOptions.profile;
+		const cv::Size& originalSize = profile.originalSize;
+		const cv::Size& intermedSize = profile.intermedSize;
+		const cv::Size& finalSize = profile.finalSize;
+
 		if ( originalSize.width <= 0 || originalSize.height <= 0 )
 		{
 			std::cerr << "Invalid original image size: " << originalSize.width << " x " << originalSize.height << std::endl;
@@ -274,14 +415,169 @@ public:
 			goodInput = false;
 		}
 
+		if ( !Remapper::isValidEngine(flattenerOptions.remapEngine) )
+		{
+			std::cerr << "Invalid remap engine: " << flattenerOptions.remapEngine << std::endl;
+			goodInput = false;
+		}
+
+		const std::string& remapScheduler = flattenerOptions.remapScheduler;
+		if ( remapScheduler != "rows" && remapScheduler != "tiled" )
+		{
+			std::cerr << "Invalid remap scheduler: " << remapScheduler << std::endl;
+			goodInput = false;
+		}
+		const cv::Size& tileSize = flattenerOptions.tileSize;
+		if ( remapScheduler == "tiled" && (tileSize.width <= 0 || tileSize.height <= 0) )
+		{
+			std::cerr << "Invalid tile size: " << tileSize.width << " x " << tileSize.height << std::endl;
+			goodInput = false;
+		}
+
+		const std::string& mapMode = flattenerOptions.mapMode;
+		if ( mapMode != "dense" && mapMode != "mesh" && mapMode != "analytic" )
+		{
+			std::cerr << "Invalid map mode: " << mapMode << std::endl;
+			goodInput = false;
+		}
+
+		const std::string& mapGenerator = flattenerOptions.mapGenerator;
+		if ( mapGenerator != "opencv" && mapGenerator != "builtin" )
+		{
+			std::cerr << "Invalid map generator: " << mapGenerator << std::endl;
+			goodInput = false;
+		}
+
+		if ( bufferPoolLimitMb <= 0 )
+		{
+			bufferPoolLimitMb = 1024;
+		}
+
+		if ( rawFormatName.empty() )
+		{
+			rawFormatName = "bgr24";
+		}
+		if ( !parseRawFormat(rawFormatName, rawFormat) )
+		{
+			std::cerr << "Invalid raw format: " << rawFormatName << std::endl;
+			goodInput = false;
+		}
+
+		if ( jpegQuality <= 0 )
+		{
+			jpegQuality = 95;
+		}
+		if ( jpegQuality > 100 )
+		{
+			std::cerr << "Invalid JPEG quality: " << jpegQuality << std::endl;
+			goodInput = false;
+		}
+		if ( jpegSubsamplingName.empty() )
+		{
+			jpegSubsamplingName = "420";
+		}
+		if ( !parseJpegSubsampling(jpegSubsamplingName, jpegSubsampling) )
+		{
+			std::cerr << "Invalid JPEG subsampling: " << jpegSubsamplingName << std::endl;
+			goodInput = false;
+		}
+		if ( jpegFastPath && !JpegCodec::available() )
+		{
+			std::cerr << "flatten was built without TurboJPEG; JPEG frames go through cv::imread() and cv::imwrite()" << std::endl;
+			jpegFastPath = false;
+		}
+		if ( inputReader.empty() )
+		{
+			inputReader = "imread";
+		}
+		// TurboJPEG decodes from memory, so JPEG frames are read with pread() even with "imread".
+		fileReadMode = FILE_READ_PREAD;
+		if ( inputReader != "imread" && !parseFileReadMode(inputReader, fileReadMode) )
+		{
+			std::cerr << "Invalid input reader: " << inputReader << std::endl;
+			goodInput = false;
+		}
+		if ( inputReadahead < 0 )
+		{
+			inputReadahead = 0;
+		}
+
+		if ( !outputDirectory.empty() )
+		{
+			struct stat st;
+			mkdir(outputDirectory.c_str(), 0777);
+			if ( stat(outputDirectory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) )
+			{
+				std::cerr << "Invalid output directory: " << outputDirectory << std::endl;
+				goodInput = false;
+			}
+		}
+		if ( outputFsyncBatch < 0 )
+		{
+			outputFsyncBatch = 0;
+		}
+
+		if ( failurePolicyName.empty() )
+		{
+			failurePolicyName = "skip";
+		}
+		if ( !parseFailurePolicy(failurePolicyName, failurePolicy) )
+		{
+			std::cerr << "Invalid failure policy: " << failurePolicyName << std::endl;
+			goodInput = false;
+		}
+		if ( failureRetries <= 0 )
+		{
+			failureRetries = 3;
+		}
+		if ( failureRetryDelayMs <= 0 )
+		{
+			failureRetryDelayMs = 100;
+		}
+
+		if ( journalFsyncBatch <= 0 )
+		{
+			journalFsyncBatch = 64;
+		}
+		if ( videoGopSize <= 0 )
+		{
+			videoGopSize = 12; // what cv::VideoWriter asks FFmpeg for
+		}
+
+		// 4:2:0 in and out: the planes of the JPEG frames are flattened as they are.
+		jpegPlanar = jpegFastPath && jpegSubsampling == JPEG_420 &&
+			((originalSize.width | originalSize.height | finalSize.width | finalSize.height) & 1) == 0;
+
 		if ( input.empty() )
 		{
 			inputType = INVALID;
 		}
+		else if ( input == "-" )
+		{
+			std::string problem;
+			inputType = RAW_STREAM;
+			if ( rawFormat == RAW_Y4M && ((originalSize.width | originalSize.height | finalSize.width | finalSize.height) & 1) )
+			{
+				std::cerr << "Invalid: raw_format \"y4m\" needs even original and final sizes" << std::endl;
+				goodInput = false;
+			}
+			if ( goodInput && !rawReader.open(STDIN_FILENO, rawFormat, originalSize, problem) )
+			{
+				std::cerr << "Invalid raw input on stdin: " << problem << std::endl;
+				goodInput = false;
+			}
+		}
 		else
 		{
-			if ( isListOfImages(input) && readStringList(input, imageList) )
+			std::string problem;
+			if ( imageSource.open(input, problem) )
+			{
+				inputType = IMAGE_LIST;
+			}
+			else if ( !problem.empty() )
 			{
+				std::cerr << "Invalid image list: " << problem << std::endl;
+				goodInput = false;
 				inputType = IMAGE_LIST;
 			}
 			else
@@ -310,56 +606,38 @@ public:
 	cv::Mat nextImage()
 	{
 		cv::Mat result;
-		if ( videoCapture.isOpened() )
+		if ( inputType == RAW_STREAM )
+		{
+			// y4m frames stay in I420 layout; see isPlanar().
+			if ( rawReader.read(result) )
+			{
+				++frameNum;
+			}
+		}
+		else if ( videoCapture.isOpened() )
 		{
 			videoCapture >> result;
 			++frameNum;
 		}
-		else if ( frameNum < imageList.size() )
+		else if ( inputType == IMAGE_LIST )
 		{
-			result = cv::imread(imageList[frameNum++], cv::IMREAD_COLOR);
+			size_t index = 0;
+			std::string path;
+			if ( imageSource.next(index, path) )
+			{
+				result = cv::imread(path, imageReadFlags(keepBitDepth));
+				++frameNum;
+			}
 		}
 		return result;
 	}
 
 	//--------------------------------------------------
 
-	static bool readStringList(const std::string& filename, std::vector<std::string>& l)
-	{
-		l.clear();
-		cv::FileStorage fs(filename, cv::FileStorage::READ);
-		if ( !fs.isOpened() )
-		{
-			return false;
-		}
-		cv::FileNode n = fs.getFirstTopLevelNode();
-		if ( n.type() != cv::FileNode::SEQ )
-		{
-			return false;
-		}
-		cv::FileNodeIterator it = n.begin();
-		cv::FileNodeIterator it_end = n.end();
-		for ( ; it != it_end; ++it )
-		{
-			l.push_back((std::string)*it);
-		}
-		return true;
-	}
-
-	//--------------------------------------------------
-
-	static bool isListOfImages(const std::string& filename)
+	// Frames from nextImage() are I420 (4:2:0 planar) rather than BGR.
+	bool isPlanar() const
 	{
-		std::string s(filename);
-		// Look for file extension
-		if ( s.find(".xml") == std::string::npos && s.find(".yaml") == std::string::npos && s.find(".yml") == std::string::npos )
-		{
-			return false;
-		}
-		else
-		{
-			return true;
-		}
+		return inputType == RAW_STREAM && rawFormat == RAW_Y4M;
 	}
 
 	//--------------------------------------------------
@@ -367,207 +645,1692 @@ public:
 public:
 
 	std::string input;
-	std::vector<std::string> imageList;
+	ImageSource imageSource;    // the images, when the input is an image list
 	size_t frameNum;
 
-	cv::Size originalSize;
-	cv::Size intermedSize;
-	cv::Size finalSize;
-
-	bool useFisheye;
-
 	cv::VideoCapture videoCapture;
+	RawFrameReader rawReader;   // input "-": frames on stdin
 	InputType inputType;
 	bool goodInput;
 
-	cv::Mat cameraMatrix;
-	cv::Mat distortionCoefficients;
+	FlattenerOptions flattenerOptions; // the lens profile, the maps and the remap engine; see flattener.hpp
+
+	// Pipeline sizing. Zero means "pick a value based on the number of CPUs".
+	int decoderThreads;
+	int remapThreads;
+	int encoderThreads;
+	int queueDepth;
+
+	bool remapEngineVerify;     // compare the engine against cv::remap() before processing
+	std::string tileReport;     // CSV file with the footprint of every tile; empty: log a summary only
+
+	int batchSize;              // frames remapped together in one pass over the maps; zero means one
+
+	bool meshErrorReport;       // compare the mesh against the exact maps before processing
+
+	bool perfCounters;          // count hardware events during the remap of every frame
+
+	bool bufferPool;            // recycle frame and map buffers, backed by huge pages; see buffer_pool.hpp
+	int bufferPoolLimitMb;      // most memory the buffer pool maps, buffers in use included
+
+	std::string rawFormatName;  // format of the frames on stdin and stdout with input "-"; see raw_stream.hpp
+	RawFormat rawFormat;
+
+	bool keepBitDepth;          // read images at their own depth (16-bit, float) instead of 8-bit BGR
+
+	bool jpegFastPath;          // JPEG frames of an image list through TurboJPEG; see jpeg_codec.hpp
+	int jpegQuality;            // 1 to 100, for every JPEG written
+	std::string jpegSubsamplingName; // "444", "422" or "420", with the fast path
+	JpegSubsampling jpegSubsampling;
+	bool jpegPlanar;            // 4:2:0 JPEG frames stay in I420 layout; set by validate()
+
+	std::string inputReader;    // "imread": cv::imread(); "pread", "mmap": see file_input.hpp
+	FileReadMode fileReadMode;
+	int inputReadahead;         // image list entries read into the page cache ahead of the decoders
+
+	std::string outputDirectory; // empty: outputs go next to their inputs
+	int writerThreads;          // threads writing the encoded images of a list; zero: pick a value
+	int outputFsyncBatch;       // sync the written images every this many files; zero: never
+
+	std::string failurePolicyName; // "skip", "retry" or "abort", for the images of a list
+	FailurePolicy failurePolicy;
+	int failureRetries;         // further attempts at a read or write with "retry"
+	int failureRetryDelayMs;    // before the first of them; doubles for each next one
+	std::string failureManifest; // JSON list of the failed images; empty: next to the outputs
+
+	std::string journal;        // completed images or frames, for --resume; empty: next to the outputs
+	int journalFsyncBatch;      // sync the journal every this many entries
+	int videoGopSize;           // frames; video runs resume at a multiple of it
+	bool resume;                // --resume: skip what the journal of the last run lists
 
 };
 
+//--------------------------------------------------
+// Compares the map entries in use against those of cv::initUndistortRectifyMap(), for maps that were not
+// built by OpenCV: the built-in generator and the analytic mode. Returns false if they differ by more
+// than CONST_INT__MAP_GENERATOR_TOLERANCE.
 //--------------------------------------------------
 
-int main (int argc, char** argv)
+static bool verifyMaps(const Flattener& flattener)
 {
-	logmsg("main() begins.");
-	const cv::String keys
-		= "{help h usage ? |           | print this message            }"
-		  "{@settings      |default.xml| input setting file            }";
+	const cv::Size size = flattener.outputSize();
+	const int64 refStart = cv::getTickCount();
+	cv::Mat ref1;
+	cv::Mat ref2;
+	buildRemapMaps(flattener.options().profile, ref1, ref2);
+	const double refElapsedMs = (cv::getTickCount() - refStart) * 1000. / cv::getTickFrequency();
+	cv::Mat map1;
+	cv::Mat map2;
+	flattener.remapper().mapBlock(cv::Rect(0, 0, size.width, size.height), map1, map2);
+	size_t mismatches = 0;
+	int maxDifference = 0;
+	compareRemapMaps(map1, map2, ref1, ref2, mismatches, maxDifference);
+	const bool withinTolerance = maxDifference <= CONST_INT__MAP_GENERATOR_TOLERANCE;
+	logmsg("verifyMaps() opencv generator took %.1f ms; %zu of %d entries differ, max difference %d/%d px (%s)",
+		refElapsedMs, mismatches, size.area(), maxDifference, cv::INTER_TAB_SIZE,
+		withinTolerance ? "within tolerance" : "OUT OF TOLERANCE");
+	return withinTolerance;
+}
 
-	cv::CommandLineParser parser(argc, argv, keys);
+//--------------------------------------------------
+// Logs how far the mesh coordinates are from the exact ones, and how much smaller the mesh is than the
+// dense maps it replaces.
+//--------------------------------------------------
 
-	parser.about("This is a distortion flattening program.\n"
-				 "Usage: flatten [configuration_file] -- default ./default.xml]\n"
-				 "The configuration file can be XML, YML or YAML.");
+static void reportMeshError(const Remapper& remapper, const LensProfile& profile, int meshStep)
+{
+	cv::Mat exact;
+	buildRemapMapsFloat(profile, exact);
+	double maxError = 0;
+	double meanError = 0;
+	cv::Point where;
+	remapper.meshError(exact, maxError, meanError, where);
+	const size_t denseBytes = profile.finalSize.area() * (2 * sizeof(short) + sizeof(ushort));
+	logmsg("reportMeshError() %s lens, step %d: max coordinate error %.4f px at (%d, %d), mean %.4f px; "
+		"mesh %zu bytes vs %zu bytes of dense maps",
+		profile.useFisheye ? "fisheye" : "pinhole", meshStep, maxError, where.x, where.y, meanError,
+		remapper.mapBytes(), denseBytes);
+}
 
-	if ( !parser.check() )
+//--------------------------------------------------
+// Logs the distribution of the per-tile cache footprints and optionally writes all of them to a CSV file,
+// so the tile size can be tuned against the cache size of the machine.
+//--------------------------------------------------
+
+static void reportTileFootprints(const Remapper& remapper, const std::string& csvPath)
+{
+	const std::vector<RemapTile>& tiles = remapper.tiles();
+	if ( tiles.empty() )
 	{
-		parser.printErrors();
-		return 0;
+		return;
 	}
-
-	if ( parser.has("help") )
+	std::vector<size_t> footprints;
+	for ( size_t i = 0; i < tiles.size(); ++i )
 	{
-		parser.printMessage();
-		return 0;
+		footprints.push_back(tiles[i].footprintBytes);
 	}
+	std::sort(footprints.begin(), footprints.end());
+	logmsg("reportTileFootprints() %zu tiles of %d x %d, footprint min %zu / median %zu / max %zu bytes",
+		tiles.size(), tiles[0].dst.width, tiles[0].dst.height,
+		footprints.front(), footprints[footprints.size() / 2], footprints.back());
 
-	//! [file_read]
-	Settings s;
-	const std::string inputSettingsFile = parser.get<std::string>(0);
-	cv::FileStorage fs(inputSettingsFile, cv::FileStorage::READ); // Read the settings
-	if ( !fs.isOpened() )
+	const long l2Size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if ( l2Size > 0 )
 	{
-		std::cerr << "Fatal error: Could not open the configuration file: \"" << inputSettingsFile << "\"" << std::endl;
-		parser.printMessage();
-		return -1;
+		const size_t over = (size_t) (footprints.end() - std::upper_bound(footprints.begin(), footprints.end(), (size_t) l2Size));
+		logmsg("reportTileFootprints() %zu tiles exceed the L2 cache size of %ld bytes", over, l2Size);
 	}
-	s.read(fs["Settings"]);
-	fs.release();                                         // close Settings file
-	//! [file_read]
-
-	//FileStorage fout("settings.yml", FileStorage::WRITE); // write config as YAML
-	//fout << "Settings" << s;
 
-	if ( !s.goodInput )
+	if ( csvPath.empty() )
 	{
-		std::cerr << "Fatal error: Invalid input detected. Application stopping." << std::endl;
-		return -1;
+		return;
+	}
+	FILE * f = fopen(csvPath.c_str(), "w");
+	if ( f == NULL )
+	{
+		logmsg("reportTileFootprints() Could not write '%s'.", csvPath.c_str());
+		return;
+	}
+	fprintf(f, "dst_x,dst_y,dst_width,dst_height,src_x,src_y,src_width,src_height,footprint_bytes\n");
+	for ( size_t i = 0; i < tiles.size(); ++i )
+	{
+		const RemapTile& t = tiles[i];
+		fprintf(f, "%d,%d,%d,%d,%d,%d,%d,%d,%zu\n",
+			t.dst.x, t.dst.y, t.dst.width, t.dst.height,
+			t.src.x, t.src.y, t.src.width, t.src.height,
+			t.footprintBytes);
 	}
+	fclose(f);
+	logmsg("reportTileFootprints() wrote '%s'", csvPath.c_str());
+}
 
-	// rectangle that defines the region of interest
-	cv::Rect myROI(
-		(s.intermedSize.width - s.finalSize.width) >> 1,
-		(s.intermedSize.height - s.finalSize.height) >> 1,
-		s.finalSize.width,
-		s.finalSize.height);
+//--------------------------------------------------
 
-	cv::Mat view; // original image
-	cv::Mat rview; // rectified image (bigger than the original image)
-	cv::Mat cview; // crop inside the rectified image
-	cv::Mat map1;
-	cv::Mat map2;
+// "dir/name.ext" -> "dir/name" + suffix, or "<output_directory>/name" + suffix when one is set.
+static std::string makeOutputPath(const Settings& s, const std::string& input, const std::string& suffix)
+{
+	const size_t slash = input.find_last_of('/');
+	const size_t dot = input.find_last_of('.');
+	const size_t nameStart = slash == std::string::npos ? 0 : slash + 1;
+	const size_t nameEnd = dot != std::string::npos && dot > nameStart ? dot : input.size();
+	const std::string directory = !s.outputDirectory.empty() ? s.outputDirectory + "/" : input.substr(0, nameStart);
+	return directory + input.substr(nameStart, nameEnd - nameStart) + suffix;
+}
+
+//--------------------------------------------------
+// Files about the whole run (timings, journal, failure manifest), named after the input like the outputs.
+// The name of a pattern or wildcard input loses its conversion and wildcards ("frame-%06d.JPG" ->
+// "frame", "*.JPG" -> "images"), and a directory input names the files next to it.
+//--------------------------------------------------
 
-	if ( s.useFisheye )
+static std::string makeRunOutputPath(const Settings& s, const std::string& suffix)
+{
+	if ( s.inputType == Settings::RAW_STREAM )
 	{
-		cv::Mat newCamMat;
-		cv::fisheye::estimateNewCameraMatrixForUndistortRectify(
-			s.cameraMatrix, s.distortionCoefficients, s.originalSize,
-			cv::Matx33d::eye(), newCamMat, 1, s.intermedSize);
-		cv::fisheye::initUndistortRectifyMap(
-			s.cameraMatrix, s.distortionCoefficients, cv::Matx33d::eye(),
-			newCamMat, s.intermedSize, CV_16SC2, map1, map2);
+		return makeOutputPath(s, "stdin", suffix);
 	}
-	else
+	std::string input = s.input;
+	while ( input.size() > 1 && input[input.size() - 1] == '/' )
 	{
-		cv::initUndistortRectifyMap(
-			s.cameraMatrix, s.distortionCoefficients, cv::Mat(),
-			cv::getOptimalNewCameraMatrix(
-				s.cameraMatrix, s.distortionCoefficients,
-				s.originalSize, 1, s.intermedSize, 0), 
-			s.intermedSize, CV_16SC2, map1, map2);
+		input.erase(input.size() - 1);
 	}
-
-	if ( s.inputType == Settings::IMAGE_LIST )
+	const ImageSourceKind kind = s.imageSource.kind();
+	if ( s.inputType == Settings::IMAGE_LIST && (kind == IMAGE_SOURCE_PATTERN || kind == IMAGE_SOURCE_DIRECTORY) )
 	{
-		for(;;)
+		const size_t slash = input.find_last_of('/');
+		const size_t nameStart = slash == std::string::npos ? 0 : slash + 1;
+		const size_t dot = input.find_last_of('.');
+		const size_t nameEnd = dot != std::string::npos && dot > nameStart ? dot : input.size();
+		std::string stem;
+		for ( size_t i = nameStart; i < nameEnd; i++ )
 		{
-			size_t i = s.frameNum;
-			view = s.nextImage();
-			if ( view.empty() )
+			if ( input[i] == '%' )
 			{
-				break;
+				while ( i < nameEnd && input[i] != 'd' )
+				{
+					i++;
+				}
+			}
+			else if ( strchr("*?[]", input[i]) == NULL )
+			{
+				stem += input[i];
 			}
-			logmsg("main() s.imageList[%zu] (out of %zu) = '%s'", i, s.imageList.size(), s.imageList[i].c_str());
+		}
+		while ( !stem.empty() && strchr("-_. ", stem[stem.size() - 1]) != NULL )
+		{
+			stem.erase(stem.size() - 1);
+		}
+		input = input.substr(0, nameStart) + (stem.empty() ? std::string("images") : stem);
+	}
+	return makeOutputPath(s, input, suffix);
+}
 
-			cv::remap(view, rview, map1, map2, cv::INTER_CUBIC);
+//--------------------------------------------------
 
-			// Crop the bigger rectified image down to the rectangle defined by the region of interest.
-			// Note that this does not copy the data.
-			cview = rview(myROI);
+static std::string makeOutputImageFilename(const Settings& s, const std::string& original_filename)
+{
+	const size_t dot = original_filename.find_last_of('.');
+	const std::string extension = dot != std::string::npos ? original_filename.substr(dot) : std::string();
+	return makeOutputPath(s, original_filename, "-b" + extension);
+}
 
-			// Save the view to a file.
-			const std::string& original_filename = s.imageList[i];
-			std::size_t idx = original_filename.find_last_of(".");
-			std::string temp_prefix = original_filename.substr(0, idx);
-			std::string temp_suffix = original_filename.substr(idx + 1);
-			std::string outfilename = temp_prefix + "-b." + temp_suffix;
-			//logmsg("main() outfilename = '%s'", outfilename.c_str());
-			bool result = false;
-			try
-			{
-				result = cv::imwrite(outfilename, cview);
-			}
-			catch (const cv::Exception& ex)
-			{
-				fprintf(stderr, "cv::imwrite() encountered an exception: %s\n", ex.what());
-			}
-			if ( !result )
-			{
-				logmsg("main() Could not save view to '%s'.", outfilename.c_str());
-				// Give the user a chance to see the error message and decide what to do in response to the error.
-				// At this point, the user has a choice: press a key to continue or press Ctrl-C to quit.
-				cv::waitKey(0);
-			}
+//--------------------------------------------------
 
-		} // end for
-	}
-	else if ( s.inputType == Settings::VIDEO_FILE )
+static const char * depthName(int depth)
+{
+	switch ( depth )
 	{
-		logmsg("main() input video file = '%s'", s.input.c_str());
+		case CV_8U:  return "8-bit";
+		case CV_16U: return "16-bit";
+		case CV_32F: return "float";
+	}
+	return "other";
+}
 
-		std::size_t idx = s.input.find_last_of('.');
-		std::string outputVideoFilename = s.input.substr(0, idx) + "-b.avi";
+//--------------------------------------------------
 
-		logmsg("main() output video file = '%s'", outputVideoFilename.c_str());
+enum FrameLayout
+{
+	FRAME_PACKED,       // BGR, or whatever cv::imread() returned
+	FRAME_I420_VIDEO,   // 4:2:0 planes from y4m, video range
+	FRAME_I420_FULL     // 4:2:0 planes from a JPEG, full range
+};
 
-		cv::VideoWriter videoWriter;
+struct PipelineFrame
+{
+	PipelineFrame() : index(0), layout(FRAME_PACKED), siting(CHROMA_SITING_CENTER) {}
 
-		int fourcc = static_cast<int>(s.videoCapture.get(cv::CAP_PROP_FOURCC));
+	size_t index;
+	cv::Mat image;
+	FrameLayout layout;
+	ChromaSiting siting;        // of the I420 layouts
+	std::string source;         // the input file of an image of a list
+};
 
-		cv::Size deducedOriginalSize = cv::Size(
-			(int) s.videoCapture.get(cv::CAP_PROP_FRAME_WIDTH), 
-			(int) s.videoCapture.get(cv::CAP_PROP_FRAME_HEIGHT));
+//--------------------------------------------------
+// "cycles 1234, instructions 5678, ipc 4.60, ..." with every count divided by frames. Counters that are
+// not available are left out; multiplexed ones, scaled up from part of the time, are marked "(scaled)".
+//--------------------------------------------------
 
-		assert( deducedOriginalSize.width == s.originalSize.width && deducedOriginalSize.height == s.originalSize.height );
+static std::string formatPerfCounts(const PerfCounts& counts, size_t frames)
+{
+	const double n = (double) std::max(frames, (size_t) 1);
+	std::string text;
+	char sbuf_item[64];
+	for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+	{
+		if ( counts.has((PerfEvent) i) )
+		{
+			snprintf(sbuf_item, sizeof(sbuf_item), "%s%s %.0f%s", text.empty() ? "" : ", ",
+				perfEventName((PerfEvent) i), counts.value[i] / n, counts.isScaled((PerfEvent) i) ? " (scaled)" : "");
+			text += sbuf_item;
+		}
+	}
+	if ( counts.has(PERF_EVENT_CYCLES) && counts.has(PERF_EVENT_INSTRUCTIONS) && counts.value[PERF_EVENT_CYCLES] > 0 )
+	{
+		snprintf(sbuf_item, sizeof(sbuf_item), ", ipc %.2f",
+			(double) counts.value[PERF_EVENT_INSTRUCTIONS] / counts.value[PERF_EVENT_CYCLES]);
+		text += sbuf_item;
+	}
+	return text.empty() ? "no counters" : text;
+}
+
+//--------------------------------------------------
+// Remaps a batch of frames in one pass over the maps and passes the results on, in batch order.
+// I420 frames (planar) are flattened one by one, plane by plane.
+// If runPerf is not NULL, the hardware events of the batch are logged per frame and added to it.
+// Returns false if the output queue was closed.
+//--------------------------------------------------
+
+static bool remapBatch(const Flattener& flattener, std::vector<PipelineFrame>& batch, BoundedQueue<PipelineFrame>& output,
+	StageTimings& timings, PerfAccumulator * runPerf)
+{
+	// Packed frames go through the Flattener together; planar ones one by one, plane by plane.
+	std::vector<cv::Mat> srcs;
+	std::vector<size_t> packed;
+	std::vector<cv::Mat> dsts(batch.size());
+	for ( size_t k = 0; k < batch.size(); ++k )
+	{
+		if ( batch[k].layout == FRAME_PACKED )
+		{
+			srcs.push_back(batch[k].image);
+			packed.push_back(k);
+			batch[k].image.release();
+		}
+	}
+	PerfAccumulator batchPerf;
+	{
+		ScopedStageTimer timer(timings, STAGE_REMAP, batch.size());
+		if ( packed.size() < batch.size() )
+		{
+			for ( size_t k = 0; k < batch.size(); ++k )
+			{
+				if ( batch[k].layout == FRAME_PACKED )
+				{
+					continue;
+				}
+				// Settings::validate() has checked the sizes, the raw reader or the JPEG decoder the layout.
+				const bool flattened = flattener.processI420(batch[k].image, dsts[k], batch[k].layout == FRAME_I420_FULL,
+					batch[k].siting, runPerf != NULL ? &batchPerf : NULL);
+				CV_Assert(flattened);
+				batch[k].image.release();
+			}
+		}
+		if ( !srcs.empty() )
+		{
+			std::vector<cv::Mat> packedDsts;
+			flattener.processBatch(srcs, packedDsts, runPerf != NULL ? &batchPerf : NULL);
+			for ( size_t j = 0; j < packed.size(); ++j )
+			{
+				dsts[packed[j]] = packedDsts[j];
+			}
+		}
+	}
+	srcs.clear();
+	if ( runPerf != NULL )
+	{
+		// The frames of a batch share every pass over the maps, so each gets an equal share.
+		const PerfCounts counts = batchPerf.total();
+		runPerf->add(counts);
+		const std::string text = formatPerfCounts(counts, batch.size());
+		for ( size_t k = 0; k < batch.size(); ++k )
+		{
+			logmsg("remapBatch() frame %zu: %s", batch[k].index, text.c_str());
+		}
+	}
+	for ( size_t k = 0; k < batch.size(); ++k )
+	{
+		PipelineFrame out;
+		out.index = batch[k].index;
+		out.layout = batch[k].layout;
+		out.image = dsts[k];
+		dsts[k].release();
+		if ( !output.push(out) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//--------------------------------------------------
+// Decodes an image of the list: JPEG through the codec of the thread with jpeg_fast_path, 4:2:0 ones
+// as planes when jpegPlanar; anything else, JPEGs with an EXIF orientation to apply, grayscale JPEGs
+// with keep_bit_depth and JPEGs TurboJPEG cannot decode, with cv::imdecode() from the bytes of the
+// reader of the thread, or with cv::imread() for input_reader "imread".
+// Returns false, with the reason in problem, if there is no image.
+//--------------------------------------------------
+
+static bool decodeListImage(const Settings& s, FileReader& reader, JpegCodec& codec, const std::string& path,
+	PipelineFrame& frame, std::string& problem)
+{
+	frame.layout = FRAME_PACKED;
+	frame.image.release();
+	bool turbo = s.jpegFastPath && isJpegFilename(path);
+	if ( !turbo && s.inputReader == "imread" )
+	{
+		frame.image = cv::imread(path, imageReadFlags(s.keepBitDepth));
+		problem = frame.image.empty() ? "cv::imread() could not read '" + path + "'" : std::string();
+		return !frame.image.empty();
+	}
+
+	const uchar * data = NULL;
+	size_t size = 0;
+	if ( !reader.read(path, data, size, problem) )
+	{
+		return false;
+	}
+	if ( size > (size_t) INT_MAX )
+	{
+		problem = "'" + path + "' is too large to decode";
+		return false;
+	}
+	if ( turbo && !s.keepBitDepth && jpegExifOrientation(data, size) != 1 )
+	{
+		// cv::imdecode() applies the EXIF orientation and TurboJPEG does not; it decides, so that the
+		// output does not depend on jpeg_fast_path.
+		turbo = false;
+	}
+	if ( turbo && s.keepBitDepth && jpegIsGrayscale(data, size) )
+	{
+		// TurboJPEG would expand it to BGR; with keep_bit_depth, cv::imdecode() keeps its one channel.
+		turbo = false;
+	}
+	if ( turbo )
+	{
+		bool i420 = false;
+		bool decoded = codec.decode(data, size, s.jpegPlanar, frame.image, i420, problem);
+		if ( decoded && i420 && (frame.image.cols != s.flattenerOptions.profile.originalSize.width ||
+			frame.image.rows != s.flattenerOptions.profile.originalSize.height * 3 / 2) )
+		{
+			// The planes can only be flattened at the size of the profile; the maps cope with BGR of any size.
+			decoded = codec.decode(data, size, false, frame.image, i420, problem);
+		}
+		if ( decoded )
+		{
+			frame.layout = i420 ? FRAME_I420_FULL : FRAME_PACKED;
+			return true;
+		}
+		logmsg("decodeListImage() TurboJPEG could not decode '%s' (%s); trying cv::imdecode().", path.c_str(), problem.c_str());
+	}
+	frame.image = cv::imdecode(cv::Mat(1, (int) size, CV_8UC1, (void *) data), imageReadFlags(s.keepBitDepth));
+	problem = frame.image.empty() ? "cv::imdecode() could not decode '" + path + "'" : std::string();
+	return !frame.image.empty();
+}
+
+//--------------------------------------------------
+// Encodes a flattened image of the list for the file path; the counterpart of decodeListImage().
+//--------------------------------------------------
+
+static bool encodeListImage(const Settings& s, JpegCodec& codec, const std::string& path, const PipelineFrame& frame,
+	std::vector<uchar>& encoded, int& storedDepth, std::string& problem)
+{
+	storedDepth = frame.image.depth();
+	if ( frame.layout == FRAME_I420_FULL || (s.jpegFastPath && isJpegFilename(path) && frame.image.type() == CV_8UC3) )
+	{
+		const uchar * data = NULL;
+		size_t size = 0;
+		if ( !codec.encode(frame.image, frame.layout == FRAME_I420_FULL, data, size, problem) )
+		{
+			problem = "TurboJPEG: " + problem;
+			return false;
+		}
+		encoded.assign(data, data + size);
+		return true;
+	}
+	std::vector<int> params;
+	params.push_back(cv::IMWRITE_JPEG_QUALITY);
+	params.push_back(s.jpegQuality);
+	try
+	{
+		if ( encodeImage(path, frame.image, encoded, storedDepth, params) )
+		{
+			return true;
+		}
+		problem = "cv::imencode() could not encode for '" + path + "'";
+	}
+	catch (const cv::Exception& ex)
+	{
+		problem = std::string("cv::imencode() encountered an exception: ") + ex.what();
+	}
+	return false;
+}
+
+//--------------------------------------------------
+// Staged pipeline for an image list:
+//
+//   decoder threads --> [decoded queue] --> remap threads --> [remapped queue] --> encoder threads
+//     --> [writer queue] --> writer threads
+//
+// Each queue holds at most s.queueDepth frames, so the number of frames in memory is bounded by the
+// queue depths plus one frame per thread, regardless of the length of the list.
+// The maps are shared read-only by all remap threads.
+// Images that fail are handled by s.failurePolicy and listed in the failure manifest. Returns false if
+// the policy aborted the run.
+//--------------------------------------------------
+// Hands the images of a list to the decoder threads, with the reads to retry (failure_policy "retry")
+// first once they fall due, as AsyncFileWriter does for writes. A decoder never waits for the retry of
+// an image while there are other images to read.
+//--------------------------------------------------
+
+class ListReadQueue
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Item
+	{
+		size_t index;
+		std::string path;
+		int attempts;          // reads of the image so far
+	};
+
+	ListReadQueue(ImageSource& source, const std::atomic<bool>& stop)
+		: source(source), stop(stop), sourceDone(false), taken(0)
+	{
+	}
+
+	// The next image to read: a retry that is due, else the next image of the source. While the only
+	// images left are retries that are not due yet or images other decoders may still put back, waits
+	// for them. Returns false when none is left or stop is set. Every image taken must be given back to
+	// retry() or done().
+	bool take(Item& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while ( !stop )
+		{
+			if ( !retries.empty() && retries.begin()->first <= Clock::now() )
+			{
+				item = retries.begin()->second;
+				retries.erase(retries.begin());
+				taken++;
+				return true;
+			}
+			if ( !sourceDone )
+			{
+				// The source may enumerate a directory; the other decoders go on meanwhile.
+				taken++;
+				lock.unlock();
+				const bool more = source.next(item.index, item.path);
+				lock.lock();
+				if ( more )
+				{
+					item.attempts = 0;
+					return true;
+				}
+				taken--;
+				sourceDone = true;
+				continue;
+			}
+			if ( retries.empty() && taken == 0 )
+			{
+				break;
+			}
+			if ( retries.empty() )
+			{
+				changed.wait(lock);
+			}
+			else
+			{
+				changed.wait_until(lock, retries.begin()->first);
+			}
+		}
+		changed.notify_all();
+		return false;
+	}
+
+	// Puts an image that could not be read back, to be read again after delayMs.
+	void retry(const Item& item, int delayMs)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		retries.insert(std::make_pair(Clock::now() + std::chrono::milliseconds(delayMs), item));
+		taken--;
+		changed.notify_all();
+	}
+
+	void done()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		taken--;
+		changed.notify_all();
+	}
+
+	//--------------------------------------------------
+
+private:
+	ListReadQueue(const ListReadQueue&);
+	ListReadQueue& operator=(const ListReadQueue&);
+
+	ImageSource& source;
+	const std::atomic<bool>& stop;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool sourceDone;
+	size_t taken;              // images being read, which may still come back as retries
+	std::multimap<Clock::time_point, Item> retries;
+};
+
+//--------------------------------------------------
+
+static bool processImageList(Settings& s, const Flattener& flattener, StageTimings& timings, PerfAccumulator * perf)
+{
+	const int numCpus = std::max(1, (int) std::thread::hardware_concurrency());
+	const int decoderThreads = s.decoderThreads > 0 ? s.decoderThreads : std::max(1, numCpus / 3);
+	const int encoderThreads = s.encoderThreads > 0 ? s.encoderThreads : std::max(1, numCpus / 3);
+	const int writerThreads = s.writerThreads > 0 ? s.writerThreads : 2;
+	const int remapThreads = s.remapThreads > 0 ? s.remapThreads : std::max(1, numCpus - decoderThreads - encoderThreads);
+	const int batchSize = std::max(1, s.batchSize);
+	// A remap thread waits for a full batch, so the decoded queue must be able to hold one.
+	const int queueDepth = std::max(batchSize, s.queueDepth > 0 ? s.queueDepth
+		: std::max(2 * std::max(decoderThreads, std::max(remapThreads, encoderThreads)), remapThreads * batchSize));
+
+	logmsg("processImageList() %s list, %d decoder / %d remap / %d encoder / %d writer threads, queue depth %d, batch size %d",
+		s.imageSource.kindName(), decoderThreads, remapThreads, encoderThreads, writerThreads, queueDepth, batchSize);
+
+	// With --resume, the images the journal lists, and those whose output is already there in full, are
+	// left out as they are enumerated, before anything is read.
+	CompletionJournal journal;
+	const std::string journalPath = !s.journal.empty() ? s.journal : makeRunOutputPath(s, "-b-journal.txt");
+	std::string journalProblem;
+	if ( !journal.open(journalPath, s.resume, s.journalFsyncBatch, journalProblem) )
+	{
+		logmsg("processImageList() No journal: %s", journalProblem.c_str());
+	}
+	if ( s.resume )
+	{
+		logmsg("processImageList() resuming with %zu images in the journal '%s'", journal.loadedEntries().size(), journalPath.c_str());
+		s.imageSource.setSkip([&](const std::string& path)
+		{
+			if ( journal.contains(path) )
+			{
+				return true;
+			}
+			if ( imageFileLooksComplete(makeOutputImageFilename(s, path)) )
+			{
+				journal.add(path);
+				return true;
+			}
+			return false;
+		});
+	}
+	s.imageSource.setReadahead((size_t) s.inputReadahead);
+
+	BoundedQueue<PipelineFrame> decodedQueue((size_t) queueDepth);
+	BoundedQueue<PipelineFrame> remappedQueue((size_t) queueDepth);
+	std::atomic<bool> stopDecoding(false);
+	std::atomic<int> liveDecoders(decoderThreads);
+	std::atomic<int> liveRemappers(remapThreads);
+	std::atomic<bool> depthWarned(false);
+	std::atomic<bool> aborted(false);
+	FailureManifest failures;
+
+	// Never waits for the user: the image goes to the manifest and, with "abort", no further images are started.
+	const std::function<void(const char *, const std::string&, const std::string&, const std::string&, int)> fail =
+		[&](const char * stage, const std::string& input, const std::string& output, const std::string& problem, int attempts)
+	{
+		logmsg("processImageList() Could not %s '%s' (%d attempts): %s", stage, input.c_str(), attempts, problem.c_str());
+		failures.record(stage, input, output, problem, attempts);
+		if ( s.failurePolicy == FAILURE_ABORT && !aborted.exchange(true) )
+		{
+			logmsg("processImageList() failure_policy is \"abort\". No further images will be started.");
+			stopDecoding = true;
+		}
+	};
+
+	const bool retry = s.failurePolicy == FAILURE_RETRY;
+	AsyncFileWriter writer(writerThreads, (size_t) queueDepth, s.outputFsyncBatch,
+		retry ? s.failureRetries : 0, s.failureRetryDelayMs,
+		[&](const AsyncFileWriter::Report& report)
+		{
+			if ( !report.problem.empty() )
+			{
+				fail("write", report.tag, report.path, report.problem, report.attempts);
+				return;
+			}
+			if ( report.synced )
+			{
+				logmsg("processImageList() synced '%s'", report.path.c_str());
+			}
+			// With output_fsync_batch, an image is only done once it is on the disk.
+			if ( report.synced == (s.outputFsyncBatch > 0) )
+			{
+				journal.add(report.tag);
+			}
+		});
+
+	std::vector<std::thread> threads;
+	ListReadQueue reads(s.imageSource, stopDecoding);
+
+	for ( int t = 0; t < decoderThreads; ++t )
+	{
+		threads.push_back(std::thread([&]
+		{
+			FileReader reader(s.fileReadMode);
+			JpegCodec codec(s.jpegQuality, s.jpegSubsampling);
+			ListReadQueue::Item item;
+			while ( reads.take(item) )
+			{
+				PipelineFrame frame;
+				frame.index = item.index;
+				frame.source = item.path;
+				std::string problem;
+				item.attempts++;
+				bool decoded = false;
+				{
+					ScopedStageTimer timer(timings, STAGE_DECODE);
+					decoded = decodeListImage(s, reader, codec, item.path, frame, problem);
+				}
+				if ( !decoded && retry && item.attempts <= s.failureRetries && !stopDecoding )
+				{
+					// Read again once the delay is over; this decoder goes on with the next image.
+					reads.retry(item, failureRetryDelayMs(s.failureRetryDelayMs, item.attempts));
+					continue;
+				}
+				reads.done();
+				if ( frame.image.empty() )
+				{
+					fail("read", item.path, std::string(), problem, item.attempts);
+					continue;
+				}
+				logmsg("processImageList() image %zu = '%s'", item.index, item.path.c_str());
+				if ( !decodedQueue.push(frame) )
+				{
+					break;
+				}
+			}
+			if ( --liveDecoders == 0 )
+			{
+				decodedQueue.close();
+			}
+		}));
+	}
+
+	for ( int t = 0; t < remapThreads; ++t )
+	{
+		threads.push_back(std::thread([&]
+		{
+			std::vector<PipelineFrame> batch;
+			while ( decodedQueue.popBatch(batch, (size_t) batchSize) )
+			{
+				if ( !remapBatch(flattener, batch, remappedQueue, timings, perf) )
+				{
+					break;
+				}
+			}
+			if ( --liveRemappers == 0 )
+			{
+				remappedQueue.close();
+			}
+		}));
+	}
+
+	for ( int t = 0; t < encoderThreads; ++t )
+	{
+		threads.push_back(std::thread([&]
+		{
+			JpegCodec codec(s.jpegQuality, s.jpegSubsampling);
+			PipelineFrame frame;
+			while ( remappedQueue.pop(frame) )
+			{
+				if ( aborted )
+				{
+					// Drain the pipeline without writing anything more.
+					frame.image.release();
+					continue;
+				}
+				// Save the view to a file.
+				const std::string outfilename = makeOutputImageFilename(s, frame.source);
+				bool result = false;
+				int storedDepth = frame.image.depth();
+				std::vector<uchar> encoded;
+				std::string problem;
+				{
+					ScopedStageTimer timer(timings, STAGE_ENCODE);
+					result = encodeListImage(s, codec, outfilename, frame, encoded, storedDepth, problem);
+				}
+				if ( result && storedDepth != frame.image.depth() && !depthWarned.exchange(true) )
+				{
+					logmsg("processImageList() The format of '%s' cannot store %s images; they are written as %s.",
+						outfilename.c_str(), depthName(frame.image.depth()), depthName(storedDepth));
+				}
+				frame.image.release();
+				if ( !result )
+				{
+					fail("encode", frame.source, outfilename, problem, 1);
+					continue;
+				}
+				// The writer threads take it from here and report their own failures.
+				writer.submit(outfilename, encoded, frame.source);
+			}
+		}));
+	}
+
+	for ( size_t t = 0; t < threads.size(); ++t )
+	{
+		threads[t].join();
+	}
+	writer.finish();
+	s.imageSource.setSkip(std::function<bool(const std::string&)>());
+	journal.close();
+
+	const std::string manifestPath = !s.failureManifest.empty() ? s.failureManifest : makeRunOutputPath(s, "-b-failures.json");
+	const size_t images = s.imageSource.enumerated();
+	if ( s.resume )
+	{
+		logmsg("processImageList() %zu of %zu images were done already.", s.imageSource.skipped(), images);
+	}
+	if ( failures.writeJson(manifestPath, s.failurePolicyName, images) )
+	{
+		logmsg("processImageList() %zu of %zu images failed; wrote '%s'", failures.count(), images, manifestPath.c_str());
+	}
+	else
+	{
+		logmsg("processImageList() Could not write '%s'.", manifestPath.c_str());
+	}
+	return !aborted;
+}
+
+//--------------------------------------------------
+// Ordered pipeline for a video file:
+//
+//   decoder thread --> [frame ring] --> remap threads --> [done queue] --> writer thread
+//
+// Every decoded frame gets a sequence number. The remap threads finish frames in any order; the writer
+// holds early arrivals in a reorder buffer keyed by sequence number and writes strictly in decode order,
+// so the output is the same as the serial loop produced.
+// The frames come from s.nextImage(), starting at s.frameNum, and go to writeFrame, a video file or stdout.
+// If journal is not NULL, it gets "frame N" every s.videoGopSize frames, N being a multiple of it one GOP
+// behind the frames written, as the encoder and the container may still hold the last ones in memory.
+// Returns false if writeFrame failed.
+//--------------------------------------------------
+
+static bool processVideo(Settings& s, const Flattener& flattener, const std::function<bool(const cv::Mat&)>& writeFrame,
+	StageTimings& timings, PerfAccumulator * perf, CompletionJournal * journal)
+{
+	const int numCpus = std::max(1, (int) std::thread::hardware_concurrency());
+	const int remapThreads = s.remapThreads > 0 ? s.remapThreads : std::max(1, numCpus - 2);
+	const int batchSize = std::max(1, s.batchSize);
+	// A remap thread waits for a full batch, so the frame ring must be able to hold one.
+	const int queueDepth = std::max(batchSize, s.queueDepth > 0 ? s.queueDepth : 2 * remapThreads * batchSize);
+
+	logmsg("processVideo() %d remap threads, queue depth %d, batch size %d", remapThreads, queueDepth, batchSize);
+
+	BoundedQueue<PipelineFrame> frameRing((size_t) queueDepth);
+	BoundedQueue<PipelineFrame> doneQueue((size_t) queueDepth);
+	// Frames from the decoder to the writer, the reorder buffer included: frames that finish out of
+	// order wait there for an earlier one, and a slow frame must not let the others pile up behind it.
+	// The oldest frame in flight has not reached the reorder buffer yet, so a full batch always fits.
+	CountingGate inFlight((size_t) queueDepth);
+	std::atomic<int> liveRemappers(remapThreads);
+	std::atomic<bool> writeFailed(false);
+	const size_t firstFrame = s.frameNum;
+
+	std::vector<std::thread> threads;
+
+	threads.push_back(std::thread([&]
+	{
+		for(;;)
+		{
+			if ( !inFlight.acquire() )
+			{
+				break;
+			}
+			PipelineFrame frame;
+			frame.index = s.frameNum;
+			frame.layout = s.isPlanar() ? FRAME_I420_VIDEO : FRAME_PACKED;
+			frame.siting = s.rawReader.chromaSiting();
+			{
+				ScopedStageTimer timer(timings, STAGE_DECODE);
+				frame.image = s.nextImage();
+			}
+			if ( frame.image.empty() )
+			{
+				break;
+			}
+			logmsg("processVideo() frame %zu", frame.index);
+			if ( !frameRing.push(frame) )
+			{
+				break;
+			}
+		}
+		frameRing.close();
+	}));
+
+	for ( int t = 0; t < remapThreads; ++t )
+	{
+		threads.push_back(std::thread([&]
+		{
+			std::vector<PipelineFrame> batch;
+			while ( frameRing.popBatch(batch, (size_t) batchSize) )
+			{
+				if ( !remapBatch(flattener, batch, doneQueue, timings, perf) )
+				{
+					break;
+				}
+			}
+			if ( --liveRemappers == 0 )
+			{
+				doneQueue.close();
+			}
+		}));
+	}
+
+	threads.push_back(std::thread([&]
+	{
+		std::map<size_t, cv::Mat> reorderBuffer;
+		size_t nextToWrite = firstFrame;
+		const size_t gop = (size_t) s.videoGopSize;
+		PipelineFrame frame;
+		while ( doneQueue.pop(frame) )
+		{
+			reorderBuffer[frame.index] = frame.image;
+			frame.image.release();
+			std::map<size_t, cv::Mat>::iterator it;
+			while ( (it = reorderBuffer.find(nextToWrite)) != reorderBuffer.end() )
+			{
+				bool written = false;
+				{
+					ScopedStageTimer timer(timings, STAGE_ENCODE);
+					written = writeFrame(it->second);
+				}
+				if ( !written )
+				{
+					writeFailed = true;
+					// Unblock the decoder and the remap threads so that everybody winds down.
+					inFlight.close();
+					frameRing.close();
+					doneQueue.close();
+					return;
+				}
+				reorderBuffer.erase(it);
+				inFlight.release();
+				++nextToWrite;
+				if ( journal != NULL && nextToWrite % gop == 0 && nextToWrite - firstFrame >= 2 * gop )
+				{
+					journal->add(cv::format("frame %zu", nextToWrite - gop));
+				}
+			}
+		}
+		inFlight.close();
+	}));
+
+	for ( size_t t = 0; t < threads.size(); ++t )
+	{
+		threads[t].join();
+	}
+	return !writeFailed;
+}
+
+//--------------------------------------------------
+// Positions capture so that the next frame read is frame number frame, for a resumed video run.
+//
+// What CAP_PROP_POS_FRAMES reports after a seek is computed from the time stamp the demuxer asked for,
+// not from the frame actually decoded, and a seek can land on a neighbouring key frame. So the seek
+// goes margin frames early, and frames are decoded forward from there, each identified by its own
+// time stamp (CAP_PROP_POS_MSEC), until the one before frame. If the seek landed too late anyway, input
+// is opened again and the frames are decoded from the start. Returns false if the position cannot be
+// established.
+//--------------------------------------------------
+
+static bool seekVideoToFrame(cv::VideoCapture& capture, const std::string& input, size_t frame, size_t margin)
+{
+	const double fps = capture.get(cv::CAP_PROP_FPS);
+	if ( frame == 0 || fps <= 0 )
+	{
+		return frame == 0;
+	}
+	const size_t start = frame > margin ? frame - margin : 0;
+	if ( start > 0 && capture.set(cv::CAP_PROP_POS_FRAMES, (double) start) )
+	{
+		size_t index = 0;
+		size_t skipped = 0;
+		while ( capture.grab() )
+		{
+			skipped++;
+			index = (size_t) llround(capture.get(cv::CAP_PROP_POS_MSEC) * fps / 1000.);
+			if ( index >= frame - 1 )
+			{
+				break;
+			}
+		}
+		if ( skipped > 0 && index == frame - 1 )
+		{
+			logmsg("seekVideoToFrame() at frame %zu after a seek to %zu and %zu frames decoded", frame, start, skipped);
+			return true;
+		}
+		logmsg("seekVideoToFrame() the seek to %zu landed at frame %zu; decoding from the start", start, index);
+	}
+
+	if ( start > 0 && !capture.open(input) )
+	{
+		return false;
+	}
+	for ( size_t i = 0; i < frame; i++ )
+	{
+		if ( !capture.grab() )
+		{
+			return false;
+		}
+	}
+	logmsg("seekVideoToFrame() at frame %zu after decoding from the start", frame);
+	return true;
+}
+
+//--------------------------------------------------
+// Logs the per-stage latencies and writes them as JSON next to the output, named after the input:
+// "/tmp/x.avi" -> "/tmp/x-b-timings.json". The hardware events of the remap go along if perf is not NULL.
+//--------------------------------------------------
+
+static void writeTimingSummary(const Settings& s, const StageTimings& timings, int64 runStart, const PerfAccumulator * perf)
+{
+	const double wallMs = (cv::getTickCount() - runStart) * 1000. / cv::getTickFrequency();
+	for ( int i = 0; i < NUM_TIMED_STAGES; i++ )
+	{
+		const StageStats st = timings.stats((TimedStage) i);
+		logmsg("writeTimingSummary() %-9s %6zu x, total %10.1f ms, p50 %8.2f / p90 %8.2f / p99 %8.2f / max %8.2f ms",
+			StageTimings::stageName((TimedStage) i), st.count, st.totalMs, st.p50Ms, st.p90Ms, st.p99Ms, st.maxMs);
+	}
+
+	PerfCounts perfTotal;
+	if ( perf != NULL )
+	{
+		perfTotal = perf->total();
+		const size_t frames = timings.stats(STAGE_REMAP).count;
+		logmsg("writeTimingSummary() remap hardware events per frame over %zu frames: %s",
+			frames, formatPerfCounts(perfTotal, frames).c_str());
+	}
+
+	const std::string path = makeRunOutputPath(s, "-b-timings.json");
+	if ( timings.writeJson(path, wallMs, perf != NULL ? &perfTotal : NULL) )
+	{
+		logmsg("writeTimingSummary() wrote '%s' (wall time %.1f ms)", path.c_str(), wallMs);
+	}
+	else
+	{
+		logmsg("writeTimingSummary() Could not write '%s'.", path.c_str());
+	}
+}
+
+//--------------------------------------------------
+// Daemon mode: "flatten --serve=/path/to/socket" listens on a Unix domain socket and runs one job per
+// connection. A request is a header of "key value" lines ended by an empty line:
+//
+//   settings /path/to/flatten-settings.xml     lens profile and options from a settings file, or
+//   profile 1234                               from the 1234 bytes of settings XML/YAML after the header
+//   input /path/to/in.JPG                      an image or a video
+//   output /path/to/out.JPG
+//
+// Paths must be absolute, since the server does not share the working directory of the client. A client
+// that sends nothing for CONST_INT__SERVE_SOCKET_TIMEOUT_S seconds, or does not read its reply, is dropped.
+//
+// The reply is a single line, "OK frames <n> ms <t> maps <hit|built>" or "ERROR <reason>", after which the
+// server closes the connection. flatten_client sends such requests.
+//
+// Flatteners are kept in a FlattenerCache, so only the first job of a lens profile builds maps. Jobs run
+// on a fixed set of worker threads; the remap of each frame is spread further by cv::parallel_for_().
+//--------------------------------------------------
+
+struct ServeJob
+{
+	std::string settingsPath;
+	std::string profileText;
+	std::string input;
+	std::string output;
+};
+
+static volatile sig_atomic_t serveStopping = 0;
+static int serveListenFd = -1;
+
+//--------------------------------------------------
+
+static void onServeSignal(int)
+{
+	serveStopping = 1;
+	if ( serveListenFd >= 0 )
+	{
+		shutdown(serveListenFd, SHUT_RDWR); // wakes up accept()
+	}
+}
+
+//--------------------------------------------------
+
+static bool sendFully(int fd, const std::string& text)
+{
+	size_t done = 0;
+	while ( done < text.size() )
+	{
+		const ssize_t n = send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			return false;
+		}
+		done += (size_t) n;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+static bool readServeRequest(int fd, ServeJob& job, std::string& problem)
+{
+	std::string data;
+	size_t headerEnd = std::string::npos;
+	char chunk[4096];
+	while ( headerEnd == std::string::npos )
+	{
+		if ( data.size() > CONST_INT__SERVE_MAX_HEADER_BYTES )
+		{
+			problem = "request header too long";
+			return false;
+		}
+		const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			problem = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? "timed out reading the request" : "incomplete request";
+			return false;
+		}
+		data.append(chunk, (size_t) n);
+		headerEnd = data.find("\n\n");
+	}
+
+	size_t profileBytes = 0;
+	std::istringstream header(data.substr(0, headerEnd));
+	std::string line;
+	while ( std::getline(header, line) )
+	{
+		const size_t space = line.find(' ');
+		const std::string key = line.substr(0, space);
+		const std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+		if ( key == "settings" )
+		{
+			job.settingsPath = value;
+		}
+		else if ( key == "profile" )
+		{
+			profileBytes = (size_t) strtoul(value.c_str(), NULL, 10);
+		}
+		else if ( key == "input" )
+		{
+			job.input = value;
+		}
+		else if ( key == "output" )
+		{
+			job.output = value;
+		}
+		else
+		{
+			problem = "unknown request key '" + key + "'";
+			return false;
+		}
+	}
+	if ( profileBytes > CONST_INT__SERVE_MAX_PROFILE_BYTES )
+	{
+		problem = "profile too long";
+		return false;
+	}
 
-		videoWriter.open(outputVideoFilename, fourcc, s.videoCapture.get(cv::CAP_PROP_FPS), deducedOriginalSize, true);
-		if ( !videoWriter.isOpened() )
+	job.profileText = data.substr(headerEnd + 2);
+	while ( job.profileText.size() < profileBytes )
+	{
+		const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+		if ( n < 0 && errno == EINTR )
 		{
-			std::cerr << "Fatal error: Could not open the output video for writing: " << outputVideoFilename << std::endl;
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			problem = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? "timed out reading the profile" : "incomplete profile";
+			return false;
+		}
+		job.profileText.append(chunk, (size_t) n);
+	}
+	job.profileText.resize(profileBytes);
+
+	if ( job.settingsPath.empty() == job.profileText.empty() )
+	{
+		problem = "exactly one of 'settings' and 'profile' is required";
+		return false;
+	}
+	if ( job.input.empty() || job.output.empty() )
+	{
+		problem = "'input' and 'output' are required";
+		return false;
+	}
+	if ( job.input[0] != '/' || job.output[0] != '/' || (!job.settingsPath.empty() && job.settingsPath[0] != '/') )
+	{
+		problem = "paths must be absolute";
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+// Runs one job and returns the reply line.
+//--------------------------------------------------
+
+static std::string runServeJob(FlattenerCache& cache, const ServeJob& job)
+{
+	const int64 start = cv::getTickCount();
+	FlattenerOptions options;
+	if ( !job.settingsPath.empty() )
+	{
+		if ( !readFlattenerOptions(job.settingsPath, options) )
+		{
+			return "ERROR could not open the settings file '" + job.settingsPath + "'";
+		}
+	}
+	else
+	{
+		cv::FileStorage fs(job.profileText, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+		if ( !fs.isOpened() )
+		{
+			return "ERROR could not parse the profile";
+		}
+		readFlattenerOptions(fs["Settings"], options);
+	}
+
+	std::string problem;
+	bool hit = false;
+	std::shared_ptr<const Flattener> flattener = cache.get(options, problem, hit);
+	if ( !flattener )
+	{
+		return "ERROR " + problem;
+	}
+
+	size_t frames = 0;
+	cv::Mat in = cv::imread(job.input, cv::IMREAD_COLOR);
+	cv::Mat out;
+	if ( !in.empty() )
+	{
+		flattener->process(in, out);
+		if ( !cv::imwrite(job.output, out) )
+		{
+			return "ERROR could not write '" + job.output + "'";
+		}
+		frames = 1;
+	}
+	else
+	{
+		cv::VideoCapture capture(job.input);
+		if ( !capture.isOpened() )
+		{
+			return "ERROR could not read '" + job.input + "'";
+		}
+		cv::VideoWriter writer(job.output, static_cast<int>(capture.get(cv::CAP_PROP_FOURCC)),
+			capture.get(cv::CAP_PROP_FPS), flattener->outputSize(), true);
+		if ( !writer.isOpened() )
+		{
+			return "ERROR could not open '" + job.output + "' for writing";
+		}
+		while ( capture.read(in) && !in.empty() )
+		{
+			flattener->process(in, out);
+			writer.write(out);
+			++frames;
+		}
+	}
+
+	const double elapsedMs = (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+	return cv::format("OK frames %zu ms %.1f maps %s", frames, elapsedMs, hit ? "hit" : "built");
+}
+
+//--------------------------------------------------
+
+static int serve(const std::string& socketPath, int workers, int cacheSize)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if ( socketPath.size() >= sizeof(address.sun_path) )
+	{
+		std::cerr << "Fatal error: socket path too long: " << socketPath << std::endl;
+		return -1;
+	}
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+	// A socket left behind by a server that did not shut down refuses connections and can go; one that
+	// accepts them belongs to a live server.
+	struct stat st;
+	if ( lstat(socketPath.c_str(), &st) == 0 )
+	{
+		const int probeFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		const bool live = probeFd >= 0 && connect(probeFd, (const sockaddr *) &address, sizeof(address)) == 0;
+		const int err = errno;
+		if ( probeFd >= 0 )
+		{
+			close(probeFd);
+		}
+		if ( live )
+		{
+			std::cerr << "Fatal error: a flatten server is already running on " << socketPath << std::endl;
+			return -1;
+		}
+		if ( !S_ISSOCK(st.st_mode) || err != ECONNREFUSED )
+		{
+			std::cerr << "Fatal error: " << socketPath << " is in the way: "
+				<< (S_ISSOCK(st.st_mode) ? strerror(err) : "not a socket") << std::endl;
 			return -1;
 		}
+		unlink(socketPath.c_str());
+	}
 
-		for(;;)
+	const int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if ( listenFd < 0 || bind(listenFd, (const sockaddr *) &address, sizeof(address)) != 0 || listen(listenFd, 64) != 0 )
+	{
+		std::cerr << "Fatal error: could not listen on " << socketPath << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+	serveListenFd = listenFd;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onServeSignal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	const int numCpus = std::max(1, (int) std::thread::hardware_concurrency());
+	if ( workers <= 0 )
+	{
+		workers = std::max(1, numCpus / 2);
+	}
+	FlattenerCache cache((size_t) std::max(1, cacheSize));
+	BoundedQueue<int> connections((size_t) workers * 4);
+	logmsg("serve() listening on '%s', %d workers, %d cached lens profiles", socketPath.c_str(), workers, std::max(1, cacheSize));
+
+	std::vector<std::thread> threads;
+	for ( int t = 0; t < workers; ++t )
+	{
+		threads.push_back(std::thread([&]
 		{
-			size_t i = s.frameNum;
-			view = s.nextImage();
-			if ( view.empty() )
+			int fd = -1;
+			while ( connections.pop(fd) )
 			{
-				break;
+				ServeJob job;
+				std::string problem;
+				std::string reply;
+				if ( !readServeRequest(fd, job, problem) )
+				{
+					reply = "ERROR " + problem;
+				}
+				else
+				{
+					try
+					{
+						reply = runServeJob(cache, job);
+					}
+					catch (const std::exception& ex)
+					{
+						reply = std::string("ERROR ") + ex.what();
+					}
+					catch (...)
+					{
+						reply = "ERROR unknown exception";
+					}
+				}
+				// Replies are a single line; multi-line exception texts are folded into it.
+				std::replace(reply.begin(), reply.end(), '\n', ' ');
+				logmsg("serve() '%s' -> '%s': %s", job.input.c_str(), job.output.c_str(), reply.c_str());
+				sendFully(fd, reply + "\n");
+				close(fd);
+			}
+		}));
+	}
+
+	while ( !serveStopping )
+	{
+		const int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+		if ( fd < 0 )
+		{
+			if ( errno == EINTR || errno == ECONNABORTED )
+			{
+				continue;
+			}
+			if ( !serveStopping )
+			{
+				logmsg("serve() accept() failed: %s", strerror(errno));
+			}
+			break;
+		}
+		// A stalled client must not hold a worker forever.
+		struct timeval timeout;
+		timeout.tv_sec = CONST_INT__SERVE_SOCKET_TIMEOUT_S;
+		timeout.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		if ( !connections.push(fd) )
+		{
+			close(fd);
+			break;
+		}
+	}
+
+	// Jobs already accepted are finished before exiting.
+	connections.close();
+	for ( size_t t = 0; t < threads.size(); ++t )
+	{
+		threads[t].join();
+	}
+	serveListenFd = -1;
+	close(listenFd);
+	unlink(socketPath.c_str());
+	logmsg("serve() stopped, %zu lens profiles cached.", cache.size());
+	return 0;
+}
+
+//--------------------------------------------------
+
+int main (int argc, char** argv)
+{
+	const int64 runStart = cv::getTickCount();
+	const cv::String keys
+		= "{help h usage ? |           | print this message            }"
+		  "{@settings      |default.xml| input setting file            }"
+		  "{serve          |           | run as a daemon on this Unix socket }"
+		  "{serve_workers  |0          | jobs run at once (default: CPUs / 2) }"
+		  "{serve_cache    |8          | lens profiles kept ready      }"
+		  "{resume         |           | skip what the journal of the last run lists }";
+
+	cv::CommandLineParser parser(argc, argv, keys);
+
+	parser.about("This is a distortion flattening program.\n"
+				 "Usage: flatten [configuration_file] -- default ./default.xml]\n"
+				 "       flatten [configuration_file] --resume -- go on where the last run stopped\n"
+				 "       flatten --serve=socket_path -- run jobs sent by flatten_client\n"
+				 "The configuration file can be XML, YML or YAML.");
+
+	if ( !parser.check() )
+	{
+		parser.printErrors();
+		return 0;
+	}
+
+	if ( parser.has("help") )
+	{
+		parser.printMessage();
+		return 0;
+	}
+
+	if ( parser.has("serve") )
+	{
+		return serve(parser.get<std::string>("serve"), parser.get<int>("serve_workers"), parser.get<int>("serve_cache"));
+	}
+
+	//! [file_read]
+	Settings s;
+	const std::string inputSettingsFile = parser.get<std::string>(0);
+	cv::FileStorage fs(inputSettingsFile, cv::FileStorage::READ); // Read the settings
+	if ( !fs.isOpened() )
+	{
+		std::cerr << "Fatal error: Could not open the configuration file: \"" << inputSettingsFile << "\"" << std::endl;
+		parser.printMessage();
+		return -1;
+	}
+	s.read(fs["Settings"]);
+	fs.release();                                         // close Settings file
+	s.resume = parser.has("resume");
+	//! [file_read]
+
+	// Raw frames on stdout leave only stderr for the log.
+	if ( s.inputType == Settings::RAW_STREAM )
+	{
+		p_log_stream = stderr;
+	}
+	logmsg("main() begins.");
+
+	//FileStorage fout("settings.yml", FileStorage::WRITE); // write config as YAML
+	//fout << "Settings" << s;
+
+	if ( !s.goodInput )
+	{
+		std::cerr << "Fatal error: Invalid input detected. Application stopping." << std::endl;
+		return -1;
+	}
+
+	// Installed before the maps and the first frame are allocated. Mats allocated earlier keep
+	// the allocator they were created with.
+	PooledMatAllocator * bufferPool = NULL;
+	if ( s.bufferPool )
+	{
+		bufferPool = PooledMatAllocator::create(CONST_INT__BUFFER_POOL_MIN_BYTES, (size_t) s.bufferPoolLimitMb << 20);
+		cv::Mat::setDefaultAllocator(bufferPool);
+	}
+
+	StageTimings timings;
+	Flattener flattener;
+	std::string setupProblem;
+	if ( !flattener.init(s.flattenerOptions, setupProblem) )
+	{
+		std::cerr << "Fatal error: " << setupProblem << std::endl;
+		return -1;
+	}
+	timings.record(STAGE_MAP_SETUP, flattener.setupMs());
+	const Remapper& remapper = flattener.remapper();
+	logmsg("main() maps from %s, set up in %.1f ms", flattener.mapOrigin().c_str(), flattener.setupMs());
+	logmsg("main() remap engine = '%s'", remapper.name().c_str());
+
+	if ( s.flattenerOptions.mapMode == "mesh" && s.meshErrorReport )
+	{
+		reportMeshError(remapper, s.flattenerOptions.profile, s.flattenerOptions.meshStep);
+	}
+	if ( s.flattenerOptions.remapScheduler == "tiled" )
+	{
+		reportTileFootprints(remapper, s.tileReport);
+	}
+
+	PerfAccumulator runPerf;
+	PerfAccumulator * perf = NULL;
+	if ( s.perfCounters )
+	{
+		std::string problem;
+		const unsigned available = perfCountersProbe(problem);
+		if ( !problem.empty() )
+		{
+			logmsg("main() Some hardware counters are not available: %s", problem.c_str());
+		}
+		if ( available != 0 )
+		{
+			perf = &runPerf;
+		}
+		else
+		{
+			logmsg("main() Continuing without hardware counters.");
+		}
+	}
+
+	if ( s.remapEngineVerify )
+	{
+		// 8-bit BGR, and the 16-bit and float frames that keep_bit_depth lets through.
+		static const int types[] = { CV_8UC3, CV_16UC3, CV_32FC3 };
+		bool remapMatches = true;
+		for ( size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++ )
+		{
+			size_t mismatches = 0;
+			size_t total = 0;
+			double maxDifference = 0;
+			remapper.verify(s.flattenerOptions.profile.originalSize, types[i], mismatches, total, maxDifference);
+			logmsg("main() remap engine '%s' vs cv::remap(), %s: %zu of %zu values differ, max difference %g",
+				remapper.name().c_str(), depthName(CV_MAT_DEPTH(types[i])), mismatches, total, maxDifference);
+			remapMatches = remapMatches && mismatches == 0;
+		}
+		if ( !remapMatches )
+		{
+			std::cerr << "Fatal error: remap engine '" << remapper.name() << "' does not match cv::remap()." << std::endl;
+			logmsg("main() ends abnormally.");
+			return -1;
+		}
+
+		if ( s.flattenerOptions.mapMode == "analytic" || (s.flattenerOptions.mapMode == "dense" && s.flattenerOptions.mapGenerator == "builtin") )
+		{
+			if ( !verifyMaps(flattener) )
+			{
+				std::cerr << "Fatal error: the map entries differ from OpenCV's by more than "
+					<< CONST_INT__MAP_GENERATOR_TOLERANCE << "/" << cv::INTER_TAB_SIZE << " px." << std::endl;
+				logmsg("main() ends abnormally.");
+				return -1;
+			}
+		}
+	}
+
+	if ( s.inputType == Settings::IMAGE_LIST )
+	{
+		if ( !processImageList(s, flattener, timings, perf) )
+		{
+			writeTimingSummary(s, timings, runStart, perf);
+			logmsg("main() ends abnormally.");
+			return -1;
+		}
+	}
+	else if ( s.inputType == Settings::VIDEO_FILE )
+	{
+		logmsg("main() input video file = '%s'", s.input.c_str());
+
+		CompletionJournal journal;
+		const std::string journalPath = !s.journal.empty() ? s.journal : makeRunOutputPath(s, "-b-journal.txt");
+		std::string journalProblem;
+		if ( !journal.open(journalPath, s.resume, s.journalFsyncBatch, journalProblem) )
+		{
+			logmsg("main() No journal: %s", journalProblem.c_str());
+		}
+		size_t resumeFrame = 0;
+		const std::vector<std::string>& entries = journal.loadedEntries();
+		for ( size_t i = 0; i < entries.size(); i++ )
+		{
+			size_t frames = 0;
+			if ( sscanf(entries[i].c_str(), "frame %zu", &frames) == 1 )
+			{
+				resumeFrame = std::max(resumeFrame, frames);
+			}
+		}
+		if ( journal.contains("done") )
+		{
+			logmsg("main() The journal '%s' says the video is done already.", journalPath.c_str());
+			writeTimingSummary(s, timings, runStart, perf);
+			logmsg("main() ends normally.");
+			return 0;
+		}
+		if ( resumeFrame > 0 && !seekVideoToFrame(s.videoCapture, s.input, resumeFrame, (size_t) s.videoGopSize) )
+		{
+			logmsg("main() Could not seek to frame %zu; starting over.", resumeFrame);
+			s.videoCapture.release();
+			resumeFrame = 0;
+			if ( !s.videoCapture.open(s.input) )
+			{
+				std::cerr << "Fatal error: Could not open the input video again: " << s.input << std::endl;
+				return -1;
 			}
-			logmsg("main() frame %zu", i);
+		}
+		s.frameNum = resumeFrame;
+
+		// A resumed run writes the rest into a file of its own; the container of the first one cannot be
+		// appended to.
+		std::string outputVideoFilename = resumeFrame > 0
+			? makeOutputPath(s, s.input, cv::format("-b-from-%06zu.avi", resumeFrame))
+			: makeOutputPath(s, s.input, "-b.avi");
+		if ( resumeFrame > 0 )
+		{
+			logmsg("main() resuming at frame %zu, from the journal '%s'", resumeFrame, journalPath.c_str());
+		}
 
-			cv::remap(view, rview, map1, map2, cv::INTER_CUBIC);
+		logmsg("main() output video file = '%s'", outputVideoFilename.c_str());
+
+		cv::VideoWriter videoWriter;
+
+		int fourcc = static_cast<int>(s.videoCapture.get(cv::CAP_PROP_FOURCC));
+
+		cv::Size deducedOriginalSize = cv::Size(
+			(int) s.videoCapture.get(cv::CAP_PROP_FRAME_WIDTH), 
+			(int) s.videoCapture.get(cv::CAP_PROP_FRAME_HEIGHT));
+
+		assert( deducedOriginalSize == s.flattenerOptions.profile.originalSize );
 
-			// Crop the bigger rectified image down to the rectangle defined by the region of interest.
-			// Note that this does not copy the data.
-			cview = rview(myROI);
+		videoWriter.open(outputVideoFilename, fourcc, s.videoCapture.get(cv::CAP_PROP_FPS), deducedOriginalSize, true);
+		if ( !videoWriter.isOpened() )
+		{
+			std::cerr << "Fatal error: Could not open the output video for writing: " << outputVideoFilename << std::endl;
+			return -1;
+		}
 
+		const std::function<bool(const cv::Mat&)> writeFrame = [&videoWriter](const cv::Mat& frame)
+		{
 			try
 			{
-				videoWriter.write(cview);
+				videoWriter.write(frame);
 			}
 			catch (const cv::Exception& ex)
 			{
 				fprintf(stderr, "cv::VideoWriter::write() encountered an exception: %s\n", ex.what());
-				logmsg("main() ends abnormally.");
-				return -1;
+				return false;
 			}
+			return true;
+		};
+		if ( !processVideo(s, flattener, writeFrame, timings, perf, &journal) )
+		{
+			writeTimingSummary(s, timings, runStart, perf);
+			logmsg("main() ends abnormally.");
+			return -1;
+		}
+		videoWriter.release();
+		journal.add("done");
+	}
+	else if ( s.inputType == Settings::RAW_STREAM )
+	{
+		const LensProfile& profile = s.flattenerOptions.profile;
+		logmsg("main() %s frames from stdin to stdout, %d x %d -> %d x %d", s.rawFormatName.c_str(),
+			profile.originalSize.width, profile.originalSize.height, profile.finalSize.width, profile.finalSize.height);
+
+		RawFrameWriter rawWriter;
+		rawWriter.open(STDOUT_FILENO, s.rawFormat, s.flattenerOptions.profile.finalSize, s.rawReader.streamTags());
+		const std::function<bool(const cv::Mat&)> writeFrame = [&rawWriter](const cv::Mat& frame)
+		{
+			return rawWriter.write(frame);
+		};
+		if ( !processVideo(s, flattener, writeFrame, timings, perf, NULL) )
+		{
+			logmsg("main() Could not write to stdout.");
+			writeTimingSummary(s, timings, runStart, perf);
+			logmsg("main() ends abnormally.");
+			return -1;
+		}
+	}
 
-		} // end for
+	if ( bufferPool != NULL )
+	{
+		const PooledMatAllocator::Stats stats = bufferPool->stats();
+		logmsg("main() buffer pool: %zu reused, %zu mapped, %zu over the limit, %.1f MB mapped at the end%s",
+			stats.hits, stats.misses, stats.overLimit, stats.mappedBytes / (1024. * 1024.),
+			stats.hugePageAdviceFailures > 0 ? ", huge pages unavailable" : "");
 	}
 
+	writeTimingSummary(s, timings, runStart, perf);
 	logmsg("main() ends normally.");
 	return 0;
 }
@@ -0,0 +1,382 @@
+//--------------------------------------------------
+// Micro-benchmarks for the hot paths of flatten, on synthetic frames of the size in the lens profiles
+// (3840 x 2160 for the shipped ones).
+//
+// Every benchmark runs once to warm up, then the requested number of times. The median run is
+// reported as ns/pixel (of the pixels the operation produces or consumes) and frames/sec, as JSON on
+// stdout or in the file given with --output, so runs can be diffed and compared across machines.
+//--------------------------------------------------
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "flattener.hpp"
+#include "jpeg_codec.hpp"
+#include "lens_model.hpp"
+#include "remap_engine.hpp"
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+
+struct BenchResult
+{
+	std::string name;
+	std::string profile;    // empty: independent of the lens
+	int iterations;
+	double pixels;          // per run
+	double medianMs;
+	double minMs;
+};
+
+//--------------------------------------------------
+
+template <typename Body>
+static BenchResult runBench(const std::string& name, const std::string& profile, int iterations, double pixels, Body body)
+{
+	body();
+
+	std::vector<double> ms;
+	for ( int i = 0; i < iterations; i++ )
+	{
+		const int64 start = cv::getTickCount();
+		body();
+		ms.push_back((cv::getTickCount() - start) * 1000. / cv::getTickFrequency());
+	}
+	std::sort(ms.begin(), ms.end());
+
+	BenchResult r;
+	r.name = name;
+	r.profile = profile;
+	r.iterations = iterations;
+	r.pixels = pixels;
+	r.medianMs = ms[ms.size() / 2];
+	r.minMs = ms.front();
+	fprintf(stderr, "%-28s %-8s %9.3f ms  %7.3f ns/pixel\n",
+		name.c_str(), profile.c_str(), r.medianMs, r.medianMs * 1e6 / pixels);
+	return r;
+}
+
+//--------------------------------------------------
+// A frame that compresses roughly like a photograph: smooth gradients, hard edges and a little noise.
+// Pure noise would make the codecs look far slower than they are on real footage.
+//--------------------------------------------------
+
+static cv::Mat makeSyntheticFrame(const cv::Size& size)
+{
+	cv::Mat frame(size, CV_8UC3);
+	for ( int y = 0; y < size.height; y++ )
+	{
+		uchar * p = frame.ptr(y);
+		for ( int x = 0; x < size.width; x++ )
+		{
+			p[x*3]     = (uchar) (x * 255 / size.width);
+			p[x*3 + 1] = (uchar) (y * 255 / size.height);
+			p[x*3 + 2] = (uchar) (((x / 64) ^ (y / 64)) & 1 ? 200 : 40);
+		}
+	}
+	for ( int i = 0; i < 40; i++ )
+	{
+		cv::circle(frame, cv::Point(size.width * (i % 8) / 8 + 100, size.height * (i / 8) / 5 + 100),
+			30 + 5 * i, cv::Scalar(255 - 6 * i, 6 * i, 128), 3, cv::LINE_AA);
+	}
+	cv::Mat noise(size, CV_8UC3);
+	cv::randn(noise, cv::Scalar::all(0), cv::Scalar::all(4));
+	cv::add(frame, noise, frame);
+	return frame;
+}
+
+//--------------------------------------------------
+
+static void benchProfile(const std::string& profileName, const LensProfile& profile, int iterations, std::vector<BenchResult>& results)
+{
+	const cv::Mat frame = makeSyntheticFrame(profile.originalSize);
+	const double outPixels = (double) profile.finalSize.area();
+
+	cv::Mat map1;
+	cv::Mat map2;
+	results.push_back(runBench("map_generation/opencv", profileName, iterations, outPixels, [&]()
+	{
+		buildRemapMaps(profile, map1, map2);
+	}));
+
+	LensModel model;
+	const bool hasModel = makeLensModel(profile, model);
+	if ( hasModel )
+	{
+		cv::Mat gen1;
+		cv::Mat gen2;
+		std::string variant;
+		lens_model_row_func(variant);
+		results.push_back(runBench("map_generation/builtin-" + variant, profileName, iterations, outPixels, [&]()
+		{
+			generateRemapMaps(model, profile.finalSize, gen1, gen2);
+		}));
+	}
+
+	static const struct { const char * name; int flag; } interpolations[] =
+	{
+		{ "remap/nearest",  cv::INTER_NEAREST  },
+		{ "remap/linear",   cv::INTER_LINEAR   },
+		{ "remap/cubic",    cv::INTER_CUBIC    },
+		{ "remap/lanczos4", cv::INTER_LANCZOS4 },
+	};
+	cv::Mat out;
+	for ( size_t i = 0; i < sizeof(interpolations) / sizeof(interpolations[0]); i++ )
+	{
+		results.push_back(runBench(interpolations[i].name, profileName, iterations, outPixels, [&]()
+		{
+			cv::remap(frame, out, map1, map2, interpolations[i].flag);
+		}));
+	}
+
+	// The built-in bicubic engine, on the same maps and on maps computed while remapping.
+	Remapper remapper;
+	remapper.init(map1, map2, "simd");
+	results.push_back(runBench("remap/cubic-" + remapper.name(), profileName, iterations, outPixels, [&]()
+	{
+		remapper.remap(frame, out);
+	}));
+
+	// The same remap of 16-bit and float frames, by cv::remap() and by the depth-specialised kernels.
+	static const struct { const char * suffix; int depth; double scale; } depths[] =
+	{
+		{ "16u", CV_16U, 257.      },
+		{ "32f", CV_32F, 1. / 255. },
+	};
+	for ( size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++ )
+	{
+		cv::Mat deep;
+		frame.convertTo(deep, depths[i].depth, depths[i].scale);
+		results.push_back(runBench(std::string("remap/cubic-") + depths[i].suffix, profileName, iterations, outPixels, [&]()
+		{
+			cv::remap(deep, out, map1, map2, cv::INTER_CUBIC);
+		}));
+		results.push_back(runBench("remap/cubic-" + remapper.name() + "-" + depths[i].suffix, profileName, iterations, outPixels, [&]()
+		{
+			remapper.remap(deep, out);
+		}));
+	}
+
+	if ( hasModel )
+	{
+		Remapper analytic;
+		analytic.initAnalytic(model, profile.finalSize, "simd");
+		results.push_back(runBench("remap/cubic-analytic", profileName, iterations, outPixels, [&]()
+		{
+			analytic.remap(frame, out);
+		}));
+	}
+
+	// A 4:2:0 frame flattened plane by plane, against the round trip through BGR it replaces.
+	FlattenerOptions options;
+	options.profile = profile;
+	options.remapEngine = "simd";
+	Flattener flattener;
+	std::string problem;
+	if ( flattener.init(options, problem) )
+	{
+		cv::Mat i420;
+		cv::Mat i420Out;
+		cv::Mat bgr;
+		cv::cvtColor(frame, i420, cv::COLOR_BGR2YUV_I420);
+		results.push_back(runBench("remap/i420-planar", profileName, iterations, outPixels, [&]()
+		{
+			flattener.processI420(i420, i420Out);
+		}));
+		results.push_back(runBench("remap/i420-via-bgr", profileName, iterations, outPixels, [&]()
+		{
+			cv::cvtColor(i420, bgr, cv::COLOR_YUV2BGR_I420);
+			flattener.process(bgr, out);
+			cv::cvtColor(out, i420Out, cv::COLOR_BGR2YUV_I420);
+		}));
+	}
+
+	// The crop of the centred region out of the full intermediate image, as done before the maps were
+	// cut down to the region of interest.
+	const cv::Mat intermediate = makeSyntheticFrame(profile.intermedSize);
+	const cv::Rect roi = profile.roi();
+	cv::Mat cropped;
+	results.push_back(runBench("crop_copy", profileName, iterations, outPixels, [&]()
+	{
+		intermediate(roi).copyTo(cropped);
+	}));
+}
+
+//--------------------------------------------------
+// The TurboJPEG fast path on the 4:2:0 JPEG of benchCodecs(), to BGR and to I420 planes.
+//--------------------------------------------------
+
+static void benchTurboJpeg(const std::vector<uchar>& jpeg, double pixels, int iterations, std::vector<BenchResult>& results)
+{
+	JpegCodec codec(95, JPEG_420);
+	static const struct { const char * suffix; bool i420; } layouts[] =
+	{
+		{ "",      false },
+		{ "-i420", true  },
+	};
+	for ( size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++ )
+	{
+		cv::Mat frame;
+		bool i420 = false;
+		std::string problem;
+		if ( !codec.decode(&jpeg[0], jpeg.size(), layouts[i].i420, frame, i420, problem) )
+		{
+			fprintf(stderr, "TurboJPEG could not decode the frame (%s); skipping it.\n", problem.c_str());
+			return;
+		}
+		results.push_back(runBench(std::string("decode/jpg-turbo") + layouts[i].suffix, "", iterations, pixels, [&]()
+		{
+			codec.decode(&jpeg[0], jpeg.size(), layouts[i].i420, frame, i420, problem);
+		}));
+		const uchar * data = NULL;
+		size_t size = 0;
+		results.push_back(runBench(std::string("encode/jpg-turbo") + layouts[i].suffix, "", iterations, pixels, [&]()
+		{
+			codec.encode(frame, i420, data, size, problem);
+		}));
+	}
+}
+
+//--------------------------------------------------
+
+static void benchCodecs(const cv::Size& size, int iterations, std::vector<BenchResult>& results)
+{
+	const cv::Mat frame = makeSyntheticFrame(size);
+	const double pixels = (double) size.area();
+
+	static const char * extensions[] = { ".jpg", ".png" };
+	for ( size_t i = 0; i < 2; i++ )
+	{
+		const std::string ext = extensions[i];
+		const std::string codec = ext.substr(1);
+		std::vector<uchar> encoded;
+		results.push_back(runBench("encode/" + codec, "", iterations, pixels, [&]()
+		{
+			cv::imencode(ext, frame, encoded);
+		}));
+		cv::Mat decoded;
+		results.push_back(runBench("decode/" + codec, "", iterations, pixels, [&]()
+		{
+			decoded = cv::imdecode(encoded, cv::IMREAD_COLOR);
+		}));
+		if ( ext == ".jpg" && JpegCodec::available() )
+		{
+			benchTurboJpeg(encoded, pixels, iterations, results);
+		}
+	}
+
+	char sbuf_path[64];
+	snprintf(sbuf_path, sizeof(sbuf_path), "/tmp/flatten_bench-%ld.avi", (long) getpid());
+	cv::VideoWriter writer(sbuf_path, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 30, size, true);
+	if ( writer.isOpened() )
+	{
+		results.push_back(runBench("video_writer/mjpg", "", iterations, pixels, [&]()
+		{
+			writer.write(frame);
+		}));
+		writer.release();
+	}
+	else
+	{
+		fprintf(stderr, "Could not open a VideoWriter for '%s'; skipping video_writer.\n", sbuf_path);
+	}
+	unlink(sbuf_path);
+}
+
+//--------------------------------------------------
+
+static void writeJson(FILE * f, const cv::Size& frameSize, int iterations, const std::vector<BenchResult>& results)
+{
+	fprintf(f, "{\n");
+	fprintf(f, "  \"frame_width\": %d,\n", frameSize.width);
+	fprintf(f, "  \"frame_height\": %d,\n", frameSize.height);
+	fprintf(f, "  \"iterations\": %d,\n", iterations);
+	fprintf(f, "  \"threads\": %d,\n", cv::getNumThreads());
+	fprintf(f, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+	fprintf(f, "  \"results\": [\n");
+	for ( size_t i = 0; i < results.size(); i++ )
+	{
+		const BenchResult& r = results[i];
+		fprintf(f, "    { \"name\": \"%s\", \"profile\": \"%s\", \"pixels\": %.0f, "
+			"\"median_ms\": %.4f, \"min_ms\": %.4f, \"ns_per_pixel\": %.4f, \"fps\": %.3f }%s\n",
+			r.name.c_str(), r.profile.c_str(), r.pixels,
+			r.medianMs, r.minMs, r.medianMs * 1e6 / r.pixels, 1000. / r.medianMs,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+}
+
+//--------------------------------------------------
+
+int main (int argc, char** argv)
+{
+	const cv::String keys
+		= "{help h usage ? |                             | print this message                     }"
+		  "{iterations n   | 10                          | timed runs per benchmark               }"
+		  "{output o       |                             | JSON output file (default: stdout)     }"
+		  "{pinhole        | flatten-settings.xml        | settings file of the pinhole profile   }"
+		  "{fisheye        | flatten-settings-fisheye.xml| settings file of the fisheye profile   }";
+
+	cv::CommandLineParser parser(argc, argv, keys);
+	parser.about("Micro-benchmarks for the flatten hot paths.");
+	if ( parser.has("help") )
+	{
+		parser.printMessage();
+		return 0;
+	}
+	const int iterations = std::max(1, parser.get<int>("iterations"));
+	const std::string outputPath = parser.get<std::string>("output");
+	if ( !parser.check() )
+	{
+		parser.printErrors();
+		return -1;
+	}
+
+	const std::string profileNames[2] = { "pinhole", "fisheye" };
+	std::vector<BenchResult> results;
+	cv::Size frameSize;
+	for ( int i = 0; i < 2; i++ )
+	{
+		const std::string path = parser.get<std::string>(profileNames[i]);
+		FlattenerOptions options;
+		const LensProfile& profile = options.profile;
+		if ( !readFlattenerOptions(path, options) || profile.originalSize.area() <= 0 ||
+			profile.finalSize.area() <= 0 || profile.cameraMatrix.empty() )
+		{
+			fprintf(stderr, "Could not read the lens profile '%s'.\n", path.c_str());
+			return -1;
+		}
+		frameSize = profile.originalSize;
+		benchProfile(profileNames[i], profile, iterations, results);
+	}
+	benchCodecs(frameSize, iterations, results);
+
+	FILE * f = outputPath.empty() ? stdout : fopen(outputPath.c_str(), "w");
+	if ( f == NULL )
+	{
+		fprintf(stderr, "Could not write '%s'.\n", outputPath.c_str());
+		return -1;
+	}
+	writeJson(f, frameSize, iterations, results);
+	if ( f != stdout )
+	{
+		fclose(f);
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,130 @@
+#include <stdio.h>
+
+#include <exception>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "flatten_c.h"
+#include "flattener.hpp"
+
+//--------------------------------------------------
+
+struct flattener
+{
+	Flattener impl;
+};
+
+//--------------------------------------------------
+
+static void set_error(char * error, size_t error_size, const std::string& message)
+{
+	if ( error != NULL && error_size > 0 )
+	{
+		snprintf(error, error_size, "%s", message.c_str());
+	}
+}
+
+//--------------------------------------------------
+
+flattener * flattener_create(const char * settings_path, char * error, size_t error_size)
+{
+	// No exception may cross the C interface.
+	set_error(error, error_size, "");
+	flattener * f = NULL;
+	try
+	{
+		FlattenerOptions options;
+		if ( settings_path == NULL || !readFlattenerOptions(settings_path, options) )
+		{
+			set_error(error, error_size, "could not open the settings file");
+			return NULL;
+		}
+		f = new flattener;
+		std::string problem;
+		if ( f->impl.init(options, problem) )
+		{
+			return f;
+		}
+		set_error(error, error_size, problem);
+	}
+	catch (const std::exception& ex)
+	{
+		set_error(error, error_size, ex.what());
+	}
+	catch (...)
+	{
+		set_error(error, error_size, "unknown exception");
+	}
+	delete f;
+	return NULL;
+}
+
+//--------------------------------------------------
+
+void flattener_destroy(flattener * f)
+{
+	delete f;
+}
+
+//--------------------------------------------------
+
+int flattener_input_size(const flattener * f, int * width, int * height)
+{
+	if ( f == NULL || width == NULL || height == NULL )
+	{
+		return -1;
+	}
+	const cv::Size& size = f->impl.options().profile.originalSize;
+	*width = size.width;
+	*height = size.height;
+	return 0;
+}
+
+//--------------------------------------------------
+
+int flattener_output_size(const flattener * f, int * width, int * height)
+{
+	if ( f == NULL || width == NULL || height == NULL )
+	{
+		return -1;
+	}
+	const cv::Size& size = f->impl.outputSize();
+	*width = size.width;
+	*height = size.height;
+	return 0;
+}
+
+//--------------------------------------------------
+
+int flattener_process_bgr24(const flattener * f,
+	const unsigned char * src, int src_width, int src_height, size_t src_stride,
+	unsigned char * dst, size_t dst_stride)
+{
+	if ( f == NULL )
+	{
+		return -1;
+	}
+	const cv::Size& inputSize = f->impl.options().profile.originalSize;
+	const cv::Size& outputSize = f->impl.outputSize();
+	if ( src == NULL || dst == NULL || src_width != inputSize.width || src_height != inputSize.height ||
+		src_stride < (size_t) src_width * 3 || dst_stride < (size_t) outputSize.width * 3 )
+	{
+		return -1;
+	}
+	// Headers over the caller's memory; process_into() writes through them without allocating.
+	const cv::Mat in(src_height, src_width, CV_8UC3, (void *) src, src_stride);
+	cv::Mat out(outputSize, CV_8UC3, dst, dst_stride);
+	try
+	{
+		return f->impl.process_into(in, out) ? 0 : -1;
+	}
+	catch (...)
+	{
+		return -1;
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,45 @@
+#ifndef FLATTEN_C_H
+#define FLATTEN_C_H
+
+#include <stddef.h>
+
+/*--------------------------------------------------
+ * C interface of libflatten, for callers that cannot use the C++ Flattener class (flattener.hpp)
+ * directly. A flattener is created once per lens profile from a flatten settings file and can then
+ * flatten frames from several threads at once.
+ *--------------------------------------------------*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct flattener flattener;
+
+/* Returns NULL on failure; if error is not NULL, the reason is written there (at most error_size bytes,
+   including the terminating zero). */
+flattener * flattener_create(const char * settings_path, char * error, size_t error_size);
+
+void flattener_destroy(flattener * f);
+
+/* Frame sizes of the lens profile, in pixels. Return 0, or -1 without writing anything if f, width or
+   height is NULL. */
+int flattener_input_size(const flattener * f, int * width, int * height);
+int flattener_output_size(const flattener * f, int * width, int * height);
+
+/* Flattens one 8-bit BGR frame of the input size into dst, which must hold a frame of the output size.
+   Rows are src_stride and dst_stride bytes apart. Nothing is allocated per call and dst is written
+   directly. Returns 0 on success, -1 if f, src or dst is NULL, a size does not match or the remap
+   failed. */
+int flattener_process_bgr24(const flattener * f,
+	const unsigned char * src, int src_width, int src_height, size_t src_stride,
+	unsigned char * dst, size_t dst_stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLATTEN_C_H */
+
+/*--------------------------------------------------
+ * end of this file
+ *--------------------------------------------------*/
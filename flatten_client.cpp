@@ -0,0 +1,185 @@
+//--------------------------------------------------
+// Sends one job to a "flatten --serve" daemon and prints its reply; see the description of the protocol
+// above serve() in flatten.cpp. The exit status is 0 if the job succeeded.
+//
+//   flatten_client --socket=/tmp/flatten.sock --settings=flatten-settings.xml --input=a.JPG --output=a-b.JPG
+//
+// With --inline, the settings file is read here and its content sent along with the request, so the
+// server does not need access to it. Relative paths are made absolute here, as the server requires.
+//--------------------------------------------------
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+
+//--------------------------------------------------
+
+static bool sendFully(int fd, const std::string& text)
+{
+	size_t done = 0;
+	while ( done < text.size() )
+	{
+		const ssize_t n = send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			return false;
+		}
+		done += (size_t) n;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+// The absolute path of an existing file, or of a file to be created in an existing directory.
+//--------------------------------------------------
+
+static bool absolutePath(const std::string& path, bool mustExist, std::string& absolute)
+{
+	char resolved[PATH_MAX];
+	if ( mustExist )
+	{
+		if ( realpath(path.c_str(), resolved) == NULL )
+		{
+			return false;
+		}
+		absolute = resolved;
+		return true;
+	}
+	if ( !path.empty() && path[0] == '/' )
+	{
+		absolute = path;
+		return true;
+	}
+	if ( getcwd(resolved, sizeof(resolved)) == NULL )
+	{
+		return false;
+	}
+	absolute = std::string(resolved) + "/" + path;
+	return true;
+}
+
+//--------------------------------------------------
+
+int main (int argc, char** argv)
+{
+	const cv::String keys
+		= "{help h usage ? |                 | print this message                          }"
+		  "{socket         | /tmp/flatten.sock | socket of the flatten --serve daemon      }"
+		  "{settings       |                 | settings file with the lens profile         }"
+		  "{inline         |                 | send the content of the settings file       }"
+		  "{input          |                 | image or video to flatten                   }"
+		  "{output         |                 | where to write the result                   }";
+
+	cv::CommandLineParser parser(argc, argv, keys);
+	parser.about("Sends a job to a flatten --serve daemon.");
+	if ( parser.has("help") )
+	{
+		parser.printMessage();
+		return 0;
+	}
+	const std::string socketPath = parser.get<std::string>("socket");
+	std::string settingsPath = parser.get<std::string>("settings");
+	std::string input = parser.get<std::string>("input");
+	std::string output = parser.get<std::string>("output");
+	if ( !parser.check() || settingsPath.empty() || input.empty() || output.empty() )
+	{
+		parser.printErrors();
+		parser.printMessage();
+		return 2;
+	}
+	if ( !absolutePath(settingsPath, true, settingsPath) )
+	{
+		fprintf(stderr, "Could not find '%s': %s\n", settingsPath.c_str(), strerror(errno));
+		return 2;
+	}
+	if ( !absolutePath(input, true, input) )
+	{
+		fprintf(stderr, "Could not find '%s': %s\n", input.c_str(), strerror(errno));
+		return 2;
+	}
+	if ( !absolutePath(output, false, output) )
+	{
+		fprintf(stderr, "Could not resolve '%s': %s\n", output.c_str(), strerror(errno));
+		return 2;
+	}
+
+	std::string request;
+	if ( parser.has("inline") )
+	{
+		std::ifstream file(settingsPath.c_str(), std::ios::binary);
+		if ( !file )
+		{
+			fprintf(stderr, "Could not read '%s'.\n", settingsPath.c_str());
+			return 2;
+		}
+		std::ostringstream content;
+		content << file.rdbuf();
+		request = "profile " + std::to_string(content.str().size()) + "\n"
+			+ "input " + input + "\n"
+			+ "output " + output + "\n\n"
+			+ content.str();
+	}
+	else
+	{
+		request = "settings " + settingsPath + "\n"
+			+ "input " + input + "\n"
+			+ "output " + output + "\n\n";
+	}
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if ( socketPath.size() >= sizeof(address.sun_path) )
+	{
+		fprintf(stderr, "Socket path too long: %s\n", socketPath.c_str());
+		return 2;
+	}
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if ( fd < 0 || connect(fd, (const sockaddr *) &address, sizeof(address)) != 0 )
+	{
+		fprintf(stderr, "Could not connect to '%s': %s\n", socketPath.c_str(), strerror(errno));
+		return 2;
+	}
+	if ( !sendFully(fd, request) )
+	{
+		fprintf(stderr, "Could not send the request: %s\n", strerror(errno));
+		close(fd);
+		return 2;
+	}
+
+	std::string reply;
+	char sbuf_chunk[1024];
+	ssize_t n;
+	while ( (n = recv(fd, sbuf_chunk, sizeof(sbuf_chunk), 0)) > 0 || (n < 0 && errno == EINTR) )
+	{
+		if ( n > 0 )
+		{
+			reply.append(sbuf_chunk, (size_t) n);
+		}
+	}
+	close(fd);
+
+	printf("%s", reply.c_str());
+	return reply.compare(0, 3, "OK ") == 0 ? 0 : 1;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "flattener.hpp"
+
+//--------------------------------------------------
+
+// Video range black, the value of the planes outside the source frame; full range black has luma 0
+#define CONST_INT__I420_BORDER_LUMA     16
+#define CONST_INT__I420_BORDER_CHROMA   128
+
+//--------------------------------------------------
+
+FlattenerOptions::FlattenerOptions()
+	: mapMode("dense"), meshStep(16), mapGenerator("opencv"), remapEngine("opencv"), remapScheduler("rows"),
+	  tileSize(128, 32), tileThreads(0)
+{
+	profile.useFisheye = false;
+}
+
+//--------------------------------------------------
+
+template <typename T>
+static void readIfPresent(const cv::FileNode& node, const char * key, T& value)
+{
+	if ( !node[key].empty() )
+	{
+		node[key] >> value;
+	}
+}
+
+//--------------------------------------------------
+
+bool readFlattenerOptions(const std::string& path, FlattenerOptions& options)
+{
+	cv::FileStorage fs(path, cv::FileStorage::READ);
+	if ( !fs.isOpened() )
+	{
+		return false;
+	}
+	readFlattenerOptions(fs["Settings"], options);
+	return true;
+}
+
+//--------------------------------------------------
+
+void readFlattenerOptions(const cv::FileNode& node, FlattenerOptions& options)
+{
+	LensProfile& profile = options.profile;
+	readIfPresent(node, "original_image_width", profile.originalSize.width);
+	readIfPresent(node, "original_image_height", profile.originalSize.height);
+	readIfPresent(node, "intermediate_image_width", profile.intermedSize.width);
+	readIfPresent(node, "intermediate_image_height", profile.intermedSize.height);
+	readIfPresent(node, "final_image_width", profile.finalSize.width);
+	readIfPresent(node, "final_image_height", profile.finalSize.height);
+	readIfPresent(node, "use_fisheye_model", profile.useFisheye);
+	readIfPresent(node, "camera_matrix", profile.cameraMatrix);
+	readIfPresent(node, "distortion_coefficients", profile.distortionCoefficients);
+
+	readIfPresent(node, "map_mode", options.mapMode);
+	readIfPresent(node, "mesh_step", options.meshStep);
+	readIfPresent(node, "map_generator", options.mapGenerator);
+	readIfPresent(node, "map_cache_directory", options.mapCacheDirectory);
+	readIfPresent(node, "remap_engine", options.remapEngine);
+	readIfPresent(node, "remap_scheduler", options.remapScheduler);
+	readIfPresent(node, "tile_width", options.tileSize.width);
+	readIfPresent(node, "tile_height", options.tileSize.height);
+	readIfPresent(node, "tile_threads", options.tileThreads);
+}
+
+//--------------------------------------------------
+
+Flattener::Flattener()
+	: initialized(false), setupTime(0)
+{
+}
+
+//--------------------------------------------------
+
+void applyFlattenerDefaults(FlattenerOptions& options)
+{
+	const FlattenerOptions defaults;
+	if ( options.mapMode.empty() )
+	{
+		options.mapMode = defaults.mapMode;
+	}
+	if ( options.meshStep <= 0 )
+	{
+		options.meshStep = defaults.meshStep;
+	}
+	if ( options.mapGenerator.empty() )
+	{
+		options.mapGenerator = defaults.mapGenerator;
+	}
+	if ( options.remapEngine.empty() )
+	{
+		options.remapEngine = defaults.remapEngine;
+	}
+	if ( options.remapScheduler.empty() )
+	{
+		options.remapScheduler = defaults.remapScheduler;
+	}
+}
+
+//--------------------------------------------------
+
+bool Flattener::init(const FlattenerOptions& options, std::string& problem)
+{
+	initialized = false;
+	problem.clear();
+	opts = options;
+
+	applyFlattenerDefaults(opts);
+
+	const LensProfile& profile = opts.profile;
+	if ( profile.originalSize.area() <= 0 || profile.finalSize.area() <= 0 || profile.cameraMatrix.empty() )
+	{
+		problem = "the lens profile is incomplete";
+	}
+	else if ( opts.mapMode != "dense" && opts.mapMode != "mesh" && opts.mapMode != "analytic" )
+	{
+		problem = "invalid map mode: " + opts.mapMode;
+	}
+	else if ( opts.mapGenerator != "opencv" && opts.mapGenerator != "builtin" )
+	{
+		problem = "invalid map generator: " + opts.mapGenerator;
+	}
+	else if ( !Remapper::isValidEngine(opts.remapEngine) )
+	{
+		problem = "invalid remap engine: " + opts.remapEngine;
+	}
+	else if ( opts.remapScheduler != "rows" && opts.remapScheduler != "tiled" )
+	{
+		problem = "invalid remap scheduler: " + opts.remapScheduler;
+	}
+	else if ( opts.remapScheduler == "tiled" && (opts.tileSize.width <= 0 || opts.tileSize.height <= 0) )
+	{
+		problem = "invalid tile size";
+	}
+	else if ( opts.mapMode == "analytic" && !makeLensModel(profile, lens) )
+	{
+		problem = "map_mode \"analytic\" does not support these distortion coefficients";
+	}
+	if ( !problem.empty() )
+	{
+		return false;
+	}
+
+	const int64 start = cv::getTickCount();
+	{
+		std::lock_guard<std::mutex> lock(planarMutex);
+		for ( int i = 0; i < NUM_CHROMA_SITINGS; i++ )
+		{
+			planar[i].reset();
+		}
+	}
+	mapCache.close();
+	map1.release();
+	map2.release();
+	mesh.release();
+	remap = Remapper();
+
+	if ( opts.mapMode == "mesh" )
+	{
+		buildRemapMesh(profile, opts.meshStep, mesh);
+		remap.initMesh(mesh, opts.meshStep, profile.finalSize, opts.remapEngine);
+		origin = cv::format("a mesh with step %d, %d x %d grid points", opts.meshStep, mesh.cols, mesh.rows);
+	}
+	else if ( opts.mapMode == "analytic" )
+	{
+		remap.initAnalytic(lens, profile.finalSize, opts.remapEngine);
+		origin = "the lens model, evaluated by '" + remap.lensModelName() + "' while remapping";
+	}
+	else
+	{
+		if ( opts.mapCacheDirectory.empty() )
+		{
+			buildMaps();
+		}
+		else
+		{
+			const std::string key = MapCache::makeKey(
+				profile.cameraMatrix, profile.distortionCoefficients, profile.useFisheye,
+				profile.originalSize, profile.intermedSize, profile.finalSize);
+			const std::string path = MapCache::makePath(opts.mapCacheDirectory, key);
+			if ( mapCache.open(path, key) )
+			{
+				map1 = mapCache.map1;
+				map2 = mapCache.map2;
+				origin = "the cache '" + path + "'";
+			}
+			else
+			{
+				buildMaps();
+				origin += MapCache::store(path, key, map1, map2)
+					? ", stored in '" + path + "'"
+					: ", could not store in '" + path + "'";
+			}
+		}
+		remap.init(map1, map2, opts.remapEngine);
+	}
+
+	if ( opts.remapScheduler == "tiled" )
+	{
+		const int tileThreads = opts.tileThreads > 0 ? opts.tileThreads : std::max(1, (int) std::thread::hardware_concurrency());
+		remap.useTiles(opts.tileSize, tileThreads, profile.originalSize);
+	}
+
+	setupTime = (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+	initialized = true;
+	return true;
+}
+
+//--------------------------------------------------
+// Dense maps with the configured generator. The built-in one falls back to OpenCV for coefficient
+// layouts it does not support.
+//--------------------------------------------------
+
+void Flattener::buildMaps()
+{
+	origin = "the opencv generator";
+	if ( opts.mapGenerator == "builtin" )
+	{
+		LensModel model;
+		if ( makeLensModel(opts.profile, model) )
+		{
+			std::string variant;
+			lens_model_row_func(variant);
+			generateRemapMaps(model, opts.profile.finalSize, map1, map2);
+			origin = "the builtin-" + variant + " generator";
+			return;
+		}
+		origin = "the opencv generator (the built-in one does not support these distortion coefficients)";
+	}
+	buildRemapMaps(opts.profile, map1, map2);
+}
+
+//--------------------------------------------------
+
+void Flattener::process(const cv::Mat& in, cv::Mat& out) const
+{
+	CV_Assert(initialized);
+	remap.remap(in, out);
+}
+
+//--------------------------------------------------
+
+bool Flattener::process_into(const cv::Mat& in, cv::Mat& out) const
+{
+	CV_Assert(initialized);
+	if ( out.size() != outputSize() || out.type() != in.type() || out.data == in.data )
+	{
+		return false;
+	}
+	// The remapper only allocates a destination that does not fit already.
+	remap.remap(in, out);
+	return true;
+}
+
+//--------------------------------------------------
+// The luma remappers share the maps (or mesh, or lens model) and the tiles of the BGR one and only differ
+// in the border value. The chroma maps are derived from the full luma maps once, materialised first if
+// the map mode keeps none, for each chroma siting in use; at a quarter of the pixels, they are plain dense
+// maps.
+//--------------------------------------------------
+
+std::shared_ptr<const Flattener::PlanarRemappers> Flattener::planarRemappers(ChromaSiting siting) const
+{
+	std::lock_guard<std::mutex> lock(planarMutex);
+	if ( !planar[siting] )
+	{
+		std::shared_ptr<PlanarRemappers> p(new PlanarRemappers);
+		p->luma = remap;
+		p->luma.setBorderValue(cv::Scalar::all(CONST_INT__I420_BORDER_LUMA));
+		p->lumaFullRange = remap;
+		cv::Mat lumaMap1;
+		cv::Mat lumaMap2;
+		remap.mapBlock(cv::Rect(0, 0, outputSize().width, outputSize().height), lumaMap1, lumaMap2);
+		deriveChromaMaps(lumaMap1, lumaMap2, siting, p->chromaMap1, p->chromaMap2);
+		p->chroma.init(p->chromaMap1, p->chromaMap2, opts.remapEngine);
+		p->chroma.setBorderValue(cv::Scalar::all(CONST_INT__I420_BORDER_CHROMA));
+		planar[siting] = p;
+	}
+	return planar[siting];
+}
+
+//--------------------------------------------------
+
+bool Flattener::processI420(const cv::Mat& in, cv::Mat& out, bool fullRange, ChromaSiting siting,
+	PerfAccumulator * perf) const
+{
+	CV_Assert(initialized);
+	const cv::Size inSize = opts.profile.originalSize;
+	const cv::Size outSize = outputSize();
+	if ( (inSize.width | inSize.height | outSize.width | outSize.height) & 1 ||
+		in.type() != CV_8UC1 || !in.isContinuous() || in.cols != inSize.width || in.rows != inSize.height * 3 / 2 )
+	{
+		return false;
+	}
+	const std::shared_ptr<const PlanarRemappers> p = planarRemappers(siting);
+	out.create(outSize.height * 3 / 2, outSize.width, CV_8UC1);
+
+	// Headers over the three planes of each frame; the remappers write through them in place.
+	const cv::Size inChroma(inSize.width / 2, inSize.height / 2);
+	const cv::Size outChroma(outSize.width / 2, outSize.height / 2);
+	const cv::Mat inY(inSize, CV_8UC1, in.data);
+	cv::Mat outY(outSize, CV_8UC1, out.data);
+	std::vector<cv::Mat> inUV(2);
+	std::vector<cv::Mat> outUV(2);
+	for ( int k = 0; k < 2; k++ )
+	{
+		inUV[k] = cv::Mat(inChroma, CV_8UC1, in.data + inSize.area() + k * inChroma.area());
+		outUV[k] = cv::Mat(outChroma, CV_8UC1, out.data + outSize.area() + k * outChroma.area());
+	}
+	(fullRange ? p->lumaFullRange : p->luma).remap(inY, outY, perf);
+	// U and V share every pass over the chroma maps.
+	p->chroma.remapBatch(inUV, outUV, perf);
+	return true;
+}
+
+//--------------------------------------------------
+
+void Flattener::processBatch(const std::vector<cv::Mat>& ins, std::vector<cv::Mat>& outs, PerfAccumulator * perf) const
+{
+	CV_Assert(initialized);
+	remap.remapBatch(ins, outs, perf);
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
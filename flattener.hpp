@@ -0,0 +1,148 @@
+#ifndef FLATTEN_FLATTENER_HPP
+#define FLATTEN_FLATTENER_HPP
+
+#include <stddef.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "lens_model.hpp"
+#include "map_cache.hpp"
+#include "perf_counters.hpp"
+#include "remap_engine.hpp"
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+// The flattening of one lens profile as a reusable object, the core of libflatten.
+//
+// init() does everything that depends on the lens only: it builds or loads the maps (or the mesh, or
+// the lens model) and sets up the remap engine. After that, process() flattens any number of frames,
+// from any number of threads at once, without further setup. A service can keep one Flattener per
+// lens profile and call it per frame; the flatten program is a command line wrapper around it.
+//
+// A C interface for other languages is in flatten_c.h.
+//--------------------------------------------------
+
+struct FlattenerOptions
+{
+	FlattenerOptions();
+
+	LensProfile profile;
+
+	// Same meaning and defaults as the settings of the same name in flatten-settings.xml.
+	std::string mapMode;           // "dense", "mesh" or "analytic"
+	int meshStep;
+	std::string mapGenerator;      // "opencv" or "builtin"
+	std::string mapCacheDirectory; // dense maps only; empty: no cache
+	std::string remapEngine;       // see remap_engine.hpp
+	std::string remapScheduler;    // "rows" or "tiled"
+	cv::Size tileSize;
+	int tileThreads;               // zero: one per CPU
+};
+
+// Reads the options from the "Settings" node of a flatten settings file; keys that are missing keep
+// their defaults. Returns false if the file cannot be opened.
+bool readFlattenerOptions(const std::string& path, FlattenerOptions& options);
+
+// Same, from a "Settings" node that is already parsed, for example from a settings document in memory.
+void readFlattenerOptions(const cv::FileNode& node, FlattenerOptions& options);
+
+// Replaces empty strings and non-positive numbers by the defaults, as Flattener::init() does.
+void applyFlattenerDefaults(FlattenerOptions& options);
+
+//--------------------------------------------------
+
+class Flattener
+{
+public:
+	Flattener();
+
+	//--------------------------------------------------
+
+	// Returns false, with the reason in problem, if the options are not valid. Empty strings and
+	// non-positive numbers in the options select the defaults.
+	bool init(const FlattenerOptions& options, std::string& problem);
+
+	bool isInitialized() const { return initialized; }
+
+	const FlattenerOptions& options() const { return opts; }
+
+	// Size of the flattened frames.
+	const cv::Size& outputSize() const { return opts.profile.finalSize; }
+
+	// out gets the output size and the type of in; it is reallocated only if it has neither.
+	void process(const cv::Mat& in, cv::Mat& out) const;
+
+	// Writes into out, which the caller owns and must have allocated with the output size and the type
+	// of in; it may be a header over foreign memory. Never allocates out. Returns false, leaving out
+	// untouched, if its size or type does not match.
+	bool process_into(const cv::Mat& in, cv::Mat& out) const;
+
+	// Flattens a 4:2:0 frame in I420 layout (CV_8UC1 of height * 3 / 2 rows: the Y plane, then the U and
+	// V planes) without converting it to BGR. The Y plane is remapped with the maps, the chroma planes with
+	// half-size maps derived from them for the chroma siting of the frame (set up on the first call with
+	// that siting). Outside the source frame, the planes take the values of video range black, or of full
+	// range black with fullRange (JPEG). out gets the I420 layout of the output size. Returns false if in
+	// does not have the I420 layout of the input size or a size is odd. If perf is not NULL, the hardware
+	// events of every thread working on the frame are added to it.
+	bool processI420(const cv::Mat& in, cv::Mat& out, bool fullRange = false,
+		ChromaSiting siting = CHROMA_SITING_CENTER, PerfAccumulator * perf = NULL) const;
+
+	// Several frames in one pass over the maps; see Remapper::remapBatch().
+	void processBatch(const std::vector<cv::Mat>& ins, std::vector<cv::Mat>& outs, PerfAccumulator * perf = NULL) const;
+
+	// Where the maps came from, for example "the builtin-avx2 generator" or "the cache '/var/cache/x.map'".
+	const std::string& mapOrigin() const { return origin; }
+
+	// Time init() spent on the maps and the remap engine.
+	double setupMs() const { return setupTime; }
+
+	const Remapper& remapper() const { return remap; }
+
+	//--------------------------------------------------
+
+private:
+	Flattener(const Flattener&);
+	Flattener& operator=(const Flattener&);
+
+	void buildMaps();
+
+	// The remappers of the I420 planes, built by processI420() when it is first needed.
+	struct PlanarRemappers
+	{
+		Remapper luma;
+		Remapper lumaFullRange;
+		Remapper chroma;
+		cv::Mat chromaMap1;
+		cv::Mat chromaMap2;
+	};
+
+	std::shared_ptr<const PlanarRemappers> planarRemappers(ChromaSiting siting) const;
+
+	bool initialized;
+	FlattenerOptions opts;
+	std::string origin;
+	double setupTime;
+
+	// The remapper shares these; the cache must outlive map1/map2 when they point into its mapping.
+	MapCache mapCache;
+	cv::Mat map1;
+	cv::Mat map2;
+	cv::Mat mesh;
+	LensModel lens;
+	Remapper remap;
+
+	mutable std::mutex planarMutex;
+	mutable std::shared_ptr<const PlanarRemappers> planar[NUM_CHROMA_SITINGS];
+
+};
+
+#endif // FLATTEN_FLATTENER_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,137 @@
+#include <exception>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "flattener_cache.hpp"
+#include "map_cache.hpp"
+
+//--------------------------------------------------
+
+FlattenerCache::FlattenerCache(size_t capacity)
+	: capacity(capacity > 0 ? capacity : 1), nextSerial(0)
+{
+}
+
+//--------------------------------------------------
+
+std::string FlattenerCache::makeKey(const FlattenerOptions& requested)
+{
+	// Options that spell out a default, or that do not apply to the map mode and scheduler chosen,
+	// give the same flattener as options that leave them out.
+	FlattenerOptions options = requested;
+	applyFlattenerDefaults(options);
+	if ( options.mapMode != "mesh" )
+	{
+		options.meshStep = 0;
+	}
+	if ( options.mapMode != "dense" )
+	{
+		options.mapCacheDirectory.clear();
+	}
+	if ( options.remapScheduler != "tiled" )
+	{
+		options.tileSize = cv::Size();
+		options.tileThreads = 0;
+	}
+
+	const LensProfile& p = options.profile;
+	std::string key = MapCache::makeKey(p.cameraMatrix, p.distortionCoefficients, p.useFisheye,
+		p.originalSize, p.intermedSize, p.finalSize);
+	key += cv::format("\n%s %d %s %s %s %d %d %d\n",
+		options.mapMode.c_str(), options.meshStep, options.mapGenerator.c_str(), options.remapEngine.c_str(),
+		options.remapScheduler.c_str(), options.tileSize.width, options.tileSize.height, options.tileThreads);
+	key += options.mapCacheDirectory;
+	return key;
+}
+
+//--------------------------------------------------
+
+std::shared_ptr<const Flattener> FlattenerCache::get(const FlattenerOptions& options, std::string& problem, bool& hit)
+{
+	const std::string key = makeKey(options);
+	std::promise<Built> promise;
+	std::shared_future<Built> built;
+	size_t serial = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<std::string, std::list<Entry>::iterator>::iterator it = index.find(key);
+		hit = it != index.end();
+		if ( hit )
+		{
+			entries.splice(entries.begin(), entries, it->second);
+			built = it->second->built;
+		}
+		else
+		{
+			Entry entry;
+			entry.key = key;
+			entry.serial = serial = nextSerial++;
+			entry.built = promise.get_future().share();
+			built = entry.built;
+			entries.push_front(entry);
+			index[key] = entries.begin();
+			while ( entries.size() > capacity )
+			{
+				index.erase(entries.back().key);
+				entries.pop_back();
+			}
+		}
+	}
+
+	if ( !hit )
+	{
+		// Built outside the lock, so other profiles are served meanwhile.
+		// Whatever goes wrong, the waiters get a result rather than a broken promise.
+		Built result;
+		try
+		{
+			std::shared_ptr<Flattener> flattener(new Flattener);
+			if ( flattener->init(options, result.problem) )
+			{
+				result.flattener = flattener;
+			}
+		}
+		catch (const std::exception& ex)
+		{
+			result.problem = ex.what();
+		}
+		catch (...)
+		{
+			result.problem = "unknown exception while building the flattener";
+		}
+		promise.set_value(result);
+		if ( !result.flattener )
+		{
+			// Do not keep failures; the next request for these options tries again.
+			std::lock_guard<std::mutex> lock(mutex);
+			std::map<std::string, std::list<Entry>::iterator>::iterator it = index.find(key);
+			if ( it != index.end() && it->second->serial == serial )
+			{
+				entries.erase(it->second);
+				index.erase(it);
+			}
+		}
+	}
+
+	const Built& result = built.get();
+	problem = result.problem;
+	return result.flattener;
+}
+
+//--------------------------------------------------
+
+size_t FlattenerCache::size() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,71 @@
+#ifndef FLATTEN_FLATTENER_CACHE_HPP
+#define FLATTEN_FLATTENER_CACHE_HPP
+
+#include <stddef.h>
+
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "flattener.hpp"
+
+//--------------------------------------------------
+// Initialised Flatteners, keyed by everything that goes into their maps and engine, least recently used
+// evicted first.
+//
+// get() returns the cached flattener for a set of options or builds it. Callers asking for a profile
+// that is being built wait for that build instead of starting their own. An evicted flattener stays
+// alive for as long as a caller still holds it.
+//--------------------------------------------------
+
+class FlattenerCache
+{
+public:
+	explicit FlattenerCache(size_t capacity);
+
+	//--------------------------------------------------
+
+	// NULL, with the reason in problem, if the options are not valid. hit tells whether the flattener
+	// was already there (or being built by another caller).
+	std::shared_ptr<const Flattener> get(const FlattenerOptions& options, std::string& problem, bool& hit);
+
+	// Two sets of options have the same key if and only if they produce the same flattener.
+	static std::string makeKey(const FlattenerOptions& options);
+
+	size_t size() const;
+
+	//--------------------------------------------------
+
+private:
+	FlattenerCache(const FlattenerCache&);
+	FlattenerCache& operator=(const FlattenerCache&);
+
+	struct Built
+	{
+		std::shared_ptr<const Flattener> flattener; // NULL if init() failed
+		std::string problem;
+	};
+
+	struct Entry
+	{
+		std::string key;
+		size_t serial;  // tells a re-inserted entry from the one it replaced
+		std::shared_future<Built> built;
+	};
+
+	const size_t capacity;
+	mutable std::mutex mutex;
+	size_t nextSerial;
+	std::list<Entry> entries;                                    // most recently used first
+	std::map<std::string, std::list<Entry>::iterator> index;
+
+};
+
+#endif // FLATTEN_FLATTENER_CACHE_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,174 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "image_io.hpp"
+
+//--------------------------------------------------
+
+struct FormatDepths
+{
+	const char * extension;
+	bool can16U;
+	bool can32F;
+};
+
+// Formats whose OpenCV encoder stores more than 8 bits; every other one stores 8-bit only.
+static const FormatDepths format_depths[] =
+{
+	{ "png",  true,  false },
+	{ "pgm",  true,  false },
+	{ "ppm",  true,  false },
+	{ "pnm",  true,  false },
+	{ "pam",  true,  false },
+	{ "jp2",  true,  false },
+	{ "tif",  true,  true  },
+	{ "tiff", true,  true  },
+	{ "exr",  false, true  },
+	{ "pfm",  false, true  },
+};
+
+//--------------------------------------------------
+
+// The value of white in each depth handled here.
+static double full_range(int depth)
+{
+	return depth == CV_16U ? 65535. : depth == CV_32F ? 1. : 255.;
+}
+
+//--------------------------------------------------
+
+static std::string lower_extension(const std::string& filename)
+{
+	std::string ext;
+	const size_t dot = filename.find_last_of('.');
+	if ( dot != std::string::npos )
+	{
+		for ( size_t i = dot + 1; i < filename.size(); i++ )
+		{
+			ext += (char) tolower((unsigned char) filename[i]);
+		}
+	}
+	return ext;
+}
+
+//--------------------------------------------------
+
+int imageReadFlags(bool keepBitDepth)
+{
+	return keepBitDepth ? cv::IMREAD_UNCHANGED : cv::IMREAD_COLOR;
+}
+
+//--------------------------------------------------
+
+int imageWriteDepth(const std::string& filename, int depth)
+{
+	if ( depth != CV_16U && depth != CV_32F )
+	{
+		return depth; // 8-bit, or a depth cv::imwrite() deals with itself
+	}
+
+	const std::string ext = lower_extension(filename);
+	bool can16U = false;
+	bool can32F = false;
+	for ( size_t i = 0; i < sizeof(format_depths) / sizeof(format_depths[0]); i++ )
+	{
+		if ( ext == format_depths[i].extension )
+		{
+			can16U = format_depths[i].can16U;
+			can32F = format_depths[i].can32F;
+		}
+	}
+
+	if ( (depth == CV_16U && can16U) || (depth == CV_32F && can32F) )
+	{
+		return depth;
+	}
+	// Otherwise the other high depth (float holds 16 bits exactly), then 8-bit.
+	if ( can16U )
+	{
+		return CV_16U;
+	}
+	if ( can32F )
+	{
+		return CV_32F;
+	}
+	return CV_8U;
+}
+
+//--------------------------------------------------
+
+// image itself, or converted into converted if the format of filename cannot store its depth.
+static const cv::Mat& convert_for_writing(const std::string& filename, const cv::Mat& image, cv::Mat& converted, int& storedDepth)
+{
+	const int depth = image.depth();
+	storedDepth = imageWriteDepth(filename, depth);
+	if ( storedDepth == depth )
+	{
+		return image;
+	}
+	image.convertTo(converted, storedDepth, full_range(storedDepth) / full_range(depth));
+	return converted;
+}
+
+//--------------------------------------------------
+
+bool writeImage(const std::string& filename, const cv::Mat& image, int& storedDepth, const std::vector<int>& params)
+{
+	cv::Mat converted;
+	return cv::imwrite(filename, convert_for_writing(filename, image, converted, storedDepth), params);
+}
+
+//--------------------------------------------------
+
+bool encodeImage(const std::string& filename, const cv::Mat& image, std::vector<uchar>& encoded, int& storedDepth,
+	const std::vector<int>& params)
+{
+	const size_t dot = filename.find_last_of('.');
+	if ( dot == std::string::npos )
+	{
+		return false;
+	}
+	cv::Mat converted;
+	return cv::imencode(filename.substr(dot), convert_for_writing(filename, image, converted, storedDepth), encoded, params);
+}
+
+//--------------------------------------------------
+
+bool imageFileLooksComplete(const std::string& filename)
+{
+	const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 )
+	{
+		return false;
+	}
+	struct stat st;
+	bool complete = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+	const std::string ext = lower_extension(filename);
+	if ( complete && (ext == "jpg" || ext == "jpeg") )
+	{
+		// EOI
+		unsigned char tail[2];
+		complete = st.st_size >= 2 && pread(fd, tail, 2, st.st_size - 2) == 2 && tail[0] == 0xFF && tail[1] == 0xD9;
+	}
+	else if ( complete && ext == "png" )
+	{
+		// IEND chunk: type and CRC
+		unsigned char tail[8];
+		complete = st.st_size >= 8 && pread(fd, tail, 8, st.st_size - 8) == 8 && memcmp(tail, "IEND\xAE\x42\x60\x82", 8) == 0;
+	}
+	close(fd);
+	return complete;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
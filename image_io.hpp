@@ -0,0 +1,46 @@
+#ifndef FLATTEN_IMAGE_IO_HPP
+#define FLATTEN_IMAGE_IO_HPP
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+//--------------------------------------------------
+// Still images of more than 8 bits per channel.
+//
+// cv::IMREAD_COLOR turns every image into 8-bit BGR, so a 16-bit PNG or TIFF, or a float TIFF or EXR,
+// loses its precision on the way in. With keepBitDepth, images are read with cv::IMREAD_UNCHANGED:
+// depth, channel count and alpha stay as they are in the file (the EXIF orientation is not applied,
+// which is what a lens profile of the sensor wants anyway).
+//
+// On the way out, writeImage() stores the image at its depth if the format can hold it. If it cannot,
+// it converts to the nearest depth the format can hold, scaled over the full range, instead of the
+// saturating conversion cv::imwrite() falls back to: a 16-bit frame written as JPEG would otherwise come
+// out as mostly white, a float one as mostly black. Float images are taken to be in [0, 1].
+//--------------------------------------------------
+
+// Flags for cv::imread().
+int imageReadFlags(bool keepBitDepth);
+
+// Depth in which an image of the given depth is stored in a file of this name (by its extension).
+int imageWriteDepth(const std::string& filename, int depth);
+
+// cv::imwrite(), after the conversion above if needed. storedDepth receives the depth written.
+// Returns false if the image could not be written.
+bool writeImage(const std::string& filename, const cv::Mat& image, int& storedDepth,
+	const std::vector<int>& params = std::vector<int>());
+
+// The same into memory, with cv::imencode() and the extension of filename; false if it has none.
+bool encodeImage(const std::string& filename, const cv::Mat& image, std::vector<uchar>& encoded, int& storedDepth,
+	const std::vector<int>& params = std::vector<int>());
+
+// Whether the file exists and looks like a whole image, without decoding it: it is not empty and, for
+// JPEG and PNG, ends with the end marker of the format, so a file cut short while it was written fails.
+bool imageFileLooksComplete(const std::string& filename);
+
+#endif // FLATTEN_IMAGE_IO_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,363 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "file_input.hpp"
+#include "image_source.hpp"
+
+//--------------------------------------------------
+
+// Numbers tried for the first file of a pattern, as FFmpeg's image2 demuxer does.
+#define CONST_INT__PATTERN_START_RANGE  5
+
+//--------------------------------------------------
+
+static bool read_string_list(const std::string& filename, std::vector<std::string>& l)
+{
+	l.clear();
+	cv::FileStorage fs(filename, cv::FileStorage::READ);
+	if ( !fs.isOpened() )
+	{
+		return false;
+	}
+	cv::FileNode n = fs.getFirstTopLevelNode();
+	if ( n.type() != cv::FileNode::SEQ )
+	{
+		return false;
+	}
+	cv::FileNodeIterator it = n.begin();
+	cv::FileNodeIterator it_end = n.end();
+	for ( ; it != it_end; ++it )
+	{
+		l.push_back((std::string)*it);
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+static bool has_extension(const std::string& name, const char * extension)
+{
+	const size_t dot = name.find_last_of('.');
+	if ( dot == std::string::npos || name.find('/', dot) != std::string::npos )
+	{
+		return false;
+	}
+	return strcasecmp(name.c_str() + dot + 1, extension) == 0;
+}
+
+//--------------------------------------------------
+
+// The files flatten writes itself: "name-b.ext" and "name-b.ext.part", and the files of a run such as
+// "name-b-journal.txt", "name-b-failures.json" or "name-b-from-000480.avi".
+static bool is_flatten_output(const std::string& name)
+{
+	if ( name.size() > 5 && name.compare(name.size() - 5, 5, ".part") == 0 )
+	{
+		return true;
+	}
+	if ( name.find("-b-") != std::string::npos )
+	{
+		return true;
+	}
+	const size_t dot = name.find_last_of('.');
+	const size_t stemEnd = dot == std::string::npos ? name.size() : dot;
+	return stemEnd >= 2 && name.compare(stemEnd - 2, 2, "-b") == 0;
+}
+
+//--------------------------------------------------
+
+ImageSource::ImageSource()
+	: sourceKind(IMAGE_SOURCE_SEQUENCE), sequenceNext(0), lines(NULL), lineBuffer(NULL), lineCapacity(0),
+	  width(0), zeroPadded(false), number(0), directory(NULL), distance(0), exhausted(false), count(0), skipCount(0)
+{
+}
+
+//--------------------------------------------------
+
+ImageSource::~ImageSource()
+{
+	close();
+	free(lineBuffer);
+}
+
+//--------------------------------------------------
+
+void ImageSource::close()
+{
+	if ( lines != NULL )
+	{
+		fclose(lines);
+		lines = NULL;
+	}
+	if ( directory != NULL )
+	{
+		closedir(directory);
+		directory = NULL;
+	}
+}
+
+//--------------------------------------------------
+
+bool ImageSource::open(const std::string& input, std::string& problem)
+{
+	close();
+	problem.clear();
+	sequence.clear();
+	sequenceNext = 0;
+	ahead.clear();
+	exhausted = false;
+	count = 0;
+	skipCount = 0;
+
+	const size_t slash = input.find_last_of('/');
+	const std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+	const std::string parent = slash == std::string::npos ? std::string(".") : input.substr(0, std::max(slash, (size_t) 1));
+	struct stat st;
+
+	// Same test as before the other forms existed, so existing settings files keep working.
+	if ( input.find(".xml") != std::string::npos || input.find(".yaml") != std::string::npos || input.find(".yml") != std::string::npos )
+	{
+		sourceKind = IMAGE_SOURCE_SEQUENCE;
+		if ( !read_string_list(input, sequence) )
+		{
+			return false; // perhaps a video file after all
+		}
+		return true;
+	}
+
+	// "%d", "%6d" or "%06d", once; any other '%' is part of a file name.
+	const size_t percent = name.find('%');
+	size_t p = percent + 1;
+	zeroPadded = percent != std::string::npos && p < name.size() && name[p] == '0';
+	width = 0;
+	while ( percent != std::string::npos && p < name.size() && isdigit((unsigned char) name[p]) && width < 100 )
+	{
+		width = width * 10 + (name[p++] - '0');
+	}
+	if ( percent != std::string::npos && p < name.size() && name[p] == 'd' && name.find('%', p) == std::string::npos )
+	{
+		sourceKind = IMAGE_SOURCE_PATTERN;
+		prefix = input.substr(0, input.size() - name.size() + percent);
+		suffix = name.substr(p + 1);
+		for ( number = 0; number < CONST_INT__PATTERN_START_RANGE; number++ )
+		{
+			std::string first;
+			if ( fetch(first) )
+			{
+				number--; // hand it out again
+				return true;
+			}
+		}
+		problem = "no file matches '" + input + "'";
+		return false;
+	}
+
+	const bool wildcards = name.find_first_of("*?[") != std::string::npos;
+	if ( wildcards || name.empty() || (stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) )
+	{
+		sourceKind = IMAGE_SOURCE_DIRECTORY;
+		directoryPath = wildcards || name.empty() ? parent : input;
+		namePattern = wildcards ? name : std::string();
+		directory = opendir(directoryPath.c_str());
+		if ( directory == NULL )
+		{
+			problem = "cannot open the directory '" + directoryPath + "': " + strerror(errno);
+			return false;
+		}
+		return true;
+	}
+
+	if ( has_extension(name, "txt") || has_extension(name, "lst") )
+	{
+		sourceKind = IMAGE_SOURCE_LINES;
+		lines = fopen(input.c_str(), "r");
+		if ( lines == NULL )
+		{
+			problem = "cannot open '" + input + "': " + strerror(errno);
+			return false;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+//--------------------------------------------------
+
+const char * ImageSource::kindName() const
+{
+	switch ( sourceKind )
+	{
+	case IMAGE_SOURCE_LINES:     return "lines";
+	case IMAGE_SOURCE_PATTERN:   return "pattern";
+	case IMAGE_SOURCE_DIRECTORY: return "directory";
+	default:                     return "sequence";
+	}
+}
+
+//--------------------------------------------------
+
+void ImageSource::setReadahead(size_t distance)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->distance = distance;
+}
+
+//--------------------------------------------------
+
+void ImageSource::setSkip(const std::function<bool(const std::string& path)>& skip)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->skip = skip;
+}
+
+//--------------------------------------------------
+// The next entry of the underlying list, before skipping; false at its end.
+//--------------------------------------------------
+
+bool ImageSource::fetch(std::string& path)
+{
+	struct stat st;
+	switch ( sourceKind )
+	{
+	case IMAGE_SOURCE_SEQUENCE:
+		if ( sequenceNext >= sequence.size() )
+		{
+			return false;
+		}
+		path = sequence[sequenceNext++];
+		return true;
+
+	case IMAGE_SOURCE_LINES:
+		for(;;)
+		{
+			const ssize_t n = lines != NULL ? getline(&lineBuffer, &lineCapacity, lines) : -1;
+			if ( n < 0 )
+			{
+				return false;
+			}
+			path.assign(lineBuffer, (size_t) n);
+			while ( !path.empty() && (path[path.size() - 1] == '\n' || path[path.size() - 1] == '\r') )
+			{
+				path.erase(path.size() - 1);
+			}
+			if ( !path.empty() && path[0] != '#' )
+			{
+				return true;
+			}
+		}
+
+	case IMAGE_SOURCE_PATTERN:
+		{
+			std::string digits = cv::format("%lld", number);
+			if ( (int) digits.size() < width )
+			{
+				digits.insert(0, (size_t) width - digits.size(), zeroPadded ? '0' : ' ');
+			}
+			path = prefix + digits + suffix;
+			if ( stat(path.c_str(), &st) != 0 )
+			{
+				return false;
+			}
+			number++;
+			return true;
+		}
+
+	case IMAGE_SOURCE_DIRECTORY:
+		for(;;)
+		{
+			const struct dirent * entry = directory != NULL ? readdir(directory) : NULL;
+			if ( entry == NULL )
+			{
+				return false;
+			}
+			const std::string name = entry->d_name;
+			if ( name[0] == '.' || is_flatten_output(name) ||
+				(!namePattern.empty() && fnmatch(namePattern.c_str(), name.c_str(), 0) != 0) )
+			{
+				continue;
+			}
+			path = directoryPath == "/" ? "/" + name : directoryPath + "/" + name;
+			if ( entry->d_type == DT_REG || (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK ?
+				stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) : false) )
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+//--------------------------------------------------
+// Keeps up to distance + 1 entries that are not skipped in ahead, the ones past the first advised as
+// they come in, so every file is advised once and before a decoder gets to it.
+//--------------------------------------------------
+
+bool ImageSource::next(size_t& index, std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	while ( !exhausted && ahead.size() < distance + 1 )
+	{
+		std::string entry;
+		if ( !fetch(entry) )
+		{
+			exhausted = true;
+			close();
+			break;
+		}
+		const size_t position = count++;
+		if ( skip && skip(entry) )
+		{
+			skipCount++;
+			continue;
+		}
+		if ( distance > 0 && !ahead.empty() )
+		{
+			adviseWillNeed(entry);
+		}
+		ahead.push_back(std::make_pair(position, entry));
+	}
+	if ( ahead.empty() )
+	{
+		return false;
+	}
+	index = ahead.front().first;
+	path = ahead.front().second;
+	ahead.pop_front();
+	return true;
+}
+
+//--------------------------------------------------
+
+size_t ImageSource::enumerated() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return count;
+}
+
+//--------------------------------------------------
+
+size_t ImageSource::skipped() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return skipCount;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
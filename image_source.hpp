@@ -0,0 +1,110 @@
+#ifndef FLATTEN_IMAGE_SOURCE_HPP
+#define FLATTEN_IMAGE_SOURCE_HPP
+
+#include <stddef.h>
+#include <stdio.h>
+#include <dirent.h>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+//--------------------------------------------------
+// The images of a list input, handed out one at a time to the decoder threads.
+//
+// Every form but the first is enumerated as the decoders ask for images, so the time to start and the
+// memory used do not grow with the length of the list:
+//
+// - "list.xml", "list.yaml", "list.yml": a cv::FileStorage sequence, read in full when opened.
+// - "list.txt", "list.lst": one path per line; empty lines and lines starting with '#' are ignored.
+// - "/dir/frame-%06d.JPG": numbered files, from the first of the numbers 0 to 4 that exists, up to the
+//   first number that does not.
+// - "/dir/" or "/dir/*.JPG": the regular files of a directory, all of them or those matching the
+//   wildcards (fnmatch()), in the order of the file system. Hidden files, "*.part" files, outputs of
+//   flatten ("*-b.*") and the files of its runs ("*-b-*", such as "list-b-journal.txt") are left out,
+//   so nothing flatten writes to the same directory is ever read back.
+//
+// Paths are used as they are: relative ones are relative to the working directory, not to the list.
+// The order of the images does not matter to an image list; each output is named after its input.
+//--------------------------------------------------
+
+enum ImageSourceKind
+{
+	IMAGE_SOURCE_SEQUENCE,
+	IMAGE_SOURCE_LINES,
+	IMAGE_SOURCE_PATTERN,
+	IMAGE_SOURCE_DIRECTORY
+};
+
+class ImageSource
+{
+public:
+	ImageSource();
+	~ImageSource();
+
+	// Returns false, with problem empty, if input is none of the forms above (a video file, say), and
+	// with the reason in problem if it is one but cannot be opened.
+	bool open(const std::string& input, std::string& problem);
+
+	ImageSourceKind kind() const { return sourceKind; }
+
+	// "sequence", "lines", "pattern" or "directory".
+	const char * kindName() const;
+
+	// Keeps the page cache distance images ahead of the ones handed out (posix_fadvise WILLNEED);
+	// zero, the default, disables it.
+	void setReadahead(size_t distance);
+
+	// Images for which skip returns true are not handed out, nor read ahead. Called with the lock held.
+	void setSkip(const std::function<bool(const std::string& path)>& skip);
+
+	// Thread-safe. The next image, with its position in the list (skipped ones included). Returns false
+	// once the list is exhausted.
+	bool next(size_t& index, std::string& path);
+
+	// Images enumerated so far, and how many of them setSkip() left out.
+	size_t enumerated() const;
+	size_t skipped() const;
+
+	//--------------------------------------------------
+
+private:
+	ImageSource(const ImageSource&);
+	ImageSource& operator=(const ImageSource&);
+
+	bool fetch(std::string& path);
+	void close();
+
+	mutable std::mutex mutex;
+	ImageSourceKind sourceKind;
+
+	std::vector<std::string> sequence; // IMAGE_SOURCE_SEQUENCE
+	size_t sequenceNext;
+	FILE * lines;                      // IMAGE_SOURCE_LINES
+	char * lineBuffer;
+	size_t lineCapacity;
+	std::string prefix;                // IMAGE_SOURCE_PATTERN: prefix, number, suffix
+	std::string suffix;
+	int width;
+	bool zeroPadded;
+	long long number;
+	DIR * directory;                   // IMAGE_SOURCE_DIRECTORY
+	std::string directoryPath;
+	std::string namePattern;           // empty: every file
+
+	size_t distance;
+	std::function<bool(const std::string&)> skip;
+	std::deque<std::pair<size_t, std::string> > ahead;
+	bool exhausted;
+	size_t count;
+	size_t skipCount;
+};
+
+#endif // FLATTEN_IMAGE_SOURCE_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
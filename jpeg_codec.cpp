@@ -0,0 +1,311 @@
+#include <ctype.h>
+#include <string.h>
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#ifdef FLATTEN_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#include "jpeg_codec.hpp"
+
+//--------------------------------------------------
+
+bool parseJpegSubsampling(const std::string& name, JpegSubsampling& subsampling)
+{
+	if ( name == "444" )
+	{
+		subsampling = JPEG_444;
+		return true;
+	}
+	if ( name == "422" )
+	{
+		subsampling = JPEG_422;
+		return true;
+	}
+	if ( name == "420" )
+	{
+		subsampling = JPEG_420;
+		return true;
+	}
+	return false;
+}
+
+//--------------------------------------------------
+
+bool isJpegFilename(const std::string& filename)
+{
+	std::string ext;
+	const size_t dot = filename.find_last_of('.');
+	if ( dot != std::string::npos )
+	{
+		for ( size_t i = dot + 1; i < filename.size(); i++ )
+		{
+			ext += (char) tolower((unsigned char) filename[i]);
+		}
+	}
+	return ext == "jpg" || ext == "jpeg" || ext == "jpe";
+}
+
+//--------------------------------------------------
+
+static unsigned read_exif_uint(const uchar * p, int bytes, bool bigEndian)
+{
+	unsigned value = 0;
+	for ( int i = 0; i < bytes; i++ )
+	{
+		value |= (unsigned) p[bigEndian ? i : bytes - 1 - i] << (8 * (bytes - 1 - i));
+	}
+	return value;
+}
+
+//--------------------------------------------------
+// Walks the markers up to the first scan, looking for an APP1 "Exif" segment, and reads tag 0x0112 of
+// its first IFD. Anything malformed counts as no orientation.
+//--------------------------------------------------
+
+int jpegExifOrientation(const uchar * data, size_t size)
+{
+	if ( size < 4 || data[0] != 0xFF || data[1] != 0xD8 )
+	{
+		return 1;
+	}
+	size_t pos = 2;
+	while ( pos + 4 <= size && data[pos] == 0xFF )
+	{
+		const uchar marker = data[pos + 1];
+		if ( marker == 0xD9 || marker == 0xDA )
+		{
+			break; // end of image or start of scan: no more metadata
+		}
+		const size_t length = read_exif_uint(data + pos + 2, 2, true);
+		if ( length < 2 || pos + 2 + length > size )
+		{
+			break;
+		}
+		const uchar * segment = data + pos + 4;
+		const size_t segmentSize = length - 2;
+		if ( marker == 0xE1 && segmentSize >= 14 && memcmp(segment, "Exif\0\0", 6) == 0 )
+		{
+			const uchar * tiff = segment + 6;
+			const size_t tiffSize = segmentSize - 6;
+			const bool bigEndian = tiff[0] == 'M' && tiff[1] == 'M';
+			if ( !bigEndian && !(tiff[0] == 'I' && tiff[1] == 'I') )
+			{
+				return 1;
+			}
+			const size_t ifd = read_exif_uint(tiff + 4, 4, bigEndian);
+			if ( ifd + 2 > tiffSize )
+			{
+				return 1;
+			}
+			const size_t entries = read_exif_uint(tiff + ifd, 2, bigEndian);
+			for ( size_t i = 0; i < entries && ifd + 2 + (i + 1) * 12 <= tiffSize; i++ )
+			{
+				const uchar * entry = tiff + ifd + 2 + i * 12;
+				if ( read_exif_uint(entry, 2, bigEndian) == 0x0112 )
+				{
+					// SHORT, left-justified in the value field
+					const unsigned orientation = read_exif_uint(entry + 8, 2, bigEndian);
+					return orientation >= 1 && orientation <= 8 ? (int) orientation : 1;
+				}
+			}
+			return 1;
+		}
+		pos += 2 + length;
+	}
+	return 1;
+}
+
+//--------------------------------------------------
+// Walks the markers up to the first frame header (SOF0 to SOF15, less DHT, JPG and DAC, which share the
+// range) and reads its number of components. Anything malformed counts as colour.
+//--------------------------------------------------
+
+bool jpegIsGrayscale(const uchar * data, size_t size)
+{
+	if ( size < 4 || data[0] != 0xFF || data[1] != 0xD8 )
+	{
+		return false;
+	}
+	size_t pos = 2;
+	while ( pos + 4 <= size && data[pos] == 0xFF )
+	{
+		const uchar marker = data[pos + 1];
+		if ( marker == 0xD9 || marker == 0xDA )
+		{
+			break; // end of image or start of scan before any frame header
+		}
+		const size_t length = read_exif_uint(data + pos + 2, 2, true);
+		if ( length < 2 || pos + 2 + length > size )
+		{
+			break;
+		}
+		if ( marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC )
+		{
+			// precision, height, width, then the number of components
+			return length >= 8 && data[pos + 9] == 1;
+		}
+		pos += 2 + length;
+	}
+	return false;
+}
+
+//--------------------------------------------------
+
+JpegCodec::JpegCodec(int quality, JpegSubsampling subsampling)
+	: quality(quality), subsampling(subsampling), decompressor(NULL), compressor(NULL), encoded(NULL), encodedCapacity(0)
+{
+}
+
+//--------------------------------------------------
+
+#ifdef FLATTEN_HAVE_TURBOJPEG
+
+JpegCodec::~JpegCodec()
+{
+	if ( decompressor != NULL )
+	{
+		tjDestroy((tjhandle) decompressor);
+	}
+	if ( compressor != NULL )
+	{
+		tjDestroy((tjhandle) compressor);
+	}
+	tjFree(encoded);
+}
+
+//--------------------------------------------------
+
+bool JpegCodec::available()
+{
+	return true;
+}
+
+//--------------------------------------------------
+
+bool JpegCodec::decode(const uchar * data, size_t size, bool allowI420, cv::Mat& frame, bool& i420, std::string& problem)
+{
+	if ( decompressor == NULL && (decompressor = tjInitDecompress()) == NULL )
+	{
+		problem = "cannot create a TurboJPEG decompressor";
+		return false;
+	}
+	tjhandle handle = (tjhandle) decompressor;
+	int width = 0;
+	int height = 0;
+	int jpegSubsampling = 0;
+	int jpegColorspace = 0;
+	if ( tjDecompressHeader3(handle, data, (unsigned long) size, &width, &height, &jpegSubsampling, &jpegColorspace) != 0 )
+	{
+		problem = tjGetErrorStr2(handle);
+		return false;
+	}
+
+	i420 = allowI420 && jpegSubsampling == TJSAMP_420 && jpegColorspace == TJCS_YCbCr && ((width | height) & 1) == 0;
+	int result;
+	if ( i420 )
+	{
+		// Without row padding, the three planes of an even-sized frame are exactly the I420 layout.
+		frame.create(height * 3 / 2, width, CV_8UC1);
+		result = tjDecompressToYUV2(handle, data, (unsigned long) size, frame.data, width, 1, height, 0);
+	}
+	else
+	{
+		frame.create(height, width, CV_8UC3);
+		result = tjDecompress2(handle, data, (unsigned long) size, frame.data, width, (int) frame.step, height, TJPF_BGR, 0);
+	}
+	if ( result != 0 )
+	{
+		problem = tjGetErrorStr2(handle);
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+bool JpegCodec::encode(const cv::Mat& frame, bool i420, const uchar *& data, size_t& size, std::string& problem)
+{
+	if ( compressor == NULL && (compressor = tjInitCompress()) == NULL )
+	{
+		problem = "cannot create a TurboJPEG compressor";
+		return false;
+	}
+	tjhandle handle = (tjhandle) compressor;
+	static const int tj_subsampling[] = { TJSAMP_444, TJSAMP_422, TJSAMP_420 };
+	const int samp = i420 ? TJSAMP_420 : tj_subsampling[subsampling];
+	const int width = frame.cols;
+	const int height = i420 ? frame.rows * 2 / 3 : frame.rows;
+	if ( i420 ? (frame.type() != CV_8UC1 || !frame.isContinuous()) : frame.type() != CV_8UC3 )
+	{
+		problem = "unsupported frame type";
+		return false;
+	}
+
+	// One buffer of the worst case size, so TurboJPEG never reallocates it.
+	const size_t worstCase = tjBufSize(width, height, samp);
+	if ( worstCase > encodedCapacity )
+	{
+		tjFree(encoded);
+		encoded = tjAlloc((int) worstCase);
+		encodedCapacity = encoded != NULL ? worstCase : 0;
+		if ( encoded == NULL )
+		{
+			problem = "out of memory";
+			return false;
+		}
+	}
+	unsigned char * buffer = encoded;
+	unsigned long encodedSize = (unsigned long) encodedCapacity;
+	const int result = i420
+		? tjCompressFromYUV(handle, frame.data, width, 1, height, samp, &buffer, &encodedSize, quality, TJFLAG_NOREALLOC)
+		: tjCompress2(handle, frame.data, width, (int) frame.step, height, TJPF_BGR, &buffer, &encodedSize, samp, quality, TJFLAG_NOREALLOC);
+	if ( result != 0 )
+	{
+		problem = tjGetErrorStr2(handle);
+		return false;
+	}
+	data = buffer;
+	size = (size_t) encodedSize;
+	return true;
+}
+
+//--------------------------------------------------
+
+#else // FLATTEN_HAVE_TURBOJPEG
+
+JpegCodec::~JpegCodec()
+{
+}
+
+//--------------------------------------------------
+
+bool JpegCodec::available()
+{
+	return false;
+}
+
+//--------------------------------------------------
+
+bool JpegCodec::decode(const uchar *, size_t, bool, cv::Mat&, bool&, std::string& problem)
+{
+	problem = "flatten was built without TurboJPEG";
+	return false;
+}
+
+//--------------------------------------------------
+
+bool JpegCodec::encode(const cv::Mat&, bool, const uchar *&, size_t&, std::string& problem)
+{
+	problem = "flatten was built without TurboJPEG";
+	return false;
+}
+
+#endif // FLATTEN_HAVE_TURBOJPEG
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,91 @@
+#ifndef FLATTEN_JPEG_CODEC_HPP
+#define FLATTEN_JPEG_CODEC_HPP
+
+#include <stddef.h>
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+//--------------------------------------------------
+// JPEG decode and encode straight through TurboJPEG, for image lists of JPEG frames.
+//
+// cv::imread() and cv::imwrite() set up a new libjpeg codec and new buffers for every file. A JpegCodec
+// keeps its TurboJPEG handles and its encode buffer from one frame to the next; each worker thread owns
+// one. It decodes from memory, for example the bytes of a FileReader (file_input.hpp). Decoded frames
+// are ordinary Mats, so with buffer_pool they come out of the pooled buffers too.
+//
+// A 4:2:0 JPEG is made of Y, Cb and Cr planes. When the output is 4:2:0 as well, decode() can hand out
+// those planes in I420 layout instead of converting them to BGR, the Flattener remaps them plane by plane
+// (Flattener::processI420() with full range black), and encode() compresses them again as they are:
+// no colour conversion on either side, and half the bytes to remap. Other JPEGs are decoded to BGR.
+//
+// Unlike cv::imread(), the EXIF orientation is not applied; frames come in the orientation of the
+// sensor, which is the one of the lens profile. jpegExifOrientation() tells the caller when cv::imread()
+// would rotate or flip the frame.
+//
+// TurboJPEG is optional at build time; without it, available() is false and every call fails.
+//--------------------------------------------------
+
+enum JpegSubsampling
+{
+	JPEG_444,
+	JPEG_422,
+	JPEG_420
+};
+
+// "444", "422" or "420"; returns false for anything else.
+bool parseJpegSubsampling(const std::string& name, JpegSubsampling& subsampling);
+
+// ".jpg", ".jpeg", ".jpe" in any case.
+bool isJpegFilename(const std::string& filename);
+
+// The EXIF orientation tag (1 to 8) of a JPEG in memory; 1, the sensor orientation, if there is none.
+int jpegExifOrientation(const uchar * data, size_t size);
+
+// True if the frame header of a JPEG in memory has a single component. decode() turns such a JPEG into
+// BGR, like cv::imread() does by default, whereas cv::IMREAD_UNCHANGED keeps its one channel.
+bool jpegIsGrayscale(const uchar * data, size_t size);
+
+//--------------------------------------------------
+
+class JpegCodec
+{
+public:
+	// quality: 1 to 100, as for cv::IMWRITE_JPEG_QUALITY.
+	JpegCodec(int quality, JpegSubsampling subsampling);
+	~JpegCodec();
+
+	// True if flatten was built with TurboJPEG.
+	static bool available();
+
+	//--------------------------------------------------
+
+	// Decodes a JPEG in memory. With allowI420, a 4:2:0 YCbCr JPEG of even width and height becomes
+	// a CV_8UC1 I420 frame (height * 3 / 2 rows) and i420 is set; anything else becomes CV_8UC3 BGR.
+	// Returns false, with the reason in problem, if the data cannot be decoded.
+	bool decode(const uchar * data, size_t size, bool allowI420, cv::Mat& frame, bool& i420, std::string& problem);
+
+	// Encodes a CV_8UC3 BGR frame, or an I420 frame as decode() returns them (always as 4:2:0).
+	// data points into a buffer of the codec, valid until the next call.
+	bool encode(const cv::Mat& frame, bool i420, const uchar *& data, size_t& size, std::string& problem);
+
+	//--------------------------------------------------
+
+private:
+	JpegCodec(const JpegCodec&);
+	JpegCodec& operator=(const JpegCodec&);
+
+	int quality;
+	JpegSubsampling subsampling;
+	void * decompressor;        // tjhandle, created on first use
+	void * compressor;
+	uchar * encoded;            // tjAlloc()ed, grown to the worst case size of the largest frame so far
+	size_t encodedCapacity;
+};
+
+#endif // FLATTEN_JPEG_CODEC_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
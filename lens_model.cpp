@@ -0,0 +1,173 @@
+#include <math.h>
+
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+
+#include "lens_model.hpp"
+
+//--------------------------------------------------
+
+bool makeLensModel(const LensProfile& profile, LensModel& model)
+{
+	cv::Mat coeffs;
+	profile.distortionCoefficients.convertTo(coeffs, CV_64F);
+	coeffs = coeffs.reshape(1, (int) coeffs.total());
+	const int n = coeffs.rows;
+
+	model.fisheye = profile.useFisheye;
+	for ( int i = 0; i < 12; i++ )
+	{
+		model.k[i] = i < n ? coeffs.at<double>(i) : 0;
+	}
+	if ( model.fisheye )
+	{
+		if ( n != 4 )
+		{
+			return false;
+		}
+	}
+	else
+	{
+		if ( n != 4 && n != 5 && n != 8 && n != 12 && n != 14 )
+		{
+			return false;
+		}
+		if ( n == 14 && (coeffs.at<double>(12) != 0 || coeffs.at<double>(13) != 0) )
+		{
+			return false;
+		}
+	}
+
+	cv::Mat A;
+	profile.cameraMatrix.convertTo(A, CV_64F);
+	if ( A.at<double>(0, 1) != 0 )
+	{
+		return false;
+	}
+	model.fx = A.at<double>(0, 0);
+	model.fy = A.at<double>(1, 1);
+	model.cx = A.at<double>(0, 2);
+	model.cy = A.at<double>(1, 2);
+
+	// Output pixel (x, y) is pixel (roi.x + x, roi.y + y) of the intermediate image.
+	const cv::Rect roi = profile.roi();
+	const cv::Matx33d toIntermediate(
+		1, 0, roi.x,
+		0, 1, roi.y,
+		0, 0, 1);
+	const cv::Matx33d ir = newCameraMatrix(profile).inv() * toIntermediate;
+	for ( int i = 0; i < 9; i++ )
+	{
+		model.ir[i] = ir.val[i];
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+static inline void store_fixed_point(double u, double v, short * xy, ushort * fxy)
+{
+	const int iu = cv::saturate_cast<int>(u * cv::INTER_TAB_SIZE);
+	const int iv = cv::saturate_cast<int>(v * cv::INTER_TAB_SIZE);
+	xy[0] = cv::saturate_cast<short>(iu >> cv::INTER_BITS);
+	xy[1] = cv::saturate_cast<short>(iv >> cv::INTER_BITS);
+	fxy[0] = (ushort) ((iv & (cv::INTER_TAB_SIZE - 1)) * cv::INTER_TAB_SIZE + (iu & (cv::INTER_TAB_SIZE - 1)));
+}
+
+//--------------------------------------------------
+
+void lens_model_row_scalar(const LensModel& m, int y, int x0, int count, short * xy, ushort * fxy)
+{
+	const double * ir = m.ir;
+	const double * k = m.k;
+	for ( int j = 0; j < count; j++ )
+	{
+		const int x = x0 + j;
+		const double _x = x * ir[0] + y * ir[1] + ir[2];
+		const double _y = x * ir[3] + y * ir[4] + ir[5];
+		const double _w = x * ir[6] + y * ir[7] + ir[8];
+		double u;
+		double v;
+		if ( m.fisheye )
+		{
+			// cv::fisheye::initUndistortRectifyMap()
+			if ( _w <= 0 )
+			{
+				u = _x > 0 ? -INFINITY : INFINITY;
+				v = _y > 0 ? -INFINITY : INFINITY;
+				store_fixed_point(u, v, xy + j * 2, fxy + j);
+				continue;
+			}
+			const double px = _x / _w;
+			const double py = _y / _w;
+			const double r = sqrt(px * px + py * py);
+			const double theta = atan(r);
+			const double theta2 = theta * theta;
+			const double theta4 = theta2 * theta2;
+			const double theta6 = theta4 * theta2;
+			const double theta8 = theta4 * theta4;
+			const double theta_d = theta * (1 + k[0] * theta2 + k[1] * theta4 + k[2] * theta6 + k[3] * theta8);
+			const double scale = (r == 0) ? 1.0 : theta_d / r;
+			u = m.fx * px * scale + m.cx;
+			v = m.fy * py * scale + m.cy;
+		}
+		else
+		{
+			// cv::initUndistortRectifyMap()
+			const double w = 1. / _w;
+			const double px = _x * w;
+			const double py = _y * w;
+			const double x2 = px * px;
+			const double y2 = py * py;
+			const double r2 = x2 + y2;
+			const double _2xy = 2 * px * py;
+			const double kr = (1 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2) / (1 + ((k[7] * r2 + k[6]) * r2 + k[5]) * r2);
+			u = m.fx * (px * kr + k[2] * _2xy + k[3] * (r2 + 2 * x2) + k[8] * r2 + k[9] * r2 * r2) + m.cx;
+			v = m.fy * (py * kr + k[2] * (r2 + 2 * y2) + k[3] * _2xy + k[10] * r2 + k[11] * r2 * r2) + m.cy;
+		}
+		store_fixed_point(u, v, xy + j * 2, fxy + j);
+	}
+}
+
+//--------------------------------------------------
+
+LensRowFunc lens_model_row_func(std::string& name)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") )
+	{
+		name = "avx2";
+		return lens_model_row_avx2;
+	}
+#endif
+	name = "scalar";
+	return lens_model_row_scalar;
+}
+
+//--------------------------------------------------
+
+void generateRemapMaps(const LensModel& model, const cv::Size& size, cv::Mat& map1, cv::Mat& map2,
+	LensRowFunc row)
+{
+	map1.create(size, CV_16SC2);
+	map2.create(size, CV_16UC1);
+	if ( row == NULL )
+	{
+		std::string name;
+		row = lens_model_row_func(name);
+	}
+	cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range& range)
+	{
+		for ( int y = range.start; y < range.end; y++ )
+		{
+			row(model, y, 0, size.width, map1.ptr<short>(y), map2.ptr<ushort>(y));
+		}
+	}, (double) size.area() / (1 << 16));
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
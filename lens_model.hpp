@@ -0,0 +1,74 @@
+#ifndef FLATTEN_LENS_MODEL_HPP
+#define FLATTEN_LENS_MODEL_HPP
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+// Closed-form evaluation of the lens model behind buildRemapMaps(): for each output pixel, the
+// fixed-point source coordinate (CV_16SC2 + CV_16UC1 entry) computed from the camera matrix and the
+// distortion coefficients alone, without any map in memory.
+//
+// The formulas are those of cv::initUndistortRectifyMap() for the pinhole model with 4, 5, 8 or 12
+// coefficients (the tilted sensor model is not supported) and of cv::fisheye::initUndistortRectifyMap().
+// The scalar version computes in double precision, as OpenCV does. The AVX2 version computes 8 pixels
+// at a time in single precision, with a polynomial arctangent for the fisheye model; a coordinate can
+// then land on the neighbouring 1/32 pixel step now and then.
+//
+// A camera matrix with skew (a non-zero element (0, 1)) is not supported. Rays that point behind the
+// camera (w <= 0) of the fisheye model map far outside the source, as in OpenCV.
+//
+// This header is included by translation units compiled with different instruction sets.
+//--------------------------------------------------
+
+// Largest accepted difference between the generated map entries and OpenCV's, in 1/32 pixel steps
+#define CONST_INT__MAP_GENERATOR_TOLERANCE  1
+
+struct LensModel
+{
+	bool fisheye;
+
+	// Output pixel (x, y, 1) -> homogeneous normalised coordinates of the undistorted ray, row-major.
+	double ir[9];
+
+	// Camera matrix of the source image.
+	double fx;
+	double fy;
+	double cx;
+	double cy;
+
+	// Pinhole: k1 k2 p1 p2 k3 k4 k5 k6 s1 s2 s3 s4, missing ones zero. Fisheye: k1 k2 k3 k4.
+	double k[12];
+};
+
+// Returns false if the distortion coefficients have a layout the model does not support, or if the
+// camera matrix has skew.
+bool makeLensModel(const LensProfile& profile, LensModel& model);
+
+//--------------------------------------------------
+
+// Map entries of output pixels x0 .. x0 + count - 1 of row y.
+typedef void (*LensRowFunc)(const LensModel& model, int y, int x0, int count, short * xy, ushort * fxy);
+
+void lens_model_row_scalar(const LensModel& model, int y, int x0, int count, short * xy, ushort * fxy);
+void lens_model_row_avx2(const LensModel& model, int y, int x0, int count, short * xy, ushort * fxy);
+
+// The widest variant the CPU can run; name receives "avx2" or "scalar".
+LensRowFunc lens_model_row_func(std::string& name);
+
+//--------------------------------------------------
+
+// Fixed-point maps (CV_16SC2 + CV_16UC1) of the given output size, the counterpart of buildRemapMaps().
+// Rows are spread over the threads of cv::parallel_for_() and evaluated with row, by default the widest
+// row function.
+void generateRemapMaps(const LensModel& model, const cv::Size& size, cv::Mat& map1, cv::Mat& map2,
+	LensRowFunc row = NULL);
+
+#endif // FLATTEN_LENS_MODEL_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,154 @@
+//--------------------------------------------------
+// AVX2 + FMA lens model evaluation. This file is compiled with -mavx2 -mfma and only called after a
+// runtime CPU check.
+//
+// Eight output pixels are evaluated at a time in single precision. The fisheye model needs atan(),
+// which is replaced by the Cephes atanf() approximation: a range reduction to |x| <= tan(pi/8) followed
+// by a degree-9 odd polynomial, good to about one unit in the last place of a float.
+//--------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "lens_model.hpp"
+
+//--------------------------------------------------
+
+// atan(r) for r >= 0.
+static inline __m256 atan_nonnegative(__m256 r)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 big = _mm256_cmp_ps(r, _mm256_set1_ps(2.414213562373095f), _CMP_GT_OQ);
+	const __m256 mid = _mm256_andnot_ps(big, _mm256_cmp_ps(r, _mm256_set1_ps(0.4142135623730950f), _CMP_GT_OQ));
+
+	// atan(r) = pi/2 + atan(-1/r) = pi/4 + atan((r - 1) / (r + 1))
+	__m256 x = _mm256_blendv_ps(r, _mm256_div_ps(_mm256_sub_ps(r, one), _mm256_add_ps(r, one)), mid);
+	x = _mm256_blendv_ps(x, _mm256_div_ps(_mm256_set1_ps(-1.f), r), big);
+	const __m256 offset = _mm256_or_ps(
+		_mm256_and_ps(big, _mm256_set1_ps(1.5707963267948966f)),
+		_mm256_and_ps(mid, _mm256_set1_ps(0.7853981633974483f)));
+
+	const __m256 z = _mm256_mul_ps(x, x);
+	__m256 p = _mm256_fmadd_ps(_mm256_set1_ps(8.05374449538e-2f), z, _mm256_set1_ps(-1.38776856032e-1f));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.99777106478e-1f));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-3.33329491539e-1f));
+	p = _mm256_mul_ps(p, z);
+	return _mm256_add_ps(offset, _mm256_fmadd_ps(p, x, x));
+}
+
+//--------------------------------------------------
+
+void lens_model_row_avx2(const LensModel& m, int y, int x0, int count, short * xy, ushort * fxy)
+{
+	const double * ir = m.ir;
+	const __m256 ir0 = _mm256_set1_ps((float) ir[0]);
+	const __m256 ir3 = _mm256_set1_ps((float) ir[3]);
+	const __m256 ir6 = _mm256_set1_ps((float) ir[6]);
+	const __m256 rowX = _mm256_set1_ps((float) (y * ir[1] + ir[2]));
+	const __m256 rowY = _mm256_set1_ps((float) (y * ir[4] + ir[5]));
+	const __m256 rowW = _mm256_set1_ps((float) (y * ir[7] + ir[8]));
+
+	__m256 k[12];
+	for ( int i = 0; i < 12; i++ )
+	{
+		k[i] = _mm256_set1_ps((float) m.k[i]);
+	}
+	const __m256 fx = _mm256_set1_ps((float) m.fx);
+	const __m256 fy = _mm256_set1_ps((float) m.fy);
+	const __m256 cx = _mm256_set1_ps((float) m.cx);
+	const __m256 cy = _mm256_set1_ps((float) m.cy);
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 two = _mm256_set1_ps(2.f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 tabSize = _mm256_set1_ps((float) cv::INTER_TAB_SIZE);
+	const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i tabMask = _mm256_set1_epi32(cv::INTER_TAB_SIZE - 1);
+	// (x0 x1 x2 x3 y0 y1 y2 y3) -> (x0 y0 x1 y1 x2 y2 x3 y3) as shorts, in each 128-bit lane
+	const __m256i interleave = _mm256_setr_epi8(
+		0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+		0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+
+	for ( int j = 0; j < count; j += 8 )
+	{
+		const __m256 xs = _mm256_add_ps(_mm256_set1_ps((float) (x0 + j)), lanes);
+		const __m256 _x = _mm256_fmadd_ps(xs, ir0, rowX);
+		const __m256 _y = _mm256_fmadd_ps(xs, ir3, rowY);
+		const __m256 _w = _mm256_fmadd_ps(xs, ir6, rowW);
+		const __m256 px = _mm256_div_ps(_x, _w);
+		const __m256 py = _mm256_div_ps(_y, _w);
+		__m256 u;
+		__m256 v;
+		if ( m.fisheye )
+		{
+			const __m256 r = _mm256_sqrt_ps(_mm256_fmadd_ps(px, px, _mm256_mul_ps(py, py)));
+			const __m256 theta = atan_nonnegative(r);
+			const __m256 theta2 = _mm256_mul_ps(theta, theta);
+			__m256 poly = _mm256_fmadd_ps(k[3], theta2, k[2]);
+			poly = _mm256_fmadd_ps(poly, theta2, k[1]);
+			poly = _mm256_fmadd_ps(poly, theta2, k[0]);
+			poly = _mm256_fmadd_ps(poly, theta2, one);
+			const __m256 theta_d = _mm256_mul_ps(theta, poly);
+			const __m256 scale = _mm256_blendv_ps(one, _mm256_div_ps(theta_d, r), _mm256_cmp_ps(r, zero, _CMP_GT_OQ));
+			u = _mm256_fmadd_ps(_mm256_mul_ps(fx, px), scale, cx);
+			v = _mm256_fmadd_ps(_mm256_mul_ps(fy, py), scale, cy);
+
+			// Rays behind the camera, as in lens_model_row_scalar().
+			const __m256 behind = _mm256_cmp_ps(_w, zero, _CMP_LE_OQ);
+			const __m256 posInf = _mm256_set1_ps(INFINITY);
+			const __m256 negInf = _mm256_set1_ps(-INFINITY);
+			u = _mm256_blendv_ps(u, _mm256_blendv_ps(posInf, negInf, _mm256_cmp_ps(_x, zero, _CMP_GT_OQ)), behind);
+			v = _mm256_blendv_ps(v, _mm256_blendv_ps(posInf, negInf, _mm256_cmp_ps(_y, zero, _CMP_GT_OQ)), behind);
+		}
+		else
+		{
+			const __m256 x2 = _mm256_mul_ps(px, px);
+			const __m256 y2 = _mm256_mul_ps(py, py);
+			const __m256 r2 = _mm256_add_ps(x2, y2);
+			const __m256 r4 = _mm256_mul_ps(r2, r2);
+			const __m256 _2xy = _mm256_mul_ps(two, _mm256_mul_ps(px, py));
+			const __m256 num = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_fmadd_ps(k[4], r2, k[1]), r2, k[0]), r2, one);
+			const __m256 den = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_fmadd_ps(k[7], r2, k[6]), r2, k[5]), r2, one);
+			const __m256 kr = _mm256_div_ps(num, den);
+			__m256 xd = _mm256_fmadd_ps(px, kr, _mm256_mul_ps(k[2], _2xy));
+			xd = _mm256_fmadd_ps(k[3], _mm256_fmadd_ps(two, x2, r2), xd);
+			xd = _mm256_fmadd_ps(k[8], r2, _mm256_fmadd_ps(k[9], r4, xd));
+			__m256 yd = _mm256_fmadd_ps(py, kr, _mm256_mul_ps(k[3], _2xy));
+			yd = _mm256_fmadd_ps(k[2], _mm256_fmadd_ps(two, y2, r2), yd);
+			yd = _mm256_fmadd_ps(k[10], r2, _mm256_fmadd_ps(k[11], r4, yd));
+			u = _mm256_fmadd_ps(fx, xd, cx);
+			v = _mm256_fmadd_ps(fy, yd, cy);
+		}
+
+		// Same fixed-point split as store_fixed_point() in lens_model.cpp, with saturating packs.
+		const __m256i iu = _mm256_cvtps_epi32(_mm256_mul_ps(u, tabSize));
+		const __m256i iv = _mm256_cvtps_epi32(_mm256_mul_ps(v, tabSize));
+		const __m256i ixy = _mm256_shuffle_epi8(
+			_mm256_packs_epi32(_mm256_srai_epi32(iu, cv::INTER_BITS), _mm256_srai_epi32(iv, cv::INTER_BITS)),
+			interleave);
+		const __m256i ifxy = _mm256_or_si256(
+			_mm256_slli_epi32(_mm256_and_si256(iv, tabMask), cv::INTER_BITS),
+			_mm256_and_si256(iu, tabMask));
+		const __m128i ifxy16 = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(ifxy, ifxy), 0x08));
+
+		if ( count - j >= 8 )
+		{
+			_mm256_storeu_si256((__m256i *) (xy + j * 2), ixy);
+			_mm_storeu_si128((__m128i *) (fxy + j), ifxy16);
+		}
+		else
+		{
+			short bufXY[16];
+			ushort bufFXY[8];
+			_mm256_storeu_si256((__m256i *) bufXY, ixy);
+			_mm_storeu_si128((__m128i *) bufFXY, ifxy16);
+			memcpy(xy + j * 2, bufXY, (count - j) * 2 * sizeof(short));
+			memcpy(fxy + j, bufFXY, (count - j) * sizeof(ushort));
+		}
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
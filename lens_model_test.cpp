@@ -0,0 +1,102 @@
+//--------------------------------------------------
+// Checks that generateRemapMaps() stays within CONST_INT__MAP_GENERATOR_TOLERANCE of buildRemapMaps() on
+// the lens profile of a settings file, with the scalar row function and, if the CPU has it, the AVX2
+// one. ctest runs it once per shipped profile:
+//
+//   lens_model_test flatten-settings.xml
+//
+// The exit status is 0 if every map entry is within tolerance, 1 otherwise and 2 on bad arguments.
+//--------------------------------------------------
+
+#include <stdio.h>
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "flattener.hpp"
+#include "lens_model.hpp"
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+
+int main (int argc, char** argv)
+{
+	if ( argc != 2 )
+	{
+		fprintf(stderr, "usage: %s <settings file>\n", argv[0]);
+		return 2;
+	}
+	const std::string settingsPath = argv[1];
+
+	FlattenerOptions options;
+	if ( !readFlattenerOptions(settingsPath, options) )
+	{
+		fprintf(stderr, "Could not open '%s'.\n", settingsPath.c_str());
+		return 2;
+	}
+	const LensProfile& profile = options.profile;
+	LensModel model;
+	if ( !makeLensModel(profile, model) )
+	{
+		fprintf(stderr, "%s: the lens model does not support this profile.\n", settingsPath.c_str());
+		return 1;
+	}
+
+	cv::Mat ref1;
+	cv::Mat ref2;
+	buildRemapMaps(profile, ref1, ref2);
+
+	std::string widest;
+	lens_model_row_func(widest);
+	const struct
+	{
+		const char * name;
+		LensRowFunc row;
+	}
+	rowFuncs[] =
+	{
+		{ "scalar", lens_model_row_scalar },
+		{ "avx2",   lens_model_row_avx2   }
+	};
+
+	int failures = 0;
+	for ( size_t i = 0; i < sizeof(rowFuncs) / sizeof(rowFuncs[0]); i++ )
+	{
+		if ( std::string(rowFuncs[i].name) != "scalar" && widest != rowFuncs[i].name )
+		{
+			printf("%s: %s is not supported by this CPU; skipped.\n", settingsPath.c_str(), rowFuncs[i].name);
+			continue;
+		}
+		cv::Mat map1;
+		cv::Mat map2;
+		generateRemapMaps(model, profile.finalSize, map1, map2, rowFuncs[i].row);
+		size_t mismatches = 0;
+		int maxDifference = 0;
+		compareRemapMaps(map1, map2, ref1, ref2, mismatches, maxDifference);
+		printf("%s, %s: %zu of %d entries differ, max difference %d/%d px\n", settingsPath.c_str(),
+			rowFuncs[i].name, mismatches, profile.finalSize.area(), maxDifference, cv::INTER_TAB_SIZE);
+		if ( maxDifference > CONST_INT__MAP_GENERATOR_TOLERANCE )
+		{
+			failures++;
+		}
+	}
+
+	// A camera matrix with skew must be refused, so that the callers fall back to OpenCV.
+	LensProfile skewed = profile;
+	skewed.cameraMatrix = profile.cameraMatrix.clone();
+	skewed.cameraMatrix.convertTo(skewed.cameraMatrix, CV_64F);
+	skewed.cameraMatrix.at<double>(0, 1) = 0.5;
+	if ( makeLensModel(skewed, model) )
+	{
+		printf("%s: a camera matrix with skew was accepted.\n", settingsPath.c_str());
+		failures++;
+	}
+
+	printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,286 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "map_cache.hpp"
+
+//--------------------------------------------------
+
+#define CONST_STRING__MAP_CACHE_MAGIC     "FLATMAP"
+#define CONST_INT__MAP_CACHE_VERSION      1
+#define CONST_INT__MAP_CACHE_ALIGNMENT    4096
+
+//--------------------------------------------------
+// File layout:
+//
+//   header | key bytes | padding | map1 data | padding | map2 data
+//
+// Both maps start on a page boundary and are stored without row padding.
+//--------------------------------------------------
+
+struct MapCacheHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t keySize;
+	uint64_t keyHash;
+	int32_t  rows;
+	int32_t  cols;
+	int32_t  map1Type;
+	int32_t  map2Type;
+	uint64_t map1Offset;
+	uint64_t map2Offset;
+	uint64_t fileSize;
+};
+
+//--------------------------------------------------
+
+static uint64_t align_up(uint64_t value)
+{
+	return (value + CONST_INT__MAP_CACHE_ALIGNMENT - 1) & ~((uint64_t) CONST_INT__MAP_CACHE_ALIGNMENT - 1);
+}
+
+//--------------------------------------------------
+
+static void append_bytes(std::string& dst, const void * src, size_t len)
+{
+	dst.append((const char *) src, len);
+}
+
+//--------------------------------------------------
+
+static void append_matrix(std::string& dst, const cv::Mat& m)
+{
+	cv::Mat m64;
+	m.convertTo(m64, CV_64F);
+	int32_t dims[2] = { m64.rows, m64.cols };
+	append_bytes(dst, dims, sizeof(dims));
+	for ( int r = 0; r < m64.rows; ++r )
+	{
+		append_bytes(dst, m64.ptr<double>(r), m64.cols * sizeof(double));
+	}
+}
+
+//--------------------------------------------------
+
+static bool write_fully(int fd, const void * buf, size_t len)
+{
+	const char * p = (const char *) buf;
+	while ( len > 0 )
+	{
+		ssize_t n = ::write(fd, p, len);
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+			return false;
+		}
+		p += n;
+		len -= (size_t) n;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+MapCache::MapCache() : mappedAddress(NULL), mappedLength(0) {}
+
+MapCache::~MapCache()
+{
+	close();
+}
+
+//--------------------------------------------------
+
+std::string MapCache::makeKey(
+	const cv::Mat& cameraMatrix,
+	const cv::Mat& distortionCoefficients,
+	bool useFisheye,
+	const cv::Size& originalSize,
+	const cv::Size& intermedSize,
+	const cv::Size& finalSize)
+{
+	std::string key;
+	int32_t header[8] = {
+		(int32_t) useFisheye,
+		originalSize.width, originalSize.height,
+		intermedSize.width, intermedSize.height,
+		finalSize.width, finalSize.height,
+		CONST_INT__MAP_CACHE_VERSION };
+	append_bytes(key, header, sizeof(header));
+	append_matrix(key, cameraMatrix);
+	append_matrix(key, distortionCoefficients);
+	return key;
+}
+
+//--------------------------------------------------
+
+uint64_t MapCache::hashKey(const std::string& key)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for ( size_t i = 0; i < key.size(); ++i )
+	{
+		h ^= (uint64_t) (unsigned char) key[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+//--------------------------------------------------
+
+std::string MapCache::makePath(const std::string& directory, const std::string& key)
+{
+	char sbuf_name[64];
+	snprintf(sbuf_name, sizeof(sbuf_name), "flatten-map-%016llx.bin", (unsigned long long) hashKey(key));
+	if ( directory.empty() || directory[directory.size() - 1] == '/' )
+	{
+		return directory + sbuf_name;
+	}
+	return directory + "/" + sbuf_name;
+}
+
+//--------------------------------------------------
+
+bool MapCache::open(const std::string& path, const std::string& key)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 )
+	{
+		return false;
+	}
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(MapCacheHeader) )
+	{
+		::close(fd);
+		return false;
+	}
+	void * addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if ( addr == MAP_FAILED )
+	{
+		return false;
+	}
+	mappedAddress = addr;
+	mappedLength = (size_t) st.st_size;
+
+	// Kernels with transparent huge pages for read-only file mappings can then back the maps with
+	// 2 MB pages; elsewhere the advice is refused, which is harmless.
+	madvise(addr, mappedLength, MADV_HUGEPAGE);
+
+	const MapCacheHeader * h = (const MapCacheHeader *) addr;
+	const char * base = (const char *) addr;
+	bool valid =
+		memcmp(h->magic, CONST_STRING__MAP_CACHE_MAGIC, sizeof(h->magic)) == 0 &&
+		h->version == CONST_INT__MAP_CACHE_VERSION &&
+		h->fileSize == (uint64_t) mappedLength &&
+		h->keyHash == hashKey(key) &&
+		h->keySize == key.size() &&
+		sizeof(MapCacheHeader) + key.size() <= mappedLength &&
+		memcmp(base + sizeof(MapCacheHeader), key.data(), key.size()) == 0 &&
+		h->map1Type == CV_16SC2 &&
+		h->map2Type == CV_16UC1 &&
+		h->rows > 0 && h->cols > 0 &&
+		h->map1Offset + (uint64_t) h->rows * h->cols * 2 * sizeof(short) <= mappedLength &&
+		h->map2Offset + (uint64_t) h->rows * h->cols * sizeof(ushort) <= mappedLength;
+	if ( !valid )
+	{
+		close();
+		return false;
+	}
+
+	// cv::remap() only reads the maps, so handing it headers over the read-only mapping is safe.
+	map1 = cv::Mat(h->rows, h->cols, CV_16SC2, (void *) (base + h->map1Offset));
+	map2 = cv::Mat(h->rows, h->cols, CV_16UC1, (void *) (base + h->map2Offset));
+	return true;
+}
+
+//--------------------------------------------------
+
+bool MapCache::store(const std::string& path, const std::string& key, const cv::Mat& map1, const cv::Mat& map2)
+{
+	if ( map1.type() != CV_16SC2 || map2.type() != CV_16UC1 ||
+		map1.rows != map2.rows || map1.cols != map2.cols )
+	{
+		return false;
+	}
+
+	MapCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CONST_STRING__MAP_CACHE_MAGIC, sizeof(h.magic));
+	h.version = CONST_INT__MAP_CACHE_VERSION;
+	h.keySize = (uint32_t) key.size();
+	h.keyHash = hashKey(key);
+	h.rows = map1.rows;
+	h.cols = map1.cols;
+	h.map1Type = CV_16SC2;
+	h.map2Type = CV_16UC1;
+	const size_t map1RowBytes = (size_t) map1.cols * 2 * sizeof(short);
+	const size_t map2RowBytes = (size_t) map2.cols * sizeof(ushort);
+	h.map1Offset = align_up(sizeof(MapCacheHeader) + key.size());
+	h.map2Offset = align_up(h.map1Offset + map1RowBytes * map1.rows);
+	h.fileSize = h.map2Offset + map2RowBytes * map2.rows;
+
+	char sbuf_suffix[32];
+	snprintf(sbuf_suffix, sizeof(sbuf_suffix), ".tmp.%ld", (long) getpid());
+	std::string tmpPath = path + sbuf_suffix;
+
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ( fd < 0 )
+	{
+		return false;
+	}
+
+	static const char zeros[CONST_INT__MAP_CACHE_ALIGNMENT] = { 0 };
+	bool ok =
+		write_fully(fd, &h, sizeof(h)) &&
+		write_fully(fd, key.data(), key.size()) &&
+		write_fully(fd, zeros, h.map1Offset - sizeof(h) - key.size());
+	for ( int r = 0; ok && r < map1.rows; ++r )
+	{
+		ok = write_fully(fd, map1.ptr(r), map1RowBytes);
+	}
+	ok = ok && write_fully(fd, zeros, h.map2Offset - h.map1Offset - map1RowBytes * map1.rows);
+	for ( int r = 0; ok && r < map2.rows; ++r )
+	{
+		ok = write_fully(fd, map2.ptr(r), map2RowBytes);
+	}
+	ok = (::close(fd) == 0) && ok;
+
+	if ( !ok || rename(tmpPath.c_str(), path.c_str()) != 0 )
+	{
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+void MapCache::close()
+{
+	map1.release();
+	map2.release();
+	if ( mappedAddress != NULL )
+	{
+		munmap(mappedAddress, mappedLength);
+		mappedAddress = NULL;
+		mappedLength = 0;
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
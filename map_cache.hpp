@@ -0,0 +1,76 @@
+#ifndef FLATTEN_MAP_CACHE_HPP
+#define FLATTEN_MAP_CACHE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+//--------------------------------------------------
+// Persistent on-disk cache for the CV_16SC2 remap map and its CV_16UC1 interpolation table.
+//
+// A cache file is keyed by a hash of everything that determines the maps (camera matrix,
+// distortion coefficients, lens model and the three image sizes). Opening a cache file maps it
+// read-only into memory, so map1/map2 become plain cv::Mat headers over the page cache and
+// every concurrent flatten process with the same lens profile shares a single copy.
+//--------------------------------------------------
+
+class MapCache
+{
+public:
+	MapCache();
+	~MapCache();
+
+	//--------------------------------------------------
+
+	// Serializes the inputs of the map computation into a byte string. Two profiles produce the
+	// same key if and only if they produce the same maps.
+	static std::string makeKey(
+		const cv::Mat& cameraMatrix,
+		const cv::Mat& distortionCoefficients,
+		bool useFisheye,
+		const cv::Size& originalSize,
+		const cv::Size& intermedSize,
+		const cv::Size& finalSize);
+
+	// 64-bit FNV-1a hash of the key, used to name the cache file.
+	static uint64_t hashKey(const std::string& key);
+
+	// "<directory>/flatten-map-<hash>.bin"
+	static std::string makePath(const std::string& directory, const std::string& key);
+
+	//--------------------------------------------------
+
+	// Maps the cache file read-only and points map1/map2 at its contents.
+	// Returns false if the file does not exist or does not match the key.
+	bool open(const std::string& path, const std::string& key);
+
+	// Writes the maps to a temporary file and renames it into place, so a reader never sees a
+	// partially written cache file even when several processes populate the cache at once.
+	static bool store(const std::string& path, const std::string& key, const cv::Mat& map1, const cv::Mat& map2);
+
+	void close();
+
+	//--------------------------------------------------
+
+public:
+
+	cv::Mat map1; // CV_16SC2, points into the mapping
+	cv::Mat map2; // CV_16UC1, points into the mapping
+
+private:
+	MapCache(const MapCache&);
+	MapCache& operator=(const MapCache&);
+
+	void * mappedAddress;
+	size_t mappedLength;
+
+};
+
+#endif // FLATTEN_MAP_CACHE_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include <string>
+
+#include "perf_counters.hpp"
+
+//--------------------------------------------------
+
+const char * perfEventName(PerfEvent event)
+{
+	switch ( event )
+	{
+		case PERF_EVENT_CYCLES:       return "cycles";
+		case PERF_EVENT_INSTRUCTIONS: return "instructions";
+		case PERF_EVENT_LLC_MISSES:   return "llc_misses";
+		case PERF_EVENT_DTLB_MISSES:  return "dtlb_misses";
+		case NUM_PERF_EVENTS:         break;
+	}
+	return "unknown";
+}
+
+//--------------------------------------------------
+// The counters of one thread, opened the first time the thread takes a sample and closed when it exits.
+//--------------------------------------------------
+
+class ThreadPerfCounters
+{
+public:
+	ThreadPerfCounters() : available(0)
+	{
+		for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+		{
+			fd[i] = openCounter((PerfEvent) i);
+			if ( fd[i] >= 0 )
+			{
+				available |= 1u << i;
+			}
+		}
+	}
+
+	~ThreadPerfCounters()
+	{
+		for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+		{
+			if ( fd[i] >= 0 )
+			{
+				::close(fd[i]);
+			}
+		}
+	}
+
+	// With the time each event was enabled and the part of it that it was actually counting, in ns.
+	void read(PerfCounts& counts, uint64_t enabled[NUM_PERF_EVENTS], uint64_t running[NUM_PERF_EVENTS]) const
+	{
+		counts.available = available;
+		for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+		{
+			// The layout of PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING.
+			uint64_t v[3] = { 0, 0, 0 };
+			if ( fd[i] >= 0 && ::read(fd[i], v, sizeof(v)) != (ssize_t) sizeof(v) )
+			{
+				counts.available &= ~(1u << i);
+			}
+			counts.value[i] = v[0];
+			enabled[i] = v[1];
+			running[i] = v[2];
+		}
+	}
+
+	unsigned available;
+	std::string problem;   // why the first counter that failed could not be opened
+
+	//--------------------------------------------------
+
+private:
+	int openCounter(PerfEvent event)
+	{
+#ifdef __linux__
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		switch ( event )
+		{
+			case PERF_EVENT_CYCLES:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case PERF_EVENT_INSTRUCTIONS:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case PERF_EVENT_LLC_MISSES:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+				break;
+			case PERF_EVENT_DTLB_MISSES:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+				break;
+			case NUM_PERF_EVENTS:
+				return -1;
+		}
+		// User space only, which perf_event_paranoid up to 2 allows without privileges.
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		const int fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		if ( fd < 0 && problem.empty() )
+		{
+			const int err = errno;
+			problem = std::string(perfEventName(event)) + ": " + strerror(err);
+			if ( err == EACCES || err == EPERM )
+			{
+				problem += " (see /proc/sys/kernel/perf_event_paranoid)";
+			}
+			else if ( err == ENOENT || err == EOPNOTSUPP )
+			{
+				problem += " (event not supported by this CPU or hypervisor)";
+			}
+		}
+		return fd;
+#else
+		if ( problem.empty() )
+		{
+			problem = "perf_event_open() is only available on Linux";
+		}
+		return -1;
+#endif
+	}
+
+	int fd[NUM_PERF_EVENTS];
+
+};
+
+//--------------------------------------------------
+
+static ThreadPerfCounters& thread_perf_counters()
+{
+	thread_local ThreadPerfCounters counters;
+	return counters;
+}
+
+//--------------------------------------------------
+
+unsigned perfCountersProbe(std::string& problem)
+{
+	const ThreadPerfCounters& counters = thread_perf_counters();
+	problem = counters.problem;
+	return counters.available;
+}
+
+//--------------------------------------------------
+
+PerfAccumulator::PerfAccumulator() : available(0), multiplexed(0)
+{
+	for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+	{
+		value[i] = 0;
+	}
+}
+
+//--------------------------------------------------
+
+void PerfAccumulator::add(const PerfCounts& delta)
+{
+	for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+	{
+		if ( delta.has((PerfEvent) i) )
+		{
+			value[i] += delta.value[i];
+		}
+	}
+	available |= delta.available;
+	multiplexed |= delta.multiplexed & delta.available;
+}
+
+//--------------------------------------------------
+
+PerfCounts PerfAccumulator::total() const
+{
+	PerfCounts counts;
+	for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+	{
+		counts.value[i] = value[i];
+	}
+	counts.available = available;
+	counts.multiplexed = multiplexed;
+	return counts;
+}
+
+//--------------------------------------------------
+
+ScopedPerfSample::ScopedPerfSample(PerfAccumulator * accumulator) : accumulator(accumulator)
+{
+	if ( accumulator != NULL )
+	{
+		thread_perf_counters().read(start, startEnabled, startRunning);
+	}
+}
+
+//--------------------------------------------------
+
+ScopedPerfSample::~ScopedPerfSample()
+{
+	if ( accumulator == NULL )
+	{
+		return;
+	}
+	PerfCounts delta;
+	uint64_t enabled[NUM_PERF_EVENTS];
+	uint64_t running[NUM_PERF_EVENTS];
+	thread_perf_counters().read(delta, enabled, running);
+	delta.available &= start.available;
+	for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+	{
+		delta.value[i] -= start.value[i];
+		const uint64_t enabledNs = enabled[i] - startEnabled[i];
+		const uint64_t runningNs = running[i] - startRunning[i];
+		if ( runningNs >= enabledNs )
+		{
+			continue;
+		}
+		// Multiplexed with other events: scale up to the whole time, or drop an event that never ran.
+		if ( runningNs == 0 )
+		{
+			delta.available &= ~(1u << i);
+			continue;
+		}
+		delta.value[i] = (uint64_t) ((double) delta.value[i] * enabledNs / runningNs + 0.5);
+		delta.multiplexed |= 1u << i;
+	}
+	accumulator->add(delta);
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,105 @@
+#ifndef FLATTEN_PERF_COUNTERS_HPP
+#define FLATTEN_PERF_COUNTERS_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+//--------------------------------------------------
+// Hardware event counters through perf_event_open(2).
+//
+// The counters of a thread only see that thread, and a frame is remapped by several threads at once.
+// So every thread that does remap work opens its own counters on first use, and each stripe or tile
+// adds what its thread counted to a PerfAccumulator shared by everybody working on the same frames.
+// Decode and encode threads never touch it, so their work is not attributed to the remap.
+//
+// Counters that cannot be opened (no PMU in a VM, perf_event_paranoid too high, an event the CPU
+// does not have) are simply left out; perfCountersProbe() tells which ones work and why not. When there
+// are more events than hardware counters, the kernel multiplexes them and each one only runs part of the
+// time; such counts are scaled up to the whole time and flagged as multiplexed.
+//--------------------------------------------------
+
+enum PerfEvent
+{
+	PERF_EVENT_CYCLES,
+	PERF_EVENT_INSTRUCTIONS,
+	PERF_EVENT_LLC_MISSES,
+	PERF_EVENT_DTLB_MISSES,
+	NUM_PERF_EVENTS
+};
+
+const char * perfEventName(PerfEvent event);
+
+// Opens the counters on the calling thread. Returns a bit mask of the events that can be counted and
+// a description of the first failure, if any.
+unsigned perfCountersProbe(std::string& problem);
+
+//--------------------------------------------------
+
+struct PerfCounts
+{
+	uint64_t value[NUM_PERF_EVENTS];
+	unsigned available;      // bit mask of PerfEvent
+	unsigned multiplexed;    // bit mask of PerfEvent: scaled up from the part of the time it was counted
+
+	PerfCounts() : available(0), multiplexed(0)
+	{
+		for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+		{
+			value[i] = 0;
+		}
+	}
+
+	bool has(PerfEvent event) const { return (available & (1u << event)) != 0; }
+	bool isScaled(PerfEvent event) const { return (multiplexed & (1u << event)) != 0; }
+};
+
+//--------------------------------------------------
+
+class PerfAccumulator
+{
+public:
+	PerfAccumulator();
+
+	void add(const PerfCounts& delta);
+	PerfCounts total() const;
+
+private:
+	PerfAccumulator(const PerfAccumulator&);
+	PerfAccumulator& operator=(const PerfAccumulator&);
+
+	std::atomic<uint64_t> value[NUM_PERF_EVENTS];
+	std::atomic<unsigned> available;
+	std::atomic<unsigned> multiplexed;
+
+};
+
+//--------------------------------------------------
+// Adds the events counted by the calling thread during the enclosing scope to an accumulator.
+// Does nothing when the accumulator is NULL.
+//--------------------------------------------------
+
+class ScopedPerfSample
+{
+public:
+	explicit ScopedPerfSample(PerfAccumulator * accumulator);
+	~ScopedPerfSample();
+
+private:
+	ScopedPerfSample(const ScopedPerfSample&);
+	ScopedPerfSample& operator=(const ScopedPerfSample&);
+
+	PerfAccumulator * accumulator;
+	PerfCounts start;
+	uint64_t startEnabled[NUM_PERF_EVENTS];  // time the event was enabled and running, in ns
+	uint64_t startRunning[NUM_PERF_EVENTS];
+
+};
+
+#endif // FLATTEN_PERF_COUNTERS_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
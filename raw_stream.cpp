@@ -0,0 +1,323 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "raw_stream.hpp"
+
+//--------------------------------------------------
+
+#define CONST_INT__RAW_STREAM_BUFFER_BYTES    (1024 * 1024)
+#define CONST_INT__RAW_STREAM_PIPE_BYTES      (1024 * 1024)
+#define CONST_INT__RAW_STREAM_MAX_LINE        4096
+#define CONST_STRING__Y4M_MAGIC               "YUV4MPEG2"
+
+//--------------------------------------------------
+// A pipe holds 64 KB by default, so a 4K frame would take hundreds of context switches between the
+// processes on both ends. Fails harmlessly if fd is not a pipe or the size exceeds pipe-max-size.
+//--------------------------------------------------
+
+static void enlarge_pipe(int fd)
+{
+#ifdef F_SETPIPE_SZ
+	fcntl(fd, F_SETPIPE_SZ, CONST_INT__RAW_STREAM_PIPE_BYTES);
+#else
+	(void) fd;
+#endif
+}
+
+//--------------------------------------------------
+
+bool parseRawFormat(const std::string& name, RawFormat& format)
+{
+	if ( name == "bgr24" )
+	{
+		format = RAW_BGR24;
+		return true;
+	}
+	if ( name == "bgr48le" )
+	{
+		format = RAW_BGR48;
+		return true;
+	}
+	if ( name == "y4m" )
+	{
+		format = RAW_Y4M;
+		return true;
+	}
+	return false;
+}
+
+//--------------------------------------------------
+
+RawFrameReader::RawFrameReader()
+	: fd(-1), format(RAW_BGR24), siting(CHROMA_SITING_CENTER), begin(0), end(0)
+{
+}
+
+//--------------------------------------------------
+
+bool RawFrameReader::open(int fd, RawFormat format, const cv::Size& size, std::string& problem)
+{
+	this->fd = fd;
+	this->format = format;
+	this->size = size;
+	tags.clear();
+	siting = CHROMA_SITING_CENTER;
+	buffer.resize(CONST_INT__RAW_STREAM_BUFFER_BYTES);
+	begin = end = 0;
+	enlarge_pipe(fd);
+	if ( format != RAW_Y4M )
+	{
+		return true;
+	}
+
+	std::string header;
+	if ( !readLine(header) || header.compare(0, strlen(CONST_STRING__Y4M_MAGIC), CONST_STRING__Y4M_MAGIC) != 0 )
+	{
+		problem = "the input is not a YUV4MPEG2 stream";
+		return false;
+	}
+	std::istringstream fields(header.substr(strlen(CONST_STRING__Y4M_MAGIC)));
+	std::string field;
+	cv::Size streamSize;
+	std::string chroma = "420jpeg"; // the default of the format
+	while ( fields >> field )
+	{
+		const char tag = field[0];
+		const std::string value = field.substr(1);
+		if ( tag == 'W' )
+		{
+			streamSize.width = atoi(value.c_str());
+		}
+		else if ( tag == 'H' )
+		{
+			streamSize.height = atoi(value.c_str());
+		}
+		else
+		{
+			if ( tag == 'C' )
+			{
+				chroma = value;
+			}
+			tags += " " + field;
+		}
+	}
+	if ( chroma == "420jpeg" || chroma == "420" )
+	{
+		siting = CHROMA_SITING_CENTER;
+	}
+	else if ( chroma == "420mpeg2" )
+	{
+		siting = CHROMA_SITING_LEFT;
+	}
+	else if ( chroma == "420paldv" )
+	{
+		siting = CHROMA_SITING_TOP_LEFT;
+	}
+	else
+	{
+		problem = "the YUV4MPEG2 stream has chroma '" + chroma + "'; only 8-bit 4:2:0 (420jpeg, 420mpeg2 or 420paldv) is supported";
+		return false;
+	}
+	if ( streamSize != size )
+	{
+		problem = cv::format("the YUV4MPEG2 stream is %d x %d, the settings expect %d x %d",
+			streamSize.width, streamSize.height, size.width, size.height);
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+bool RawFrameReader::fill()
+{
+	if ( begin == end )
+	{
+		begin = end = 0;
+	}
+	else if ( end == buffer.size() )
+	{
+		memmove(&buffer[0], &buffer[begin], end - begin);
+		end -= begin;
+		begin = 0;
+	}
+	for(;;)
+	{
+		const ssize_t n = ::read(fd, &buffer[end], buffer.size() - end);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			return false;
+		}
+		end += (size_t) n;
+		return true;
+	}
+}
+
+//--------------------------------------------------
+
+bool RawFrameReader::readLine(std::string& line)
+{
+	line.clear();
+	for(;;)
+	{
+		const uchar * start = &buffer[0] + begin;
+		const uchar * newline = (const uchar *) memchr(start, '\n', end - begin);
+		if ( newline != NULL )
+		{
+			line.append((const char *) start, (size_t) (newline - start));
+			begin += (size_t) (newline - start) + 1;
+			return true;
+		}
+		line.append((const char *) start, end - begin);
+		begin = end;
+		if ( line.size() > CONST_INT__RAW_STREAM_MAX_LINE || !fill() )
+		{
+			return false;
+		}
+	}
+}
+
+//--------------------------------------------------
+
+bool RawFrameReader::readFully(uchar * dst, size_t bytes)
+{
+	const size_t buffered = std::min(bytes, end - begin);
+	memcpy(dst, &buffer[0] + begin, buffered);
+	begin += buffered;
+	size_t done = buffered;
+	while ( done < bytes )
+	{
+		const ssize_t n = ::read(fd, dst + done, bytes - done);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			return false;
+		}
+		done += (size_t) n;
+	}
+	return true;
+}
+
+//--------------------------------------------------
+
+bool RawFrameReader::read(cv::Mat& frame)
+{
+	if ( format == RAW_Y4M )
+	{
+		std::string line;
+		if ( !readLine(line) || line.compare(0, 5, "FRAME") != 0 )
+		{
+			return false;
+		}
+		frame.create(size.height * 3 / 2, size.width, CV_8UC1);
+	}
+	else
+	{
+		frame.create(size, format == RAW_BGR48 ? CV_16UC3 : CV_8UC3);
+	}
+	return readFully(frame.data, frame.total() * frame.elemSize());
+}
+
+//--------------------------------------------------
+
+RawFrameWriter::RawFrameWriter()
+	: fd(-1), format(RAW_BGR24)
+{
+}
+
+//--------------------------------------------------
+
+void RawFrameWriter::open(int fd, RawFormat format, const cv::Size& size, const std::string& tags)
+{
+	this->fd = fd;
+	this->format = format;
+	this->size = size;
+	streamHeader.clear();
+	if ( format == RAW_Y4M )
+	{
+		streamHeader = cv::format(CONST_STRING__Y4M_MAGIC " W%d H%d", size.width, size.height) + tags + "\n";
+	}
+	enlarge_pipe(fd);
+}
+
+//--------------------------------------------------
+
+bool RawFrameWriter::write(const cv::Mat& frame)
+{
+	const bool fits = format == RAW_Y4M
+		? frame.type() == CV_8UC1 && frame.cols == size.width && frame.rows == size.height * 3 / 2
+		: frame.type() == (format == RAW_BGR48 ? CV_16UC3 : CV_8UC3) && frame.size() == size;
+	if ( !fits )
+	{
+		return false;
+	}
+	std::string header;
+	header.swap(streamHeader);
+	if ( format == RAW_Y4M )
+	{
+		header += "FRAME\n";
+	}
+	return writeFully(header, frame.isContinuous() ? frame : frame.clone());
+}
+
+//--------------------------------------------------
+// The frame header and the frame in one writev(), continued after partial writes.
+//--------------------------------------------------
+
+bool RawFrameWriter::writeFully(const std::string& header, const cv::Mat& frame)
+{
+	struct iovec iov[2];
+	iov[0].iov_base = (void *) header.data();
+	iov[0].iov_len = header.size();
+	iov[1].iov_base = (void *) frame.data;
+	iov[1].iov_len = frame.total() * frame.elemSize();
+	struct iovec * next = header.empty() ? iov + 1 : iov;
+	int count = header.empty() ? 1 : 2;
+	while ( count > 0 )
+	{
+		const ssize_t n = writev(fd, next, count);
+		if ( n < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( n <= 0 )
+		{
+			return false;
+		}
+		size_t written = (size_t) n;
+		while ( count > 0 && written >= next->iov_len )
+		{
+			written -= next->iov_len;
+			++next;
+			--count;
+		}
+		if ( count > 0 )
+		{
+			next->iov_base = (uchar *) next->iov_base + written;
+			next->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,110 @@
+#ifndef FLATTEN_RAW_STREAM_HPP
+#define FLATTEN_RAW_STREAM_HPP
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+// Uncompressed frames over a pipe, so flatten can sit between two ffmpeg processes without an
+// intermediate file or an extra lossy encode:
+//
+//   ffmpeg -i in.MP4 -f rawvideo -pix_fmt bgr24 - | flatten s.xml | ffmpeg -f rawvideo -pix_fmt bgr24 -s 3840x2160 -i - ...
+//   ffmpeg -i in.MP4 -f yuv4mpegpipe - | flatten s.xml | ffmpeg -f yuv4mpegpipe -i - ...
+//
+// "bgr24" is a headerless sequence of frames of a size known in advance; "bgr48le" the same with 16 bits
+// per channel, little-endian, which is the byte order of the host on the CPUs flatten runs on. "y4m" is
+// YUV4MPEG2 with 4:2:0 chroma: a stream header with the size, then one "FRAME" line per frame followed
+// by the Y, U and V planes. Frames are read and written as a whole with few, large system calls: the
+// reader copies only what it has already buffered and reads the rest directly into the frame, and the
+// pipe buffers are enlarged when the descriptors are pipes.
+//--------------------------------------------------
+
+enum RawFormat
+{
+	RAW_BGR24,
+	RAW_BGR48,
+	RAW_Y4M
+};
+
+// "bgr24", "bgr48le" or "y4m"; returns false for anything else.
+bool parseRawFormat(const std::string& name, RawFormat& format);
+
+//--------------------------------------------------
+
+class RawFrameReader
+{
+public:
+	RawFrameReader();
+
+	//--------------------------------------------------
+
+	// For y4m, reads the stream header and checks that the frames are of the given size and 8-bit 4:2:0
+	// with one of the chroma sitings "420jpeg" (or "420"), "420mpeg2" or "420paldv".
+	// Returns false, with the reason in problem, if they are not.
+	bool open(int fd, RawFormat format, const cv::Size& size, std::string& problem);
+
+	// bgr24: a CV_8UC3 frame. bgr48le: a CV_16UC3 frame. y4m: a CV_8UC1 I420 frame (the Y plane, then U and V, height * 3 / 2 rows).
+	// Returns false at the end of the stream or on a truncated frame.
+	bool read(cv::Mat& frame);
+
+	// Frame rate, interlacing, aspect and chroma tags of the y4m stream header, for the output header.
+	const std::string& streamTags() const { return tags; }
+
+	// Of the y4m frames; see processI420().
+	ChromaSiting chromaSiting() const { return siting; }
+
+	//--------------------------------------------------
+
+private:
+	bool fill();
+	bool readLine(std::string& line);
+	bool readFully(uchar * dst, size_t bytes);
+
+	int fd;
+	RawFormat format;
+	cv::Size size;
+	std::string tags;
+	ChromaSiting siting;
+	std::vector<uchar> buffer;
+	size_t begin;   // unread bytes are buffer[begin, end)
+	size_t end;
+};
+
+//--------------------------------------------------
+
+class RawFrameWriter
+{
+public:
+	RawFrameWriter();
+
+	//--------------------------------------------------
+
+	// tags: from RawFrameReader::streamTags(), for y4m.
+	void open(int fd, RawFormat format, const cv::Size& size, const std::string& tags);
+
+	// Takes frames as RawFrameReader::read() returns them, of the size given to open().
+	// Returns false if the pipe is closed or the frame does not fit.
+	bool write(const cv::Mat& frame);
+
+	//--------------------------------------------------
+
+private:
+	bool writeFully(const std::string& header, const cv::Mat& frame);
+
+	int fd;
+	RawFormat format;
+	cv::Size size;
+	std::string streamHeader; // written before the first frame
+};
+
+#endif // FLATTEN_RAW_STREAM_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,197 @@
+//--------------------------------------------------
+// Checks that the chroma planes of y4m frames are flattened for the chroma siting of their stream tag.
+//
+// A smooth 4:4:4 YUV frame of the input size of the settings is subsampled to 4:2:0 as the tag says the
+// chroma samples sit, written as a YUV4MPEG2 stream and read back with RawFrameReader. Its planes are
+// flattened with Flattener::processI420(). The reference is the 4:4:4 frame flattened as a 3-channel
+// frame, subsampled the same way afterwards. With the siting of the tag the two agree to rounding; with
+// the wrong siting, the chroma is off by a quarter of a chroma sample, which the test must be able to
+// tell apart. ctest runs it once per accepted tag:
+//
+//   raw_stream_test flatten-settings.xml 420mpeg2
+//
+// The exit status is 0 if the chroma planes match, 1 if they do not and 2 on bad arguments.
+//--------------------------------------------------
+
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "flattener.hpp"
+#include "raw_stream.hpp"
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+
+// Mean absolute difference allowed between the flattened and the reference chroma planes
+#define CONST_DOUBLE__CHROMA_TOLERANCE  1.5
+// Chroma samples left out along the edges, where the remap reaches the border of the source frame
+#define CONST_INT__CHROMA_MARGIN        16
+
+//--------------------------------------------------
+// The chroma plane of a 4:4:4 plane: each sample is the mean of the pixels it sits between.
+//--------------------------------------------------
+
+static cv::Mat subsample(const cv::Mat& plane, ChromaSiting siting)
+{
+	const int columns = siting == CHROMA_SITING_CENTER ? 2 : 1;
+	const int rows = siting == CHROMA_SITING_TOP_LEFT ? 1 : 2;
+	cv::Mat chroma(plane.rows / 2, plane.cols / 2, CV_8UC1);
+	for ( int y = 0; y < chroma.rows; y++ )
+	{
+		for ( int x = 0; x < chroma.cols; x++ )
+		{
+			int sum = 0;
+			for ( int r = 0; r < rows; r++ )
+			{
+				for ( int c = 0; c < columns; c++ )
+				{
+					sum += plane.at<uchar>(2 * y + r, 2 * x + c);
+				}
+			}
+			chroma.at<uchar>(y, x) = (uchar) ((sum + columns * rows / 2) / (columns * rows));
+		}
+	}
+	return chroma;
+}
+
+//--------------------------------------------------
+
+static double chromaError(const cv::Mat& i420, const cv::Size& size, const cv::Mat refUV[2])
+{
+	const cv::Size chromaSize(size.width / 2, size.height / 2);
+	const cv::Rect inner(CONST_INT__CHROMA_MARGIN, CONST_INT__CHROMA_MARGIN,
+		chromaSize.width - 2 * CONST_INT__CHROMA_MARGIN, chromaSize.height - 2 * CONST_INT__CHROMA_MARGIN);
+	double error = 0;
+	for ( int k = 0; k < 2; k++ )
+	{
+		const cv::Mat plane(chromaSize, CV_8UC1, i420.data + size.area() + k * chromaSize.area());
+		cv::Mat diff;
+		cv::absdiff(plane(inner), refUV[k](inner), diff);
+		error = std::max(error, cv::mean(diff)[0]);
+	}
+	return error;
+}
+
+//--------------------------------------------------
+
+int main (int argc, char** argv)
+{
+	if ( argc != 3 )
+	{
+		fprintf(stderr, "usage: %s <settings file> <y4m chroma tag>\n", argv[0]);
+		return 2;
+	}
+	const std::string settingsPath = argv[1];
+	const std::string tag = argv[2];
+
+	FlattenerOptions options;
+	if ( !readFlattenerOptions(settingsPath, options) )
+	{
+		fprintf(stderr, "Could not open '%s'.\n", settingsPath.c_str());
+		return 2;
+	}
+	Flattener flattener;
+	std::string problem;
+	if ( !flattener.init(options, problem) )
+	{
+		fprintf(stderr, "%s: %s\n", settingsPath.c_str(), problem.c_str());
+		return 2;
+	}
+	const cv::Size inSize = options.profile.originalSize;
+	const cv::Size outSize = flattener.outputSize();
+
+	// Smooth 4:4:4 planes, with enough chroma detail that a shift of half a luma pixel shows.
+	cv::Mat yuv(inSize, CV_8UC3);
+	for ( int y = 0; y < inSize.height; y++ )
+	{
+		for ( int x = 0; x < inSize.width; x++ )
+		{
+			cv::Vec3b& p = yuv.at<cv::Vec3b>(y, x);
+			p[0] = cv::saturate_cast<uchar>(128 + 60 * sin(x * 0.05) * cos(y * 0.04));
+			p[1] = cv::saturate_cast<uchar>(128 + 80 * sin(x * 2 * CV_PI / 32 + y * 0.01));
+			p[2] = cv::saturate_cast<uchar>(128 + 80 * cos(y * 2 * CV_PI / 32 + x * 0.01));
+		}
+	}
+	cv::Mat planes[3];
+	cv::split(yuv, planes);
+
+	// The YUV4MPEG2 stream, through a file the reader reads like a pipe.
+	FILE * stream = tmpfile();
+	if ( stream == NULL )
+	{
+		perror("tmpfile");
+		return 2;
+	}
+	fprintf(stream, "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C%s\nFRAME\n", inSize.width, inSize.height, tag.c_str());
+	ChromaSiting siting = CHROMA_SITING_CENTER;
+	if ( tag == "420mpeg2" )
+	{
+		siting = CHROMA_SITING_LEFT;
+	}
+	else if ( tag == "420paldv" )
+	{
+		siting = CHROMA_SITING_TOP_LEFT;
+	}
+	const cv::Mat inU = subsample(planes[1], siting);
+	const cv::Mat inV = subsample(planes[2], siting);
+	fwrite(planes[0].data, 1, planes[0].total(), stream);
+	fwrite(inU.data, 1, inU.total(), stream);
+	fwrite(inV.data, 1, inV.total(), stream);
+	fflush(stream);
+	rewind(stream);
+
+	RawFrameReader reader;
+	cv::Mat frame;
+	if ( !reader.open(fileno(stream), RAW_Y4M, inSize, problem) || !reader.read(frame) )
+	{
+		fprintf(stderr, "C%s: %s\n", tag.c_str(), problem.empty() ? "could not read the frame" : problem.c_str());
+		return 1;
+	}
+	fclose(stream);
+	if ( reader.chromaSiting() != siting )
+	{
+		fprintf(stderr, "C%s: the reader reports chroma siting %d, expected %d\n", tag.c_str(), (int) reader.chromaSiting(), (int) siting);
+		return 1;
+	}
+
+	cv::Mat flattenedYUV;
+	flattener.process(yuv, flattenedYUV);
+	cv::Mat outPlanes[3];
+	cv::split(flattenedYUV, outPlanes);
+	const cv::Mat refUV[2] = { subsample(outPlanes[1], siting), subsample(outPlanes[2], siting) };
+
+	double errors[NUM_CHROMA_SITINGS];
+	for ( int other = 0; other < NUM_CHROMA_SITINGS; other++ )
+	{
+		cv::Mat out;
+		if ( !flattener.processI420(frame, out, false, (ChromaSiting) other) )
+		{
+			fprintf(stderr, "C%s: processI420() refused the frame\n", tag.c_str());
+			return 1;
+		}
+		errors[other] = chromaError(out, outSize, refUV);
+		printf("C%s flattened as siting %d: mean chroma difference %.3f\n", tag.c_str(), other, errors[other]);
+	}
+
+	int failures = errors[siting] > CONST_DOUBLE__CHROMA_TOLERANCE ? 1 : 0;
+	for ( int other = 0; other < NUM_CHROMA_SITINGS; other++ )
+	{
+		if ( other != siting && errors[other] <= 2 * errors[siting] )
+		{
+			printf("C%s: siting %d cannot be told apart from the right one.\n", tag.c_str(), other);
+			failures++;
+		}
+	}
+
+	printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,495 @@
+#include <limits.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "remap_engine.hpp"
+
+//--------------------------------------------------
+
+enum CpuFeature
+{
+	CPU_FEATURE_NONE,
+	CPU_FEATURE_SSE41,
+	CPU_FEATURE_AVX2,
+	CPU_FEATURE_AVX512
+};
+
+//--------------------------------------------------
+
+static bool cpu_has(CpuFeature feature)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	switch ( feature )
+	{
+		case CPU_FEATURE_NONE:   return true;
+		case CPU_FEATURE_SSE41:  return __builtin_cpu_supports("sse4.1");
+		case CPU_FEATURE_AVX2:   return __builtin_cpu_supports("avx2");
+		case CPU_FEATURE_AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+	}
+	return false;
+#else
+	return feature == CPU_FEATURE_NONE;
+#endif
+}
+
+//--------------------------------------------------
+
+struct KernelVariant
+{
+	const char * name;
+	CpuFeature cpuFeature;
+	BicubicRowFunc func;
+};
+
+// Widest first. The last entry runs everywhere.
+static const KernelVariant kernel_variants[] =
+{
+	{ "simd-avx512", CPU_FEATURE_AVX512, remap_bicubic_8uc3_row_avx512 },
+	{ "simd-avx2",   CPU_FEATURE_AVX2,   remap_bicubic_8uc3_row_avx2   },
+	{ "simd-sse4.1", CPU_FEATURE_SSE41,  remap_bicubic_8uc3_row_sse41  },
+	{ "simd-scalar", CPU_FEATURE_NONE,   remap_bicubic_8uc3_row_scalar },
+};
+
+static const int num_kernel_variants = (int) (sizeof(kernel_variants) / sizeof(kernel_variants[0]));
+
+//--------------------------------------------------
+
+Remapper::Remapper() : mapSource(MAP_DENSE), meshStep(0), lensRow(NULL), rowFunc(NULL) {}
+
+//--------------------------------------------------
+
+bool Remapper::isValidEngine(const std::string& engine)
+{
+	if ( engine == "opencv" || engine == "simd" )
+	{
+		return true;
+	}
+	for ( int i = 0; i < num_kernel_variants; i++ )
+	{
+		if ( engine == kernel_variants[i].name )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//--------------------------------------------------
+
+bool Remapper::init(const cv::Mat& map1_, const cv::Mat& map2_, const std::string& engine)
+{
+	mapSource = MAP_DENSE;
+	mapSize = map1_.size();
+	map1 = map1_;
+	map2 = map2_;
+	mesh.release();
+	meshStep = 0;
+	return selectEngine(engine);
+}
+
+//--------------------------------------------------
+
+bool Remapper::initMesh(const cv::Mat& mesh_, int step, const cv::Size& mapSize_, const std::string& engine)
+{
+	mapSource = MAP_MESH;
+	mapSize = mapSize_;
+	map1.release();
+	map2.release();
+	mesh = mesh_;
+	meshStep = step;
+	return selectEngine(engine);
+}
+
+//--------------------------------------------------
+
+bool Remapper::initAnalytic(const LensModel& model, const cv::Size& mapSize_, const std::string& engine)
+{
+	mapSource = MAP_ANALYTIC;
+	mapSize = mapSize_;
+	map1.release();
+	map2.release();
+	mesh.release();
+	meshStep = 0;
+	lens = model;
+	lensRow = lens_model_row_func(lensName);
+	return selectEngine(engine);
+}
+
+//--------------------------------------------------
+
+size_t Remapper::mapBytes() const
+{
+	switch ( mapSource )
+	{
+		case MAP_DENSE:    return map1.total() * map1.elemSize() + map2.total() * map2.elemSize();
+		case MAP_MESH:     return mesh.total() * mesh.elemSize();
+		case MAP_ANALYTIC: return 0;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+
+bool Remapper::selectEngine(const std::string& engine)
+{
+	if ( !isValidEngine(engine) )
+	{
+		return false;
+	}
+	rowFunc = NULL;
+	engineName = "opencv";
+	if ( engine == "opencv" )
+	{
+		return true;
+	}
+
+	// Start at the requested variant (or the widest one for "simd") and take the first one the CPU can run.
+	int i = 0;
+	while ( engine != "simd" && engine != kernel_variants[i].name )
+	{
+		++i;
+	}
+	while ( !cpu_has(kernel_variants[i].cpuFeature) )
+	{
+		++i;
+	}
+	rowFunc = kernel_variants[i].func;
+	engineName = kernel_variants[i].name;
+	return true;
+}
+
+//--------------------------------------------------
+// The kernel is chosen once per frame: the SIMD one for 8-bit BGR, a depth-specialised one for 16-bit
+// and float frames. The built-in kernels only implement a zero border.
+//--------------------------------------------------
+
+BicubicRowFunc Remapper::rowFuncFor(int type) const
+{
+	if ( rowFunc == NULL || borderValue != cv::Scalar() )
+	{
+		return NULL;
+	}
+	return type == CV_8UC3 ? rowFunc : remap_bicubic_row_func(type);
+}
+
+//--------------------------------------------------
+
+void Remapper::useTiles(const cv::Size& tileSize, int numThreads, const cv::Size& srcSize)
+{
+	const int tw = std::max(1, tileSize.width);
+	const int th = std::max(1, tileSize.height);
+
+	tileList.clear();
+	for ( int ty = 0; ty < mapSize.height; ty += th )
+	{
+		for ( int tx = 0; tx < mapSize.width; tx += tw )
+		{
+			RemapTile tile;
+			tile.dst = cv::Rect(tx, ty, std::min(tw, mapSize.width - tx), std::min(th, mapSize.height - ty));
+
+			// The bicubic kernel of map entry (x, y) reads source columns x-1..x+2 and rows y-1..y+2.
+			cv::Mat m1;
+			cv::Mat m2;
+			mapBlock(tile.dst, m1, m2);
+			int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+			for ( int y = 0; y < tile.dst.height; y++ )
+			{
+				const short * xy = m1.ptr<short>(y);
+				for ( int x = 0; x < tile.dst.width; x++ )
+				{
+					minX = std::min(minX, (int) xy[x*2]);
+					maxX = std::max(maxX, (int) xy[x*2]);
+					minY = std::min(minY, (int) xy[x*2 + 1]);
+					maxY = std::max(maxY, (int) xy[x*2 + 1]);
+				}
+			}
+			const int x0 = std::max(minX - 1, 0);
+			const int y0 = std::max(minY - 1, 0);
+			const int x1 = std::min(maxX + 3, srcSize.width);
+			const int y1 = std::min(maxY + 3, srcSize.height);
+			tile.src = (x1 > x0 && y1 > y0) ? cv::Rect(x0, y0, x1 - x0, y1 - y0) : cv::Rect();
+
+			tile.footprintBytes =
+				(size_t) tile.src.area() * 3 +
+				(size_t) tile.dst.area() * (2 * sizeof(short) + sizeof(ushort)) +
+				(size_t) tile.dst.area() * 3;
+			tileList.push_back(tile);
+		}
+	}
+
+	pool = std::make_shared<WorkStealingPool>(numThreads);
+}
+
+//--------------------------------------------------
+
+void Remapper::remap(const cv::Mat& src, cv::Mat& dst, PerfAccumulator * perf) const
+{
+	// cv::remap() threads on its own, out of reach of the counters; with perf, remapAll() runs it per stripe.
+	if ( perf == NULL && tileList.empty() && mapSource == MAP_DENSE && rowFuncFor(src.type()) == NULL )
+	{
+		cv::remap(src, dst, map1, map2, cv::INTER_CUBIC, cv::BORDER_CONSTANT, borderValue);
+		return;
+	}
+	dst.create(mapSize, src.type());
+	remapAll(&src, &dst, 1, perf);
+}
+
+//--------------------------------------------------
+
+void Remapper::remapBatch(const std::vector<cv::Mat>& srcs, std::vector<cv::Mat>& dsts, PerfAccumulator * perf) const
+{
+	dsts.resize(srcs.size());
+	for ( size_t k = 0; k < srcs.size(); k++ )
+	{
+		dsts[k].create(mapSize, srcs[k].type());
+	}
+	if ( !srcs.empty() )
+	{
+		remapAll(&srcs[0], &dsts[0], srcs.size(), perf);
+	}
+}
+
+//--------------------------------------------------
+
+void Remapper::remapAll(const cv::Mat * srcs, cv::Mat * dsts, size_t count, PerfAccumulator * perf) const
+{
+	if ( tileList.empty() )
+	{
+		cv::parallel_for_(cv::Range(0, mapSize.height), [&](const cv::Range& range)
+		{
+			ScopedPerfSample sample(perf);
+			remapRect(srcs, dsts, count, cv::Rect(0, range.start, mapSize.width, range.end - range.start));
+		}, (double) mapSize.area() / (1 << 16));
+		return;
+	}
+
+	pool->run(tileList.size(), [&](size_t i)
+	{
+		ScopedPerfSample sample(perf);
+		remapRect(srcs, dsts, count, tileList[i].dst);
+	});
+}
+
+//--------------------------------------------------
+
+void Remapper::remapRect(const cv::Mat * srcs, cv::Mat * dsts, size_t count, const cv::Rect& rect) const
+{
+	cv::Mat m1;
+	cv::Mat m2;
+	std::vector<BicubicRowArgs> args;
+	std::vector<BicubicRowFunc> funcs;
+	std::vector<size_t> frames;
+	for ( size_t k = 0; k < count; k++ )
+	{
+		const cv::Mat& src = srcs[k];
+		const BicubicRowFunc func = rowFuncFor(src.type());
+		if ( func == NULL )
+		{
+			if ( m1.empty() )
+			{
+				mapBlock(rect, m1, m2);
+			}
+			// dst(rect) already has the right size and type, so cv::remap() writes into it in place.
+			// A region of up to 64K pixels runs on the calling thread, and the map region is still in
+			// cache from the previous frame of the batch.
+			cv::Mat dstRect = dsts[k](rect);
+			cv::remap(src, dstRect, m1, m2, cv::INTER_CUBIC, cv::BORDER_CONSTANT, borderValue);
+			continue;
+		}
+		BicubicRowArgs a;
+		a.src = src.ptr();
+		a.srcStep = src.step;
+		a.srcWidth = src.cols;
+		a.srcHeight = src.rows;
+		a.srcEnd = src.ptr(src.rows - 1) + (size_t) src.cols * src.elemSize();
+		a.count = rect.width;
+		args.push_back(a);
+		funcs.push_back(func);
+		frames.push_back(k);
+	}
+	if ( args.empty() )
+	{
+		return;
+	}
+
+	// One map row is loaded (or generated) once and applied to every frame of the batch before moving
+	// to the next row. Generated rows go to a buffer of one row, which stays in cache.
+	std::vector<short> xyRow;
+	std::vector<ushort> fxyRow;
+	RowScratch scratch;
+	if ( mapSource != MAP_DENSE )
+	{
+		xyRow.resize((size_t) rect.width * 2);
+		fxyRow.resize((size_t) rect.width);
+	}
+	for ( int y = rect.y; y < rect.y + rect.height; y++ )
+	{
+		const short * xy;
+		const ushort * fxy;
+		if ( mapSource == MAP_DENSE )
+		{
+			xy = map1.ptr<short>(y) + rect.x * 2;
+			fxy = map2.ptr<ushort>(y) + rect.x;
+		}
+		else
+		{
+			mapRow(y, rect.x, rect.width, &xyRow[0], &fxyRow[0], scratch);
+			xy = &xyRow[0];
+			fxy = &fxyRow[0];
+		}
+		for ( size_t j = 0; j < args.size(); j++ )
+		{
+			args[j].xy = xy;
+			args[j].fxy = fxy;
+			cv::Mat& dst = dsts[frames[j]];
+			args[j].dst = dst.ptr(y) + rect.x * dst.elemSize();
+			funcs[j](args[j]);
+		}
+	}
+}
+
+//--------------------------------------------------
+// Bilinear interpolation of the grid: source coordinates (u, v) of output pixels [x0, x0 + width) of row y.
+//--------------------------------------------------
+
+static void interpolate_mesh_row(const cv::Mat& mesh, int step, int y, int x0, int width, std::vector<float>& nodes, float * uv)
+{
+	const float inv = 1.f / step;
+	const int i = y / step;
+	const float ty = (y - i * step) * inv;
+	const int j0 = x0 / step;
+	const int j1 = (x0 + width - 1) / step + 1;
+
+	// Blend the two grid rows around y once; the pixels of the row then only interpolate horizontally.
+	nodes.resize((size_t) (j1 - j0 + 1) * 2);
+	const float * r0 = mesh.ptr<float>(i);
+	const float * r1 = mesh.ptr<float>(i + 1);
+	for ( int k = j0 * 2; k < (j1 + 1) * 2; k++ )
+	{
+		nodes[k - j0 * 2] = r0[k] + (r1[k] - r0[k]) * ty;
+	}
+
+	for ( int x = x0; x < x0 + width; x++ )
+	{
+		const int j = x / step;
+		const float tx = (x - j * step) * inv;
+		const float * a = &nodes[(size_t) (j - j0) * 2];
+		uv[(x - x0) * 2]     = a[0] + (a[2] - a[0]) * tx;
+		uv[(x - x0) * 2 + 1] = a[1] + (a[3] - a[1]) * tx;
+	}
+}
+
+//--------------------------------------------------
+
+void Remapper::mapBlock(const cv::Rect& rect, cv::Mat& m1, cv::Mat& m2) const
+{
+	if ( mapSource == MAP_DENSE )
+	{
+		m1 = map1(rect);
+		m2 = map2(rect);
+		return;
+	}
+	m1.create(rect.size(), CV_16SC2);
+	m2.create(rect.size(), CV_16UC1);
+	RowScratch scratch;
+	for ( int y = 0; y < rect.height; y++ )
+	{
+		mapRow(rect.y + y, rect.x, rect.width, m1.ptr<short>(y), m2.ptr<ushort>(y), scratch);
+	}
+}
+
+//--------------------------------------------------
+
+void Remapper::mapRow(int y, int x0, int count, short * xy, ushort * fxy, RowScratch& scratch) const
+{
+	if ( mapSource == MAP_ANALYTIC )
+	{
+		lensRow(lens, y, x0, count, xy, fxy);
+		return;
+	}
+
+	scratch.uv.resize((size_t) count * 2);
+	const float * uv = &scratch.uv[0];
+	interpolate_mesh_row(mesh, meshStep, y, x0, count, scratch.nodes, &scratch.uv[0]);
+
+	// Same fixed-point conversion as cv::initUndistortRectifyMap() uses for CV_16SC2 maps.
+	for ( int x = 0; x < count; x++ )
+	{
+		const int iu = cv::saturate_cast<int>(uv[x*2] * cv::INTER_TAB_SIZE);
+		const int iv = cv::saturate_cast<int>(uv[x*2 + 1] * cv::INTER_TAB_SIZE);
+		xy[x*2]     = cv::saturate_cast<short>(iu >> cv::INTER_BITS);
+		xy[x*2 + 1] = cv::saturate_cast<short>(iv >> cv::INTER_BITS);
+		fxy[x] = (ushort) ((iv & (cv::INTER_TAB_SIZE - 1)) * cv::INTER_TAB_SIZE + (iu & (cv::INTER_TAB_SIZE - 1)));
+	}
+}
+
+//--------------------------------------------------
+
+void Remapper::meshError(const cv::Mat& exactMapXY, double& maxError, double& meanError, cv::Point& where) const
+{
+	maxError = 0;
+	meanError = 0;
+	where = cv::Point();
+	if ( mapSource != MAP_MESH )
+	{
+		return;
+	}
+	std::vector<float> nodes;
+	std::vector<float> uv((size_t) mapSize.width * 2);
+	double sum = 0;
+	for ( int y = 0; y < mapSize.height; y++ )
+	{
+		interpolate_mesh_row(mesh, meshStep, y, 0, mapSize.width, nodes, &uv[0]);
+		const float * exact = exactMapXY.ptr<float>(y);
+		for ( int x = 0; x < mapSize.width; x++ )
+		{
+			const double du = uv[x*2] - exact[x*2];
+			const double dv = uv[x*2 + 1] - exact[x*2 + 1];
+			const double e = std::sqrt(du * du + dv * dv);
+			sum += e;
+			if ( e > maxError )
+			{
+				maxError = e;
+				where = cv::Point(x, y);
+			}
+		}
+	}
+	meanError = sum / std::max(1, mapSize.area());
+}
+
+//--------------------------------------------------
+
+void Remapper::verify(const cv::Size& srcSize, int type, size_t& mismatches, size_t& total, double& maxDifference) const
+{
+	// Random values over the whole range of the depth; float frames are taken to be in [0, 1].
+	const double range = CV_MAT_DEPTH(type) == CV_8U ? 256 : CV_MAT_DEPTH(type) == CV_16U ? 65536 : 1;
+	cv::Mat src(srcSize, type);
+	cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(range));
+
+	cv::Mat m1;
+	cv::Mat m2;
+	mapBlock(cv::Rect(0, 0, mapSize.width, mapSize.height), m1, m2);
+
+	cv::Mat expected;
+	cv::Mat actual;
+	cv::remap(src, expected, m1, m2, cv::INTER_CUBIC, cv::BORDER_CONSTANT, borderValue);
+	remap(src, actual);
+
+	cv::Mat diff;
+	cv::absdiff(expected.reshape(1), actual.reshape(1), diff);
+	cv::minMaxLoc(diff, NULL, &maxDifference);
+	mismatches = (size_t) cv::countNonZero(diff);
+	total = diff.total();
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
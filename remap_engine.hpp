@@ -0,0 +1,168 @@
+#ifndef FLATTEN_REMAP_ENGINE_HPP
+#define FLATTEN_REMAP_ENGINE_HPP
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "lens_model.hpp"
+#include "perf_counters.hpp"
+#include "remap_kernels.hpp"
+#include "work_stealing_pool.hpp"
+
+//--------------------------------------------------
+// Applies the fixed CV_16SC2 + CV_16UC1 maps to frames, using the engine named in the settings:
+//
+//   "opencv"       cv::remap(..., cv::INTER_CUBIC)
+//   "simd"         the built-in bicubic kernel, with the widest instruction set the CPU supports
+//   "simd-avx512"  the built-in kernel limited to one instruction set, for benchmarking;
+//   "simd-avx2"    if the CPU lacks it, the next narrower one is used
+//   "simd-sse4.1"
+//   "simd-scalar"
+//
+// The built-in kernel handles 3-channel 8-bit frames with the instruction set above, and 16-bit and
+// float frames of 1, 3 or 4 channels with depth-specialised kernels (see remap_kernels.hpp); anything
+// else goes to cv::remap(). Both engines produce the same output; verify() checks that on the maps
+// actually in use.
+//
+// By default a frame is split into horizontal stripes by cv::parallel_for_(). After useTiles(), it is
+// split into rectangular tiles instead, run on a work-stealing pool. Because of the lens warp, a stripe
+// near the top or bottom edge reads from a tall, curved band of source rows; a tile reads from a much
+// smaller source rectangle that can stay in cache while the tile is processed.
+//
+// Instead of dense maps, initMesh() takes exact source coordinates on a coarse grid only (see
+// buildRemapMesh()). The fixed-point map entries of each stripe or tile are then interpolated from the
+// grid just before they are used, so the map data that has to come from memory shrinks from tens of
+// megabytes to a few hundred kilobytes. The coordinates are approximate; meshError() measures how far
+// they are from the exact ones.
+//
+// initAnalytic() goes one step further and keeps no map at all: the map entries of each row are
+// computed from the lens model (see lens_model.hpp) right before the row is remapped. This trades the
+// map memory traffic and the map construction at startup for arithmetic.
+//--------------------------------------------------
+
+struct RemapTile
+{
+	cv::Rect dst;          // output pixels
+	cv::Rect src;          // bounding box of the source pixels they read (empty if all fall outside)
+	size_t footprintBytes; // source box + map entries + output pixels, for 3-channel 8-bit frames
+};
+
+class Remapper
+{
+public:
+	Remapper();
+
+	//--------------------------------------------------
+
+	static bool isValidEngine(const std::string& engine);
+
+	// The maps are shared, not copied; they must stay alive as long as the Remapper is used.
+	// Returns false if the engine name is not recognised.
+	bool init(const cv::Mat& map1, const cv::Mat& map2, const std::string& engine);
+
+	// Same as init(), with a CV_32FC2 coordinate grid from buildRemapMesh() instead of dense maps.
+	// mapSize is the size of the output.
+	bool initMesh(const cv::Mat& mesh, int step, const cv::Size& mapSize, const std::string& engine);
+
+	// Same as init(), computing the map entries from the lens model instead of reading them.
+	bool initAnalytic(const LensModel& model, const cv::Size& mapSize, const std::string& engine);
+
+	// "avx2" or "scalar" after initAnalytic(), empty otherwise.
+	const std::string& lensModelName() const { return lensName; }
+
+	// Compares the grid-interpolated coordinates against exact ones (CV_32FC2, one per output pixel).
+	// Reports the largest and the mean Euclidean distance, in source pixels, and where the largest occurs.
+	void meshError(const cv::Mat& exactMapXY, double& maxError, double& meanError, cv::Point& where) const;
+
+	// Bytes of map data the remap reads per frame.
+	size_t mapBytes() const;
+
+	// Switches to tiled scheduling. srcSize is the size of the frames that will be remapped; it is only
+	// used to compute the source bounding box of each tile.
+	void useTiles(const cv::Size& tileSize, int numThreads, const cv::Size& srcSize);
+
+	const std::vector<RemapTile>& tiles() const { return tileList; }
+
+	// dst gets the size of the maps and the type of src. If perf is not NULL, the hardware events of every
+	// thread working on the frame are added to it.
+	void remap(const cv::Mat& src, cv::Mat& dst, PerfAccumulator * perf = NULL) const;
+
+	// Remaps several frames in one pass over the maps: every stripe or tile of the maps is applied to
+	// all frames of the batch while it is in cache, so each map entry is loaded from memory once per
+	// batch instead of once per frame. The output is the same as calling remap() for each frame.
+	// If perf is not NULL, the hardware events of every thread working on the batch are added to it.
+	void remapBatch(const std::vector<cv::Mat>& srcs, std::vector<cv::Mat>& dsts, PerfAccumulator * perf = NULL) const;
+
+	// Remaps the output rectangle rect of count frames. Each dsts[k] must already have the size of the
+	// maps and the type of srcs[k].
+	void remapRect(const cv::Mat * srcs, cv::Mat * dsts, size_t count, const cv::Rect& rect) const;
+
+	// Value of the source pixels outside the frame; zero by default. The built-in kernels only implement
+	// zero, so with any other value every frame goes to cv::remap().
+	void setBorderValue(const cv::Scalar& value) { borderValue = value; }
+
+	// Resolved engine, for example "simd-avx2".
+	const std::string& name() const { return engineName; }
+
+	// Fixed-point map entries of the output rectangle rect: views into the dense maps, or generated into
+	// m1/m2 from the mesh or the lens model.
+	void mapBlock(const cv::Rect& rect, cv::Mat& m1, cv::Mat& m2) const;
+
+	// Remaps a random image of srcSize and the given type with this engine and with cv::remap() and
+	// compares the results.
+	void verify(const cv::Size& srcSize, int type, size_t& mismatches, size_t& total, double& maxDifference) const;
+
+	//--------------------------------------------------
+
+private:
+	bool selectEngine(const std::string& engine);
+
+	// Built-in kernel for frames of this type, NULL if they go to cv::remap().
+	BicubicRowFunc rowFuncFor(int type) const;
+	void remapAll(const cv::Mat * srcs, cv::Mat * dsts, size_t count, PerfAccumulator * perf) const;
+
+	// Buffers reused by mapRow() from one row to the next.
+	struct RowScratch
+	{
+		std::vector<float> nodes;
+		std::vector<float> uv;
+	};
+
+	// Map entries of output pixels x0 .. x0 + count - 1 of row y, for the mesh and analytic sources.
+	void mapRow(int y, int x0, int count, short * xy, ushort * fxy, RowScratch& scratch) const;
+
+	enum MapSource
+	{
+		MAP_DENSE,
+		MAP_MESH,
+		MAP_ANALYTIC
+	};
+
+	MapSource mapSource;
+	cv::Size mapSize;
+	cv::Mat map1;
+	cv::Mat map2;
+	cv::Mat mesh;
+	int meshStep;
+	LensModel lens;
+	LensRowFunc lensRow;
+	std::string lensName;
+	BicubicRowFunc rowFunc; // NULL means cv::remap()
+	std::string engineName;
+	cv::Scalar borderValue;
+
+	std::vector<RemapTile> tileList;         // empty: stripes
+	std::shared_ptr<WorkStealingPool> pool;
+
+};
+
+#endif // FLATTEN_REMAP_ENGINE_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
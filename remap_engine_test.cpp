@@ -0,0 +1,195 @@
+//--------------------------------------------------
+// Checks one remap engine against cv::remap(..., cv::INTER_CUBIC) on the lens profile of a settings file,
+// with dense, mesh and analytic maps, stripes and tiles, and 8-bit, 16-bit and float frames. Any value that
+// differs fails the test. The analytic map entries, computed from the lens model of the profile and of a
+// rational (8 coefficient) variant of a pinhole profile, must also stay within
+// CONST_INT__MAP_GENERATOR_TOLERANCE of OpenCV's dense maps, and their output on a smooth frame within
+// CONST_INT__ANALYTIC_OUTPUT_TOLERANCE of the dense output. ctest runs it once per shipped profile and
+// instruction set:
+//
+//   remap_engine_test flatten-settings.xml simd-avx2
+//
+// The exit status is 0 if every value matches, 1 if any differs, 2 on bad arguments and 77 (skipped) if
+// the CPU does not have the instruction set of the engine.
+//--------------------------------------------------
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "flattener.hpp"
+#include "lens_model.hpp"
+#include "remap_engine.hpp"
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+
+#define CONST_INT__TEST_SKIPPED  77
+
+// Largest difference of an 8-bit value between the analytic and the dense output on a frame that changes
+// by a few levels per pixel; map entries 1/32 pixel apart move such a frame by well under one level.
+#define CONST_INT__ANALYTIC_OUTPUT_TOLERANCE  2
+
+//--------------------------------------------------
+// Flattens frame with the dense maps of OpenCV and with analytic map entries, and compares the map
+// entries and the outputs. Returns the number of failed checks.
+//--------------------------------------------------
+
+static int compareAnalytic(const FlattenerOptions& base, const char * modelName, const cv::Mat& frame)
+{
+	FlattenerOptions denseOptions = base;
+	denseOptions.mapMode = "dense";
+	FlattenerOptions analyticOptions = base;
+	analyticOptions.mapMode = "analytic";
+	Flattener dense;
+	Flattener analytic;
+	std::string problem;
+	if ( !dense.init(denseOptions, problem) || !analytic.init(analyticOptions, problem) )
+	{
+		printf("%s model, analytic maps: %s\n", modelName, problem.c_str());
+		return 1;
+	}
+
+	int failures = 0;
+	const cv::Rect all(cv::Point(0, 0), dense.outputSize());
+	cv::Mat map1;
+	cv::Mat map2;
+	cv::Mat ref1;
+	cv::Mat ref2;
+	analytic.remapper().mapBlock(all, map1, map2);
+	dense.remapper().mapBlock(all, ref1, ref2);
+	size_t mismatches = 0;
+	int maxDifference = 0;
+	compareRemapMaps(map1, map2, ref1, ref2, mismatches, maxDifference);
+	printf("%s, %s model, analytic maps (%s lens rows): %zu of %d entries differ from OpenCV's, max difference %d/%d px\n",
+		analytic.remapper().name().c_str(), modelName, analytic.remapper().lensModelName().c_str(),
+		mismatches, all.area(), maxDifference, cv::INTER_TAB_SIZE);
+	if ( maxDifference > CONST_INT__MAP_GENERATOR_TOLERANCE )
+	{
+		failures++;
+	}
+
+	cv::Mat expected;
+	cv::Mat actual;
+	dense.process(frame, expected);
+	analytic.process(frame, actual);
+	cv::Mat diff;
+	cv::absdiff(expected.reshape(1), actual.reshape(1), diff);
+	double maxOutputDifference = 0;
+	cv::minMaxLoc(diff, NULL, &maxOutputDifference);
+	printf("%s, %s model, analytic maps: max output difference %g against the dense maps\n",
+		analytic.remapper().name().c_str(), modelName, maxOutputDifference);
+	if ( maxOutputDifference > CONST_INT__ANALYTIC_OUTPUT_TOLERANCE )
+	{
+		failures++;
+	}
+	return failures;
+}
+
+//--------------------------------------------------
+
+int main (int argc, char** argv)
+{
+	if ( argc != 3 )
+	{
+		fprintf(stderr, "usage: %s <settings file> <remap engine>\n", argv[0]);
+		return 2;
+	}
+	const std::string settingsPath = argv[1];
+	const std::string engine = argv[2];
+
+	FlattenerOptions base;
+	if ( !readFlattenerOptions(settingsPath, base) )
+	{
+		fprintf(stderr, "Could not open '%s'.\n", settingsPath.c_str());
+		return 2;
+	}
+	base.remapEngine = engine;
+	base.mapGenerator = "opencv";
+	base.mapCacheDirectory.clear();
+
+	static const char * const mapModes[] = { "dense", "mesh", "analytic" };
+	static const char * const schedulers[] = { "rows", "tiled" };
+	static const int types[] = { CV_8UC3, CV_16UC3, CV_32FC3 };
+
+	int failures = 0;
+	for ( size_t m = 0; m < sizeof(mapModes) / sizeof(mapModes[0]); m++ )
+	{
+		for ( size_t s = 0; s < sizeof(schedulers) / sizeof(schedulers[0]); s++ )
+		{
+			FlattenerOptions options = base;
+			options.mapMode = mapModes[m];
+			options.remapScheduler = schedulers[s];
+			Flattener flattener;
+			std::string problem;
+			if ( !flattener.init(options, problem) )
+			{
+				fprintf(stderr, "%s, %s, %s: %s\n", settingsPath.c_str(), mapModes[m], schedulers[s], problem.c_str());
+				return 2;
+			}
+			const Remapper& remapper = flattener.remapper();
+			if ( engine != "simd" && remapper.name() != engine )
+			{
+				printf("%s is not supported by this CPU (it would run as %s); skipped.\n", engine.c_str(), remapper.name().c_str());
+				return CONST_INT__TEST_SKIPPED;
+			}
+
+			for ( size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++ )
+			{
+				size_t mismatches = 0;
+				size_t total = 0;
+				double maxDifference = 0;
+				remapper.verify(options.profile.originalSize, types[t], mismatches, total, maxDifference);
+				printf("%s, %s maps, %s, %s, depth %d: %zu of %zu values differ, max difference %g\n",
+					remapper.name().c_str(), mapModes[m], schedulers[s], settingsPath.c_str(),
+					CV_MAT_DEPTH(types[t]), mismatches, total, maxDifference);
+				if ( mismatches != 0 )
+				{
+					failures++;
+				}
+			}
+		}
+	}
+
+	// A smooth frame, a few levels per pixel at most.
+	const cv::Size inSize = base.profile.originalSize;
+	cv::Mat frame(inSize, CV_8UC3);
+	for ( int y = 0; y < inSize.height; y++ )
+	{
+		for ( int x = 0; x < inSize.width; x++ )
+		{
+			const double v = sin(x * 0.03) * cos(y * 0.02);
+			frame.at<cv::Vec3b>(y, x) = cv::Vec3b(cv::saturate_cast<uchar>(128 + 100 * v),
+				cv::saturate_cast<uchar>(128 - 80 * v), cv::saturate_cast<uchar>(128 + 60 * sin(y * 0.025)));
+		}
+	}
+	failures += compareAnalytic(base, base.profile.useFisheye ? "fisheye" : "pinhole", frame);
+	if ( !base.profile.useFisheye )
+	{
+		// k4, k5 and k6 of the rational model, small enough to keep the lens monotonic over the frame.
+		FlattenerOptions rational = base;
+		cv::Mat given;
+		base.profile.distortionCoefficients.convertTo(given, CV_64F);
+		cv::Mat coefficients = cv::Mat::zeros(8, 1, CV_64F);
+		for ( size_t i = 0; i < std::min(given.total(), (size_t) 5); i++ )
+		{
+			coefficients.at<double>((int) i) = given.ptr<double>()[i];
+		}
+		coefficients.at<double>(5) = 0.02;
+		coefficients.at<double>(6) = 0.01;
+		coefficients.at<double>(7) = 0.005;
+		rational.profile.distortionCoefficients = coefficients;
+		failures += compareAnalytic(rational, "rational", frame);
+	}
+
+	printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,250 @@
+#include <string.h>
+
+#include <mutex>
+
+#include <opencv2/core.hpp>
+
+#include "remap_kernels.hpp"
+
+//--------------------------------------------------
+
+#define CONST_INT__BICUBIC_TAPS            16
+#define CONST_INT__BICUBIC_SIMD_SHORTS     64
+
+//--------------------------------------------------
+
+static short bicubic_weights [ cv::INTER_TAB_SIZE2 * CONST_INT__BICUBIC_TAPS ];
+static float bicubic_weights_float [ cv::INTER_TAB_SIZE2 * CONST_INT__BICUBIC_TAPS ];
+alignas(64) static short bicubic_weights_simd [ cv::INTER_TAB_SIZE2 * CONST_INT__BICUBIC_SIMD_SHORTS ];
+static std::once_flag bicubic_weights_once;
+
+//--------------------------------------------------
+// Same as interpolateCubic() in OpenCV's imgwarp.cpp.
+//--------------------------------------------------
+
+static void interpolate_cubic(float x, float * coeffs)
+{
+	const float A = -0.75f;
+
+	coeffs[0] = ((A*(x + 1) - 5*A)*(x + 1) + 8*A)*(x + 1) - 4*A;
+	coeffs[1] = ((A + 2)*x - (A + 3))*x*x + 1;
+	coeffs[2] = ((A + 2)*(1 - x) - (A + 3))*(1 - x)*(1 - x) + 1;
+	coeffs[3] = 1.f - coeffs[0] - coeffs[1] - coeffs[2];
+}
+
+//--------------------------------------------------
+// Same as the fixed-point branch of initInterTab2D(INTER_CUBIC, true) in OpenCV's imgwarp.cpp,
+// including the correction that makes every 4x4 kernel sum to exactly INTER_REMAP_COEF_SCALE.
+// The float table is that of initInterTab2D(INTER_CUBIC, false): the same products, unrounded.
+//--------------------------------------------------
+
+static void build_bicubic_weights()
+{
+	const int ksize = 4;
+	float tab1d [ cv::INTER_TAB_SIZE * 4 ];
+	const float scale = 1.f / cv::INTER_TAB_SIZE;
+	for ( int i = 0; i < cv::INTER_TAB_SIZE; i++ )
+	{
+		interpolate_cubic(i * scale, tab1d + i * ksize);
+	}
+
+	short * itab = bicubic_weights;
+	float * ftab = bicubic_weights_float;
+	for ( int i = 0; i < cv::INTER_TAB_SIZE; i++ )
+	{
+		for ( int j = 0; j < cv::INTER_TAB_SIZE; j++, itab += ksize * ksize, ftab += ksize * ksize )
+		{
+			int isum = 0;
+			for ( int k1 = 0; k1 < ksize; k1++ )
+			{
+				float vy = tab1d[i*ksize + k1];
+				for ( int k2 = 0; k2 < ksize; k2++ )
+				{
+					float v = vy * tab1d[j*ksize + k2];
+					ftab[k1*ksize + k2] = v;
+					isum += itab[k1*ksize + k2] = cv::saturate_cast<short>(v * cv::INTER_REMAP_COEF_SCALE);
+				}
+			}
+
+			if ( isum != cv::INTER_REMAP_COEF_SCALE )
+			{
+				int diff = isum - cv::INTER_REMAP_COEF_SCALE;
+				int ksize2 = ksize / 2, Mk1 = ksize2, Mk2 = ksize2, mk1 = ksize2, mk2 = ksize2;
+				for ( int k1 = ksize2; k1 < ksize2 + 2; k1++ )
+				{
+					for ( int k2 = ksize2; k2 < ksize2 + 2; k2++ )
+					{
+						if ( itab[k1*ksize + k2] < itab[mk1*ksize + mk2] )
+						{
+							mk1 = k1, mk2 = k2;
+						}
+						else if ( itab[k1*ksize + k2] > itab[Mk1*ksize + Mk2] )
+						{
+							Mk1 = k1, Mk2 = k2;
+						}
+					}
+				}
+				if ( diff < 0 )
+				{
+					itab[Mk1*ksize + Mk2] = (short) (itab[Mk1*ksize + Mk2] - diff);
+				}
+				else
+				{
+					itab[mk1*ksize + mk2] = (short) (itab[mk1*ksize + mk2] - diff);
+				}
+			}
+		}
+	}
+
+	memset(bicubic_weights_simd, 0, sizeof(bicubic_weights_simd));
+	for ( int e = 0; e < cv::INTER_TAB_SIZE2; e++ )
+	{
+		const short * w = bicubic_weights + e * CONST_INT__BICUBIC_TAPS;
+		short * v = bicubic_weights_simd + e * CONST_INT__BICUBIC_SIMD_SHORTS;
+		for ( int row = 0; row < 4; row++ )
+		{
+			short * taps01 = v + row * 8;
+			short * taps23 = v + 32 + row * 8;
+			for ( int c = 0; c < 3; c++ )
+			{
+				taps01[c*2]     = w[row*4 + 0];
+				taps01[c*2 + 1] = w[row*4 + 1];
+				taps23[c*2]     = w[row*4 + 2];
+				taps23[c*2 + 1] = w[row*4 + 3];
+			}
+		}
+	}
+}
+
+//--------------------------------------------------
+
+const short * remap_bicubic_weights()
+{
+	std::call_once(bicubic_weights_once, build_bicubic_weights);
+	return bicubic_weights;
+}
+
+//--------------------------------------------------
+
+const short * remap_bicubic_weights_simd()
+{
+	std::call_once(bicubic_weights_once, build_bicubic_weights);
+	return bicubic_weights_simd;
+}
+
+//--------------------------------------------------
+
+const float * remap_bicubic_weights_float()
+{
+	std::call_once(bicubic_weights_once, build_bicubic_weights);
+	return bicubic_weights_float;
+}
+
+//--------------------------------------------------
+
+void remap_bicubic_8uc3_row_scalar(const BicubicRowArgs& args)
+{
+	const short * wtab = remap_bicubic_weights();
+	for ( int x = 0; x < args.count; x++ )
+	{
+		remap_bicubic_8uc3_pixel_scalar(args, x, wtab);
+	}
+}
+
+//--------------------------------------------------
+// remapBicubic<Cast<float, T>, float, 1>() of OpenCV's imgwarp.cpp for one row, with the channel count
+// known at compile time: the same products summed in the same order, so the result is bit-identical
+// as long as this file is not compiled with FMA contraction. The border is constant zero.
+//--------------------------------------------------
+
+template <typename T, int CN>
+static void remap_bicubic_row(const BicubicRowArgs& a)
+{
+	const float * wtab = remap_bicubic_weights_float();
+	const T * src = (const T *) a.src;
+	const size_t sstep = a.srcStep / sizeof(T);
+	T * dst = (T *) a.dst;
+	const unsigned width1 = a.srcWidth > 3 ? (unsigned) (a.srcWidth - 3) : 0;
+	const unsigned height1 = a.srcHeight > 3 ? (unsigned) (a.srcHeight - 3) : 0;
+
+	for ( int x = 0; x < a.count; x++ )
+	{
+		const int sx = a.xy[x*2] - 1;
+		const int sy = a.xy[x*2 + 1] - 1;
+		const float * w = wtab + (a.fxy[x] & (cv::INTER_TAB_SIZE2 - 1)) * CONST_INT__BICUBIC_TAPS;
+		T * D = dst + x * CN;
+		if ( (unsigned) sx < width1 && (unsigned) sy < height1 )
+		{
+			const T * S = src + sy * sstep + sx * CN;
+			for ( int k = 0; k < CN; k++ )
+			{
+				const T * p = S + k;
+				float sum = p[0]*w[0] + p[CN]*w[1] + p[CN*2]*w[2] + p[CN*3]*w[3];
+				p += sstep;
+				sum += p[0]*w[4] + p[CN]*w[5] + p[CN*2]*w[6] + p[CN*3]*w[7];
+				p += sstep;
+				sum += p[0]*w[8] + p[CN]*w[9] + p[CN*2]*w[10] + p[CN*3]*w[11];
+				p += sstep;
+				sum += p[0]*w[12] + p[CN]*w[13] + p[CN*2]*w[14] + p[CN*3]*w[15];
+				D[k] = cv::saturate_cast<T>(sum);
+			}
+			continue;
+		}
+
+		if ( sx >= a.srcWidth || sx + 4 <= 0 || sy >= a.srcHeight || sy + 4 <= 0 )
+		{
+			for ( int k = 0; k < CN; k++ )
+			{
+				D[k] = 0;
+			}
+			continue;
+		}
+		int xs[4];
+		int ys[4];
+		for ( int i = 0; i < 4; i++ )
+		{
+			xs[i] = (unsigned) (sx + i) < (unsigned) a.srcWidth ? (sx + i) * CN : -1;
+			ys[i] = (unsigned) (sy + i) < (unsigned) a.srcHeight ? sy + i : -1;
+		}
+		for ( int k = 0; k < CN; k++ )
+		{
+			float sum = 0;
+			for ( int i = 0; i < 4; i++ )
+			{
+				if ( ys[i] < 0 )
+				{
+					continue;
+				}
+				const T * S = src + ys[i] * sstep + k;
+				for ( int j = 0; j < 4; j++ )
+				{
+					if ( xs[j] >= 0 )
+					{
+						sum += S[xs[j]] * w[i*4 + j];
+					}
+				}
+			}
+			D[k] = cv::saturate_cast<T>(sum);
+		}
+	}
+}
+
+//--------------------------------------------------
+
+BicubicRowFunc remap_bicubic_row_func(int type)
+{
+	switch ( type )
+	{
+		case CV_16UC1: return remap_bicubic_row<ushort, 1>;
+		case CV_16UC3: return remap_bicubic_row<ushort, 3>;
+		case CV_16UC4: return remap_bicubic_row<ushort, 4>;
+		case CV_32FC1: return remap_bicubic_row<float, 1>;
+		case CV_32FC3: return remap_bicubic_row<float, 3>;
+		case CV_32FC4: return remap_bicubic_row<float, 4>;
+	}
+	return NULL;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,158 @@
+#ifndef FLATTEN_REMAP_KERNELS_HPP
+#define FLATTEN_REMAP_KERNELS_HPP
+
+#include <stddef.h>
+
+#include <opencv2/core.hpp>
+
+//--------------------------------------------------
+// Bicubic remap kernels for 3-channel 8-bit images with fixed-point maps
+// (CV_16SC2 integer coordinates + CV_16UC1 interpolation table indices).
+//
+// The kernels reproduce the arithmetic of cv::remap(..., cv::INTER_CUBIC, cv::BORDER_CONSTANT)
+// exactly: the same 15-bit fixed-point weight table, the same integer accumulation and the same
+// rounding, so the output is bit-identical. Pixels whose 4x4 neighbourhood is not entirely inside
+// the source image go through remap_bicubic_8uc3_pixel_border(), a transcription of OpenCV's
+// border handling with a constant (black) border.
+//
+// 16-bit and float images go through remap_bicubic_row_func(): one kernel per depth and channel count,
+// instantiated from a template, with the floating-point weight table and float accumulation that
+// cv::remap() uses for these depths. These are plain C++; the compiler vectorises what it can.
+//
+// This header is included by translation units compiled with different instruction sets, so
+// everything defined here is static inline.
+//--------------------------------------------------
+
+struct BicubicRowArgs
+{
+	const uchar * src;      // top-left pixel of the source image
+	size_t srcStep;         // bytes per source row
+	int srcWidth;
+	int srcHeight;
+	const uchar * srcEnd;   // one past the last byte of the source image that may be read
+
+	const short * xy;       // CV_16SC2 map entries for this row
+	const ushort * fxy;     // CV_16UC1 map entries for this row
+	uchar * dst;            // first destination pixel of this row
+	int count;              // number of pixels in this row
+};
+
+typedef void (*BicubicRowFunc)(const BicubicRowArgs& args);
+
+//--------------------------------------------------
+
+// OpenCV's fixed-point bicubic weights: 1024 entries of 4x4 shorts, row-major.
+const short * remap_bicubic_weights();
+
+// The same weights laid out for the SIMD kernels: for each entry, eight vectors of 8 shorts.
+// Vectors 0..3 hold the weights of taps 0 and 1 of source rows 0..3, vectors 4..7 the weights of
+// taps 2 and 3. Within a vector the pair is repeated for the B, G and R channels:
+//   (w0, w1, w0, w1, w0, w1, 0, 0)
+// which matches the byte shuffle applied to the source pixels before _mm_madd_epi16().
+const short * remap_bicubic_weights_simd();
+
+// OpenCV's floating-point bicubic weights, used for every depth but 8-bit: 1024 entries of 4x4 floats.
+const float * remap_bicubic_weights_float();
+
+//--------------------------------------------------
+
+void remap_bicubic_8uc3_row_scalar(const BicubicRowArgs& args);
+void remap_bicubic_8uc3_row_sse41(const BicubicRowArgs& args);
+void remap_bicubic_8uc3_row_avx2(const BicubicRowArgs& args);
+void remap_bicubic_8uc3_row_avx512(const BicubicRowArgs& args);
+
+// The kernel for CV_16UC1/3/4 and CV_32FC1/3/4 images; NULL for other types. The source and
+// destination pointers and srcEnd of the arguments are in bytes, as for the 8-bit kernels.
+BicubicRowFunc remap_bicubic_row_func(int type);
+
+//--------------------------------------------------
+
+static inline uchar remap_bicubic_cast(int sum)
+{
+	int v = (sum + (1 << (cv::INTER_REMAP_COEF_BITS - 1))) >> cv::INTER_REMAP_COEF_BITS;
+	return (uchar) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+//--------------------------------------------------
+
+static inline void remap_bicubic_8uc3_pixel_inner(const uchar * S, size_t sstep, const short * w, uchar * D)
+{
+	for ( int k = 0; k < 3; k++ )
+	{
+		const uchar * p = S + k;
+		int sum = p[0]*w[0] + p[3]*w[1] + p[6]*w[2] + p[9]*w[3];
+		p += sstep;
+		sum += p[0]*w[4] + p[3]*w[5] + p[6]*w[6] + p[9]*w[7];
+		p += sstep;
+		sum += p[0]*w[8] + p[3]*w[9] + p[6]*w[10] + p[9]*w[11];
+		p += sstep;
+		sum += p[0]*w[12] + p[3]*w[13] + p[6]*w[14] + p[9]*w[15];
+		D[k] = remap_bicubic_cast(sum);
+	}
+}
+
+//--------------------------------------------------
+
+static inline void remap_bicubic_8uc3_pixel_border(const BicubicRowArgs& a, int sx, int sy, const short * w, uchar * D)
+{
+	if ( sx >= a.srcWidth || sx + 4 <= 0 || sy >= a.srcHeight || sy + 4 <= 0 )
+	{
+		D[0] = D[1] = D[2] = 0;
+		return;
+	}
+	int x[4];
+	int y[4];
+	for ( int i = 0; i < 4; i++ )
+	{
+		x[i] = (unsigned) (sx + i) < (unsigned) a.srcWidth ? (sx + i) * 3 : -1;
+		y[i] = (unsigned) (sy + i) < (unsigned) a.srcHeight ? sy + i : -1;
+	}
+	for ( int k = 0; k < 3; k++ )
+	{
+		int sum = 0;
+		for ( int i = 0; i < 4; i++ )
+		{
+			if ( y[i] < 0 )
+			{
+				continue;
+			}
+			const uchar * S = a.src + y[i] * a.srcStep + k;
+			for ( int j = 0; j < 4; j++ )
+			{
+				if ( x[j] >= 0 )
+				{
+					sum += S[x[j]] * w[i*4 + j];
+				}
+			}
+		}
+		D[k] = remap_bicubic_cast(sum);
+	}
+}
+
+//--------------------------------------------------
+
+// Handles one pixel without SIMD: the border case, and interior pixels that are too close to the end
+// of the source buffer for a 16-byte load.
+static inline void remap_bicubic_8uc3_pixel_scalar(const BicubicRowArgs& a, int x, const short * wtab)
+{
+	const int sx = a.xy[x*2] - 1;
+	const int sy = a.xy[x*2 + 1] - 1;
+	const short * w = wtab + (a.fxy[x] & (cv::INTER_TAB_SIZE2 - 1)) * 16;
+	uchar * D = a.dst + x * 3;
+	const unsigned width1 = a.srcWidth > 3 ? (unsigned) (a.srcWidth - 3) : 0;
+	const unsigned height1 = a.srcHeight > 3 ? (unsigned) (a.srcHeight - 3) : 0;
+	if ( (unsigned) sx < width1 && (unsigned) sy < height1 )
+	{
+		remap_bicubic_8uc3_pixel_inner(a.src + sy * a.srcStep + sx * 3, a.srcStep, w, D);
+	}
+	else
+	{
+		remap_bicubic_8uc3_pixel_border(a, sx, sy, w, D);
+	}
+}
+
+#endif // FLATTEN_REMAP_KERNELS_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
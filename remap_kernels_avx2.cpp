@@ -0,0 +1,79 @@
+//--------------------------------------------------
+// AVX2 bicubic remap kernel. This file is compiled with -mavx2 and only called after a runtime
+// CPU check.
+//
+// Same scheme as the SSE4.1 kernel, with two source rows per 256-bit register: the low lane holds
+// row r and the high lane row r+1. The SIMD weight table stores the vectors of consecutive rows next
+// to each other, so a single 32-byte load fetches the matching weights for both lanes.
+//--------------------------------------------------
+
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "remap_kernels.hpp"
+
+//--------------------------------------------------
+
+static inline __m256i load_two_rows(const uchar * S, size_t sstep)
+{
+	return _mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) S)),
+		_mm_loadu_si128((const __m128i *) (S + sstep)), 1);
+}
+
+//--------------------------------------------------
+
+void remap_bicubic_8uc3_row_avx2(const BicubicRowArgs& a)
+{
+	const short * wtab = remap_bicubic_weights();
+	const short * wsimd = remap_bicubic_weights_simd();
+	const __m256i shuffle01 = _mm256_setr_epi8(
+		0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1,
+		0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+	const __m256i shuffle23 = _mm256_setr_epi8(
+		6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1,
+		6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1);
+	const __m128i round = _mm_set1_epi32(1 << (cv::INTER_REMAP_COEF_BITS - 1));
+	const unsigned width1 = a.srcWidth > 3 ? (unsigned) (a.srcWidth - 3) : 0;
+	const unsigned height1 = a.srcHeight > 3 ? (unsigned) (a.srcHeight - 3) : 0;
+	const size_t sstep = a.srcStep;
+
+	for ( int x = 0; x < a.count; x++ )
+	{
+		const int sx = a.xy[x*2] - 1;
+		const int sy = a.xy[x*2 + 1] - 1;
+		if ( (unsigned) sx >= width1 || (unsigned) sy >= height1 )
+		{
+			remap_bicubic_8uc3_pixel_scalar(a, x, wtab);
+			continue;
+		}
+		const uchar * S = a.src + sy * sstep + sx * 3;
+		if ( S + 3 * sstep + 16 > a.srcEnd )
+		{
+			remap_bicubic_8uc3_pixel_scalar(a, x, wtab);
+			continue;
+		}
+		const short * w = wsimd + (a.fxy[x] & (cv::INTER_TAB_SIZE2 - 1)) * 64;
+
+		__m256i p01 = load_two_rows(S, sstep);
+		__m256i p23 = load_two_rows(S + 2 * sstep, sstep);
+		__m256i acc = _mm256_add_epi32(
+			_mm256_madd_epi16(_mm256_shuffle_epi8(p01, shuffle01), _mm256_load_si256((const __m256i *) (w + 0))),
+			_mm256_madd_epi16(_mm256_shuffle_epi8(p01, shuffle23), _mm256_load_si256((const __m256i *) (w + 32))));
+		acc = _mm256_add_epi32(acc,
+			_mm256_madd_epi16(_mm256_shuffle_epi8(p23, shuffle01), _mm256_load_si256((const __m256i *) (w + 16))));
+		acc = _mm256_add_epi32(acc,
+			_mm256_madd_epi16(_mm256_shuffle_epi8(p23, shuffle23), _mm256_load_si256((const __m256i *) (w + 48))));
+
+		__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		sum = _mm_srai_epi32(_mm_add_epi32(sum, round), cv::INTER_REMAP_COEF_BITS);
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(sum, sum), sum);
+		int bgr = _mm_cvtsi128_si32(packed);
+		memcpy(a.dst + x * 3, &bgr, 3);
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
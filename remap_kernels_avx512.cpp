@@ -0,0 +1,66 @@
+//--------------------------------------------------
+// AVX-512 bicubic remap kernel. This file is compiled with -mavx512f -mavx512bw and only called
+// after a runtime CPU check.
+//
+// Same scheme as the SSE4.1 kernel, with all four source rows in one 512-bit register, one row per
+// 128-bit lane. Two byte shuffles and two _mm512_madd_epi16() cover all 16 taps of a pixel.
+//--------------------------------------------------
+
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "remap_kernels.hpp"
+
+//--------------------------------------------------
+
+void remap_bicubic_8uc3_row_avx512(const BicubicRowArgs& a)
+{
+	const short * wtab = remap_bicubic_weights();
+	const short * wsimd = remap_bicubic_weights_simd();
+	const __m512i shuffle01 = _mm512_broadcast_i32x4(
+		_mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1));
+	const __m512i shuffle23 = _mm512_broadcast_i32x4(
+		_mm_setr_epi8(6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1));
+	const __m128i round = _mm_set1_epi32(1 << (cv::INTER_REMAP_COEF_BITS - 1));
+	const unsigned width1 = a.srcWidth > 3 ? (unsigned) (a.srcWidth - 3) : 0;
+	const unsigned height1 = a.srcHeight > 3 ? (unsigned) (a.srcHeight - 3) : 0;
+	const size_t sstep = a.srcStep;
+
+	for ( int x = 0; x < a.count; x++ )
+	{
+		const int sx = a.xy[x*2] - 1;
+		const int sy = a.xy[x*2 + 1] - 1;
+		if ( (unsigned) sx >= width1 || (unsigned) sy >= height1 )
+		{
+			remap_bicubic_8uc3_pixel_scalar(a, x, wtab);
+			continue;
+		}
+		const uchar * S = a.src + sy * sstep + sx * 3;
+		if ( S + 3 * sstep + 16 > a.srcEnd )
+		{
+			remap_bicubic_8uc3_pixel_scalar(a, x, wtab);
+			continue;
+		}
+		const short * w = wsimd + (a.fxy[x] & (cv::INTER_TAB_SIZE2 - 1)) * 64;
+
+		__m512i p = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *) S));
+		p = _mm512_inserti32x4(p, _mm_loadu_si128((const __m128i *) (S + sstep)), 1);
+		p = _mm512_inserti32x4(p, _mm_loadu_si128((const __m128i *) (S + 2 * sstep)), 2);
+		p = _mm512_inserti32x4(p, _mm_loadu_si128((const __m128i *) (S + 3 * sstep)), 3);
+		__m512i acc = _mm512_add_epi32(
+			_mm512_madd_epi16(_mm512_shuffle_epi8(p, shuffle01), _mm512_load_si512((const void *) (w + 0))),
+			_mm512_madd_epi16(_mm512_shuffle_epi8(p, shuffle23), _mm512_load_si512((const void *) (w + 32))));
+
+		__m256i half = _mm256_add_epi32(_mm512_castsi512_si256(acc), _mm512_extracti64x4_epi64(acc, 1));
+		__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+		sum = _mm_srai_epi32(_mm_add_epi32(sum, round), cv::INTER_REMAP_COEF_BITS);
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(sum, sum), sum);
+		int bgr = _mm_cvtsi128_si32(packed);
+		memcpy(a.dst + x * 3, &bgr, 3);
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,70 @@
+//--------------------------------------------------
+// SSE4.1 bicubic remap kernel. This file is compiled with -msse4.1 and only called after a runtime
+// CPU check.
+//
+// For each destination pixel, each of the 4 source rows contributes 12 bytes (4 pixels x BGR).
+// Two byte shuffles turn them into (B0,B1,G0,G1,R0,R1,0,0) and (B2,B3,G2,G3,R2,R3,0,0) as 16-bit
+// words, and _mm_madd_epi16() against the matching weight vectors yields the per-channel partial
+// sums as 32-bit integers. Integer addition is exact, so the result equals the scalar sum.
+//--------------------------------------------------
+
+#include <string.h>
+
+#include <smmintrin.h>
+
+#include "remap_kernels.hpp"
+
+//--------------------------------------------------
+
+void remap_bicubic_8uc3_row_sse41(const BicubicRowArgs& a)
+{
+	const short * wtab = remap_bicubic_weights();
+	const short * wsimd = remap_bicubic_weights_simd();
+	const __m128i shuffle01 = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+	const __m128i shuffle23 = _mm_setr_epi8(6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1);
+	const __m128i round = _mm_set1_epi32(1 << (cv::INTER_REMAP_COEF_BITS - 1));
+	const unsigned width1 = a.srcWidth > 3 ? (unsigned) (a.srcWidth - 3) : 0;
+	const unsigned height1 = a.srcHeight > 3 ? (unsigned) (a.srcHeight - 3) : 0;
+	const size_t sstep = a.srcStep;
+
+	for ( int x = 0; x < a.count; x++ )
+	{
+		const int sx = a.xy[x*2] - 1;
+		const int sy = a.xy[x*2 + 1] - 1;
+		if ( (unsigned) sx >= width1 || (unsigned) sy >= height1 )
+		{
+			remap_bicubic_8uc3_pixel_scalar(a, x, wtab);
+			continue;
+		}
+		const uchar * S = a.src + sy * sstep + sx * 3;
+		if ( S + 3 * sstep + 16 > a.srcEnd )
+		{
+			remap_bicubic_8uc3_pixel_scalar(a, x, wtab);
+			continue;
+		}
+		const __m128i * w = (const __m128i *) (wsimd + (a.fxy[x] & (cv::INTER_TAB_SIZE2 - 1)) * 64);
+
+		__m128i p = _mm_loadu_si128((const __m128i *) S);
+		__m128i acc = _mm_add_epi32(
+			_mm_madd_epi16(_mm_shuffle_epi8(p, shuffle01), _mm_load_si128(w + 0)),
+			_mm_madd_epi16(_mm_shuffle_epi8(p, shuffle23), _mm_load_si128(w + 4)));
+		p = _mm_loadu_si128((const __m128i *) (S + sstep));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuffle01), _mm_load_si128(w + 1)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuffle23), _mm_load_si128(w + 5)));
+		p = _mm_loadu_si128((const __m128i *) (S + 2 * sstep));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuffle01), _mm_load_si128(w + 2)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuffle23), _mm_load_si128(w + 6)));
+		p = _mm_loadu_si128((const __m128i *) (S + 3 * sstep));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuffle01), _mm_load_si128(w + 3)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(p, shuffle23), _mm_load_si128(w + 7)));
+
+		acc = _mm_srai_epi32(_mm_add_epi32(acc, round), cv::INTER_REMAP_COEF_BITS);
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+		int bgr = _mm_cvtsi128_si32(packed);
+		memcpy(a.dst + x * 3, &bgr, 3);
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "remap_maps.hpp"
+
+//--------------------------------------------------
+
+cv::Matx33d newCameraMatrix(const LensProfile& profile)
+{
+	cv::Mat newCamMat;
+	if ( profile.useFisheye )
+	{
+		cv::fisheye::estimateNewCameraMatrixForUndistortRectify(
+			profile.cameraMatrix, profile.distortionCoefficients, profile.originalSize,
+			cv::Matx33d::eye(), newCamMat, 1, profile.intermedSize);
+	}
+	else
+	{
+		newCamMat = cv::getOptimalNewCameraMatrix(
+			profile.cameraMatrix, profile.distortionCoefficients,
+			profile.originalSize, 1, profile.intermedSize, 0);
+	}
+	cv::Matx33d P;
+	for ( int r = 0; r < 3; r++ )
+	{
+		for ( int c = 0; c < 3; c++ )
+		{
+			P(r, c) = newCamMat.at<double>(r, c);
+		}
+	}
+	return P;
+}
+
+//--------------------------------------------------
+
+static void init_undistort_rectify_map(
+	const LensProfile& profile, const cv::Matx33d& P, const cv::Size& size, int m1type, cv::Mat& map1, cv::Mat& map2)
+{
+	if ( profile.useFisheye )
+	{
+		cv::fisheye::initUndistortRectifyMap(
+			profile.cameraMatrix, profile.distortionCoefficients, cv::Matx33d::eye(),
+			P, size, m1type, map1, map2);
+	}
+	else
+	{
+		cv::initUndistortRectifyMap(
+			profile.cameraMatrix, profile.distortionCoefficients, cv::Mat(),
+			P, size, m1type, map1, map2);
+	}
+}
+
+//--------------------------------------------------
+
+void buildRemapMaps(const LensProfile& profile, cv::Mat& map1, cv::Mat& map2)
+{
+	init_undistort_rectify_map(profile, newCameraMatrix(profile), profile.intermedSize, CV_16SC2, map1, map2);
+
+	// Only the region of interest survives the crop, and cv::remap() computes each destination pixel
+	// from its own map entry alone. Keeping just that window of the maps therefore produces exactly the
+	// same output, without remapping the border that used to be thrown away on every frame.
+	const cv::Rect roi = profile.roi();
+	map1 = map1(roi).clone();
+	map2 = map2(roi).clone();
+}
+
+//--------------------------------------------------
+
+void buildRemapMapsFloat(const LensProfile& profile, cv::Mat& mapxy)
+{
+	cv::Mat mapx;
+	cv::Mat mapy;
+	init_undistort_rectify_map(profile, newCameraMatrix(profile), profile.intermedSize, CV_32FC1, mapx, mapy);
+	const cv::Rect roi = profile.roi();
+	cv::Mat channels[2] = { mapx(roi), mapy(roi) };
+	cv::merge(channels, 2, mapxy);
+}
+
+//--------------------------------------------------
+
+void buildRemapMesh(const LensProfile& profile, int step, cv::Mat& mesh)
+{
+	// Output pixel (j * step, i * step) is intermediate pixel (roi.x + j * step, roi.y + i * step).
+	// Moving the principal point by the region of interest and dividing the first two rows of the new
+	// camera matrix by step makes the map of a small image land exactly on those pixels.
+	const cv::Rect roi = profile.roi();
+	const double s = 1.0 / step;
+	const cv::Matx33d toGrid(
+		s, 0, -roi.x * s,
+		0, s, -roi.y * s,
+		0, 0, 1);
+	const cv::Size gridSize((profile.finalSize.width - 1) / step + 2, (profile.finalSize.height - 1) / step + 2);
+
+	cv::Mat mapx;
+	cv::Mat mapy;
+	init_undistort_rectify_map(profile, toGrid * newCameraMatrix(profile), gridSize, CV_32FC1, mapx, mapy);
+	cv::Mat channels[2] = { mapx, mapy };
+	cv::merge(channels, 2, mesh);
+}
+
+//--------------------------------------------------
+// In 1/32 pixel units, with S the sum of the source coordinates of the n luma pixels the chroma sample
+// sits between (n = 4 for the centre, 2 on the left column, 1 on the top-left pixel): the luma position
+// of the chroma sample is S / n, and chroma sample c sits at luma position 2c + o, with o 1/2 where it is
+// between two luma pixels and 0 where it is on one, so the chroma coordinate is (S / n - 32 o) / 2,
+// rounded to nearest. For the centre, (S / 4 - 16) / 2 = (S - 64) / 8.
+//--------------------------------------------------
+
+void deriveChromaMaps(const cv::Mat& map1, const cv::Mat& map2, ChromaSiting siting, cv::Mat& chroma1, cv::Mat& chroma2)
+{
+	const int columns = siting == CHROMA_SITING_CENTER ? 2 : 1;
+	const int rows = siting == CHROMA_SITING_TOP_LEFT ? 1 : 2;
+	const int n = columns * rows;
+	const int shift = n == 4 ? 3 : n == 2 ? 2 : 1;     // log2(2 n)
+	const int offsetU = columns == 2 ? n * 16 : 0;     // n * 32 o, horizontally
+	const int offsetV = rows == 2 ? n * 16 : 0;        // and vertically
+	const cv::Size size(map1.cols / 2, map1.rows / 2);
+	chroma1.create(size, CV_16SC2);
+	chroma2.create(size, CV_16UC1);
+	for ( int y = 0; y < size.height; y++ )
+	{
+		const short * xy[2] = { map1.ptr<short>(2 * y), map1.ptr<short>(2 * y + 1) };
+		const ushort * fxy[2] = { map2.ptr<ushort>(2 * y), map2.ptr<ushort>(2 * y + 1) };
+		short * cxy = chroma1.ptr<short>(y);
+		ushort * cfxy = chroma2.ptr<ushort>(y);
+		for ( int x = 0; x < size.width; x++ )
+		{
+			int su = 0;
+			int sv = 0;
+			for ( int r = 0; r < rows; r++ )
+			{
+				for ( int c = 2 * x; c < 2 * x + columns; c++ )
+				{
+					su += xy[r][c*2] * cv::INTER_TAB_SIZE + (fxy[r][c] & (cv::INTER_TAB_SIZE - 1));
+					sv += xy[r][c*2 + 1] * cv::INTER_TAB_SIZE + (fxy[r][c] >> cv::INTER_BITS);
+				}
+			}
+			const int u = (su - offsetU + n) >> shift;
+			const int v = (sv - offsetV + n) >> shift;
+			cxy[x*2] = cv::saturate_cast<short>(u >> cv::INTER_BITS);
+			cxy[x*2 + 1] = cv::saturate_cast<short>(v >> cv::INTER_BITS);
+			cfxy[x] = (ushort) ((v & (cv::INTER_TAB_SIZE - 1)) * cv::INTER_TAB_SIZE + (u & (cv::INTER_TAB_SIZE - 1)));
+		}
+	}
+}
+
+//--------------------------------------------------
+
+void compareRemapMaps(
+	const cv::Mat& map1, const cv::Mat& map2, const cv::Mat& ref1, const cv::Mat& ref2,
+	size_t& mismatches, int& maxDifference)
+{
+	mismatches = 0;
+	maxDifference = 0;
+	for ( int y = 0; y < map1.rows; y++ )
+	{
+		const short * xy = map1.ptr<short>(y);
+		const ushort * fxy = map2.ptr<ushort>(y);
+		const short * rxy = ref1.ptr<short>(y);
+		const ushort * rfxy = ref2.ptr<ushort>(y);
+		for ( int x = 0; x < map1.cols; x++ )
+		{
+			const int du = (xy[x*2] - rxy[x*2]) * cv::INTER_TAB_SIZE
+				+ (fxy[x] & (cv::INTER_TAB_SIZE - 1)) - (rfxy[x] & (cv::INTER_TAB_SIZE - 1));
+			const int dv = (xy[x*2 + 1] - rxy[x*2 + 1]) * cv::INTER_TAB_SIZE
+				+ (fxy[x] >> cv::INTER_BITS) - (rfxy[x] >> cv::INTER_BITS);
+			const int d = std::max(std::abs(du), std::abs(dv));
+			if ( d != 0 )
+			{
+				++mismatches;
+				maxDifference = std::max(maxDifference, d);
+			}
+		}
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
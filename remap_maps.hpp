@@ -0,0 +1,76 @@
+#ifndef FLATTEN_REMAP_MAPS_HPP
+#define FLATTEN_REMAP_MAPS_HPP
+
+#include <opencv2/core.hpp>
+
+//--------------------------------------------------
+// Everything that determines the geometry of the flattening: the calibrated lens and the three sizes
+// from the settings file.
+//--------------------------------------------------
+
+struct LensProfile
+{
+	cv::Mat cameraMatrix;
+	cv::Mat distortionCoefficients;
+	bool useFisheye;
+
+	cv::Size originalSize;
+	cv::Size intermedSize;
+	cv::Size finalSize;
+
+	LensProfile() : useFisheye(false) {}
+
+	// Rectangle that defines the region of interest: the centred crop of the intermediate image that
+	// becomes the output.
+	cv::Rect roi() const
+	{
+		return cv::Rect(
+			(intermedSize.width - finalSize.width) >> 1,
+			(intermedSize.height - finalSize.height) >> 1,
+			finalSize.width,
+			finalSize.height);
+	}
+};
+
+//--------------------------------------------------
+
+// Camera matrix of the (undistorted) intermediate image.
+cv::Matx33d newCameraMatrix(const LensProfile& profile);
+
+// Fixed-point maps (CV_16SC2 + CV_16UC1) for the region of interest, as used by cv::remap().
+void buildRemapMaps(const LensProfile& profile, cv::Mat& map1, cv::Mat& map2);
+
+// Exact source coordinates (CV_32FC2) for every output pixel of the region of interest.
+void buildRemapMapsFloat(const LensProfile& profile, cv::Mat& mapxy);
+
+// Exact source coordinates (CV_32FC2) on a coarse grid: element (i, j) belongs to output pixel
+// (j * step, i * step). The grid has one row and column more than needed to cover the output, so
+// every output pixel lies inside a grid cell.
+void buildRemapMesh(const LensProfile& profile, int step, cv::Mat& mesh);
+
+// Where the chroma samples of a 4:2:0 frame sit relative to their 2 x 2 luma pixels, as in the chroma tags
+// of YUV4MPEG2.
+enum ChromaSiting
+{
+	CHROMA_SITING_CENTER,   // "420jpeg", the YUV4MPEG2 default: at the centre of the four
+	CHROMA_SITING_LEFT,     // "420mpeg2": on the left column, halfway between the two rows
+	CHROMA_SITING_TOP_LEFT, // "420paldv": on the top-left luma pixel
+	NUM_CHROMA_SITINGS
+};
+
+// Fixed-point maps for the chroma planes of 4:2:0 frames, half the size of the luma maps in each direction.
+// The source coordinate of a chroma sample is that of its position on the luma grid (the mean of the luma
+// pixels it sits between), moved to the chroma grid.
+void deriveChromaMaps(const cv::Mat& map1, const cv::Mat& map2, ChromaSiting siting, cv::Mat& chroma1, cv::Mat& chroma2);
+
+// Compares two pairs of fixed-point maps of the same size entry by entry. Reports the number of entries
+// whose source coordinate differs and the largest difference along x or y, in 1/32 pixel steps.
+void compareRemapMaps(
+	const cv::Mat& map1, const cv::Mat& map2, const cv::Mat& ref1, const cv::Mat& ref2,
+	size_t& mismatches, int& maxDifference);
+
+#endif // FLATTEN_REMAP_MAPS_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,123 @@
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "stage_timings.hpp"
+
+//--------------------------------------------------
+
+StageTimings::StageTimings()
+{
+	for ( int i = 0; i < NUM_TIMED_STAGES; i++ )
+	{
+		totals[i] = 0;
+	}
+}
+
+//--------------------------------------------------
+
+const char * StageTimings::stageName(TimedStage stage)
+{
+	switch ( stage )
+	{
+		case STAGE_MAP_SETUP:  return "map_setup";
+		case STAGE_DECODE:     return "decode";
+		case STAGE_REMAP:      return "remap";
+		case STAGE_ENCODE:     return "encode";
+		case NUM_TIMED_STAGES: break;
+	}
+	return "unknown";
+}
+
+//--------------------------------------------------
+
+void StageTimings::record(TimedStage stage, double ms, size_t frames)
+{
+	const size_t n = std::max(frames, (size_t) 1);
+	std::lock_guard<std::mutex> lock(mutex);
+	samples[stage].insert(samples[stage].end(), n, ms / n);
+	totals[stage] += ms;
+}
+
+//--------------------------------------------------
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if ( sorted.empty() )
+	{
+		return 0;
+	}
+	const size_t rank = (size_t) ceil(p * sorted.size());
+	return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+
+//--------------------------------------------------
+
+StageStats StageTimings::stats(TimedStage stage) const
+{
+	std::vector<double> sorted;
+	StageStats s;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		sorted = samples[stage];
+		s.totalMs = totals[stage];
+	}
+	std::sort(sorted.begin(), sorted.end());
+	s.count = sorted.size();
+	s.p50Ms = percentile(sorted, 0.50);
+	s.p90Ms = percentile(sorted, 0.90);
+	s.p99Ms = percentile(sorted, 0.99);
+	s.maxMs = sorted.empty() ? 0 : sorted.back();
+	return s;
+}
+
+//--------------------------------------------------
+
+bool StageTimings::writeJson(const std::string& path, double wallMs, const PerfCounts * perf) const
+{
+	FILE * f = fopen(path.c_str(), "w");
+	if ( f == NULL )
+	{
+		return false;
+	}
+	fprintf(f, "{\n");
+	fprintf(f, "  \"wall_ms\": %.3f,\n", wallMs);
+	fprintf(f, "  \"stages\": {\n");
+	for ( int i = 0; i < NUM_TIMED_STAGES; i++ )
+	{
+		const StageStats s = stats((TimedStage) i);
+		fprintf(f, "    \"%s\": { \"count\": %zu, \"total_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, "
+			"\"p99_ms\": %.3f, \"max_ms\": %.3f }%s\n",
+			stageName((TimedStage) i), s.count, s.totalMs, s.p50Ms, s.p90Ms, s.p99Ms, s.maxMs,
+			i + 1 < NUM_TIMED_STAGES ? "," : "");
+	}
+	fprintf(f, "  }%s\n", perf != NULL ? "," : "");
+	if ( perf != NULL )
+	{
+		// Counters that were not available are left out; "multiplexed" ones are scaled up from part of the time.
+		const size_t frames = std::max(stats(STAGE_REMAP).count, (size_t) 1);
+		fprintf(f, "  \"remap_perf_counters\": {");
+		const char * separator = "";
+		for ( int i = 0; i < NUM_PERF_EVENTS; i++ )
+		{
+			if ( perf->has((PerfEvent) i) )
+			{
+				fprintf(f, "%s\n    \"%s\": { \"total\": %llu, \"per_frame\": %.1f, \"multiplexed\": %s }", separator,
+					perfEventName((PerfEvent) i), (unsigned long long) perf->value[i], (double) perf->value[i] / frames,
+					perf->isScaled((PerfEvent) i) ? "true" : "false");
+				separator = ",";
+			}
+		}
+		fprintf(f, "\n  }\n");
+	}
+	fprintf(f, "}\n");
+	return fclose(f) == 0;
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,99 @@
+#ifndef FLATTEN_STAGE_TIMINGS_HPP
+#define FLATTEN_STAGE_TIMINGS_HPP
+
+#include <stddef.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "perf_counters.hpp"
+
+//--------------------------------------------------
+// Latency samples of the processing stages, collected from any thread.
+//
+// Every sample is kept, so the percentiles are exact; a run stores a few samples per frame, which is
+// negligible next to the frames themselves. A batch of frames remapped in one call is recorded as one
+// sample per frame, each with the per-frame share of the batch time.
+//--------------------------------------------------
+
+enum TimedStage
+{
+	STAGE_MAP_SETUP,  // building or loading the maps and initialising the remap engine
+	STAGE_DECODE,     // cv::imread() / Settings::nextImage()
+	STAGE_REMAP,
+	STAGE_ENCODE,     // cv::imwrite() / cv::VideoWriter::write()
+	NUM_TIMED_STAGES
+};
+
+struct StageStats
+{
+	size_t count;
+	double totalMs;
+	double p50Ms;
+	double p90Ms;
+	double p99Ms;
+	double maxMs;
+};
+
+class StageTimings
+{
+public:
+	StageTimings();
+
+	static const char * stageName(TimedStage stage);
+
+	// Records one call that took ms milliseconds and handled frames frames.
+	void record(TimedStage stage, double ms, size_t frames = 1);
+
+	StageStats stats(TimedStage stage) const;
+
+	// End-of-run summary of every stage plus the wall time of the whole run and, if perf is not NULL,
+	// the hardware events of the remap stage.
+	bool writeJson(const std::string& path, double wallMs, const PerfCounts * perf = NULL) const;
+
+	//--------------------------------------------------
+
+private:
+	StageTimings(const StageTimings&);
+	StageTimings& operator=(const StageTimings&);
+
+	mutable std::mutex mutex;
+	std::vector<double> samples[NUM_TIMED_STAGES];
+	double totals[NUM_TIMED_STAGES];
+
+};
+
+//--------------------------------------------------
+// Times the enclosing scope.
+//--------------------------------------------------
+
+class ScopedStageTimer
+{
+public:
+	ScopedStageTimer(StageTimings& timings, TimedStage stage, size_t frames = 1)
+		: timings(timings), stage(stage), frames(frames), start(cv::getTickCount()) {}
+
+	~ScopedStageTimer()
+	{
+		timings.record(stage, (cv::getTickCount() - start) * 1000. / cv::getTickFrequency(), frames);
+	}
+
+private:
+	ScopedStageTimer(const ScopedStageTimer&);
+	ScopedStageTimer& operator=(const ScopedStageTimer&);
+
+	StageTimings& timings;
+	const TimedStage stage;
+	const size_t frames;
+	const int64 start;
+
+};
+
+#endif // FLATTEN_STAGE_TIMINGS_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,145 @@
+#include <algorithm>
+
+#include "work_stealing_pool.hpp"
+
+//--------------------------------------------------
+
+WorkStealingPool::WorkStealingPool(int numThreads) : queuedTasks(0), stopping(false)
+{
+	const size_t n = (size_t) std::max(1, numThreads);
+	for ( size_t i = 0; i < n; ++i )
+	{
+		queues.push_back(new Queue());
+	}
+	for ( size_t i = 0; i < n; ++i )
+	{
+		threads.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+	}
+}
+
+//--------------------------------------------------
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for ( size_t i = 0; i < threads.size(); ++i )
+	{
+		threads[i].join();
+	}
+	for ( size_t i = 0; i < queues.size(); ++i )
+	{
+		delete queues[i];
+	}
+}
+
+//--------------------------------------------------
+
+void WorkStealingPool::run(size_t count, const std::function<void(size_t)>& body)
+{
+	if ( count == 0 )
+	{
+		return;
+	}
+
+	Job job;
+	job.body = &body;
+	job.remaining = count;
+
+	const size_t n = queues.size();
+	for ( size_t q = 0; q < n; ++q )
+	{
+		const size_t first = count * q / n;
+		const size_t last = count * (q + 1) / n;
+		if ( first == last )
+		{
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(queues[q]->mutex);
+		for ( size_t i = first; i < last; ++i )
+		{
+			Task task;
+			task.job = &job;
+			task.index = i;
+			queues[q]->tasks.push_back(task);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queuedTasks += count;
+	}
+	wakeUp.notify_all();
+
+	std::unique_lock<std::mutex> lock(job.mutex);
+	job.done.wait(lock, [&job] { return job.remaining == 0; });
+}
+
+//--------------------------------------------------
+
+bool WorkStealingPool::takeTask(size_t self, Task& task)
+{
+	const size_t n = queues.size();
+	{
+		Queue& own = *queues[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if ( !own.tasks.empty() )
+		{
+			task = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+	for ( size_t k = 1; k < n; ++k )
+	{
+		Queue& victim = *queues[(self + k) % n];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if ( !victim.tasks.empty() )
+		{
+			task = victim.tasks.back();
+			victim.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+//--------------------------------------------------
+
+void WorkStealingPool::workerLoop(size_t self)
+{
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wakeUp.wait(lock, [this] { return stopping || queuedTasks > 0; });
+			if ( queuedTasks == 0 )
+			{
+				return; // stopping, and nothing left to do
+			}
+		}
+
+		Task task;
+		while ( takeTask(self, task) )
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				--queuedTasks;
+			}
+			(*task.job->body)(task.index);
+			// The count drops under the job mutex: run() may return and destroy the job as soon as it
+			// sees zero, so nothing may touch the job after this block.
+			std::lock_guard<std::mutex> lock(task.job->mutex);
+			if ( --task.job->remaining == 0 )
+			{
+				task.job->done.notify_all();
+			}
+		}
+	}
+}
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------
@@ -0,0 +1,78 @@
+#ifndef FLATTEN_WORK_STEALING_POOL_HPP
+#define FLATTEN_WORK_STEALING_POOL_HPP
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------
+// Fixed set of threads, each with its own task deque.
+//
+// run() splits [0, count) into contiguous blocks, one per thread, so neighbouring tasks (neighbouring
+// tiles) start out on the same thread. A thread works through its own deque from the front; when it is
+// empty, it steals from the back of another thread's deque, which takes the tasks farthest away from
+// what that thread is currently working on.
+//
+// Several threads may call run() at the same time; their tasks share the pool.
+//--------------------------------------------------
+
+class WorkStealingPool
+{
+public:
+	explicit WorkStealingPool(int numThreads);
+	~WorkStealingPool();
+
+	int size() const { return (int) threads.size(); }
+
+	// Calls body(i) for every i in [0, count) on the pool threads and returns when all calls are done.
+	void run(size_t count, const std::function<void(size_t)>& body);
+
+	//--------------------------------------------------
+
+private:
+	WorkStealingPool(const WorkStealingPool&);
+	WorkStealingPool& operator=(const WorkStealingPool&);
+
+	struct Job
+	{
+		const std::function<void(size_t)> * body;
+		size_t remaining; // guarded by mutex
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+
+	struct Task
+	{
+		Job * job;
+		size_t index;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	bool takeTask(size_t self, Task& task);
+	void workerLoop(size_t self);
+
+	std::vector<Queue *> queues;
+	std::vector<std::thread> threads;
+
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	size_t queuedTasks; // guarded by sleepMutex
+	bool stopping;      // guarded by sleepMutex
+
+};
+
+#endif // FLATTEN_WORK_STEALING_POOL_HPP
+
+//--------------------------------------------------
+// end of this file
+//--------------------------------------------------